@@ -0,0 +1,656 @@
+/*
+ * gitlite_bench: end-to-end timings of the gitlite executable.
+ *
+ * Builds a synthetic repository of the requested shape in a temporary
+ * directory (through libgitlite, in process), then runs every timed command
+ * as its own `gitlite` process, the way a user would, --reps times. The
+ * untimed preparation before each run (editing files, resetting a branch,
+ * pushing from a peer) also goes through the library.
+ *
+ * Results are printed as a table and written as JSON (milliseconds):
+ *
+ *   {
+ *     "config": {"files": 200, ...},
+ *     "results": {
+ *       "add": {"reps": 20, "min_ms": ..., "p50_ms": ..., "p90_ms": ..., "p99_ms": ..., "max_ms": ..., "mean_ms": ...},
+ *       ...
+ *     }
+ *   }
+ *
+ * --baseline=<json> compares each command's p50 against a previous run and
+ * exits with status 1 when one got slower by more than --threshold percent.
+ */
+
+#include "Gitlite.hpp"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef GITLITE_EXE
+#define GITLITE_EXE "gitlite"
+#endif
+
+namespace {
+    const char* USAGE =
+        "Usage: gitlite_bench [options]\n"
+        "  repository shape:\n"
+        "    --files=N             tracked files (200)\n"
+        "    --min-size=BYTES      smallest file (64)\n"
+        "    --max-size=BYTES      largest file, sizes are log-uniform in between (65536)\n"
+        "    --commits=N           commits after the initial import (60)\n"
+        "    --branches=N          side branches the commits rotate over (3)\n"
+        "    --merge-every=N       merge a side branch into master every N commits, 0 = never (10)\n"
+        "    --files-per-commit=N  files edited by each commit (3)\n"
+        "    --seed=N              random seed (1)\n"
+        "  measurement:\n"
+        "    --reps=N              runs per command (20)\n"
+        "    --only=a,b,...        time only these commands\n"
+        "    --gitlite=PATH        executable to time (the one built next to this tool)\n"
+        "    --out=FILE            write the JSON report to FILE\n"
+        "    --baseline=FILE       compare p50 against an earlier report\n"
+        "    --threshold=PCT       allowed p50 slowdown against the baseline (15)\n"
+        "    --keep                keep the generated repositories\n";
+
+    const std::vector<std::string> COMMANDS = {
+        "add", "commit", "status", "log", "global-log", "find",
+        "checkout", "reset", "merge", "push", "fetch"
+    };
+
+    struct Config {
+        int files = 200;
+        size_t min_size = 64;
+        size_t max_size = 65536;
+        int commits = 60;
+        int branches = 3;
+        int merge_every = 10;
+        int files_per_commit = 3;
+        unsigned seed = 1;
+        int reps = 20;
+        std::vector<std::string> only;
+        std::string gitlite = GITLITE_EXE;
+        std::string out;
+        std::string baseline;
+        double threshold = 15;
+        bool keep = false;
+    };
+
+    struct Summary {
+        int reps = 0;
+        double min = 0, p50 = 0, p90 = 0, p99 = 0, max = 0, mean = 0;
+    };
+
+    double seconds(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    //nearest rank on SAMPLES (ms)
+    Summary summarize(std::vector<double> samples) {
+        Summary s;
+        if (samples.empty()) return s;
+        std::sort(samples.begin(), samples.end());
+        auto rank = [&samples](double p) {
+            size_t i = static_cast<size_t>(std::ceil(p / 100 * samples.size()));
+            return samples[std::min(samples.size() - 1, i == 0 ? 0 : i - 1)];
+        };
+        s.reps = static_cast<int>(samples.size());
+        s.min = samples.front();
+        s.max = samples.back();
+        s.p50 = rank(50);
+        s.p90 = rank(90);
+        s.p99 = rank(99);
+        double total = 0;
+        for (double v : samples) total += v;
+        s.mean = total / samples.size();
+        return s;
+    }
+
+    //runs `gitlite ARGS` in DIR, returns wall time in ms. stdout and stderr go to
+    //OUTPUT_FILE: gitlite exits 0 after an error too, so callers check what it printed
+    double timeProcess(const std::string& exe, const std::string& dir, const std::vector<std::string>& args,
+                       const std::string& output_file) {
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>("gitlite"));
+        for (const std::string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw GitliteException("fork failed");
+        }
+        if (pid == 0) {
+            int out_fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out_fd < 0) _exit(127);
+            dup2(out_fd, STDOUT_FILENO);
+            dup2(out_fd, STDERR_FILENO);
+            if (chdir(dir.c_str()) != 0) _exit(127);
+            execv(exe.c_str(), argv.data());
+            _exit(127);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        double ms = seconds(start) * 1000;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+            throw GitliteException("cannot run " + exe);
+        }
+        if (WEXITSTATUS(status) != 0) {
+            throw GitliteException("gitlite " + args[0] + " exited with status " + std::to_string(WEXITSTATUS(status)));
+        }
+        return ms;
+    }
+
+    //one repository driven in process through libgitlite
+    class Workspace {
+    private:
+        std::string path;
+        Repository repo;
+        CommandRunner runner;
+
+    public:
+        explicit Workspace(const std::string& dir) : path(dir), runner(repo) {
+            Utils::createDirectories(path);
+        }
+
+        const std::string& dir() const { return path; }
+
+        //false if the command reported an error, its message in ERROR
+        bool tryGit(const std::vector<std::string>& args, std::string& error) {
+            if (chdir(path.c_str()) != 0) {
+                throw GitliteException("cannot enter " + path);
+            }
+            std::ostringstream sink;
+            std::streambuf* saved = std::cout.rdbuf(sink.rdbuf());
+            bool ok = true;
+            try {
+                runner.run(args);
+            } catch (const GitliteException& e) {
+                error = e.what();
+                ok = false;
+            }
+            std::cout.rdbuf(saved);
+            return ok;
+        }
+
+        //a preparation step: an error means the benchmark is not measuring what it should
+        void git(const std::vector<std::string>& args) {
+            std::string error;
+            if (!tryGit(args, error)) {
+                std::string cmd;
+                for (const std::string& a : args) cmd += " " + a;
+                throw GitliteException("setup step `gitlite" + cmd + "` failed in " + path + ": " + error);
+            }
+        }
+
+        void write(const std::string& file, const std::string& content) {
+            Utils::writeContents(Utils::join(path, file), content);
+        }
+
+        std::string head() {
+            if (chdir(path.c_str()) != 0) {
+                throw GitliteException("cannot enter " + path);
+            }
+            return RefManager().resolveHead().hex();
+        }
+
+        std::string branch() {
+            if (chdir(path.c_str()) != 0) {
+                throw GitliteException("cannot enter " + path);
+            }
+            return RefManager().getCurrentBranchName();
+        }
+
+        //hash of REF_NAME in this repository, "" if absent
+        std::string ref(const std::string& refName) {
+            ObjectId oid = RemoteRefManager(Utils::join(path, ".gitlite")).resolveRef(refName);
+            return oid.isNull() ? "" : oid.hex();
+        }
+
+        void checkout(const std::string& branchName) {
+            if (branch() != branchName) git({"checkout", branchName});
+        }
+    };
+
+    class Generator {
+    private:
+        const Config& cfg;
+        std::mt19937 rng;
+        std::vector<size_t> sizes;
+        int edits = 0;
+
+    public:
+        explicit Generator(const Config& config) : cfg(config), rng(config.seed) {}
+
+        static std::string fileName(int i) {
+            return "f" + std::to_string(i) + ".txt";
+        }
+
+        //log-uniform between min and max
+        size_t drawSize() {
+            double lo = std::log(static_cast<double>(std::max<size_t>(1, cfg.min_size)));
+            double hi = std::log(static_cast<double>(std::max(cfg.min_size, cfg.max_size)));
+            std::uniform_real_distribution<double> d(lo, hi);
+            return static_cast<size_t>(std::exp(d(rng)));
+        }
+
+        //text lines, so that line based features see realistic input
+        std::string content(size_t size) {
+            static const char* WORDS[] = {"alpha", "beta", "gamma", "delta", "merge", "commit",
+                                          "blob", "tree", "index", "branch", "ref", "object"};
+            std::uniform_int_distribution<int> word(0, 11);
+            std::string text = "version " + std::to_string(++edits) + "\n";
+            while (text.size() < size) {
+                for (int w = 0; w < 8; ++w) {
+                    text += WORDS[word(rng)];
+                    text += w == 7 ? '\n' : ' ';
+                }
+            }
+            text.resize(size);
+            return text;
+        }
+
+        //rewrite file I with new content of its usual size and stage it
+        void edit(Workspace& ws, int i) {
+            ws.write(fileName(i), content(sizes[i]));
+            ws.git({"add", fileName(i)});
+        }
+
+        //file I is only ever edited on lane I % (branches + 1); lane 0 is master.
+        //keeps every generated merge free of conflicts
+        int pick(int lane) {
+            int lanes = cfg.branches + 1;
+            int per_lane = std::max(1, cfg.files / lanes);
+            std::uniform_int_distribution<int> d(0, per_lane - 1);
+            int i = d(rng) * lanes + lane;
+            return i < cfg.files ? i : lane % cfg.files;
+        }
+
+        void commitOn(Workspace& ws, int lane, const std::string& message) {
+            for (int k = 0; k < cfg.files_per_commit; ++k) {
+                edit(ws, pick(lane));
+            }
+            ws.git({"commit", message});
+        }
+
+        static std::string branchName(int lane) {
+            return lane == 0 ? "master" : "b" + std::to_string(lane);
+        }
+
+        void generate(Workspace& ws) {
+            ws.git({"init"});
+            for (int i = 0; i < cfg.files; ++i) {
+                sizes.push_back(drawSize());
+                ws.write(fileName(i), content(sizes[i]));
+                ws.git({"add", fileName(i)});
+            }
+            ws.git({"commit", "import"});
+            for (int b = 1; b <= cfg.branches; ++b) {
+                ws.git({"branch", branchName(b)});
+            }
+
+            int lanes = cfg.branches + 1;
+            int merged = 0;
+            for (int c = 1; c <= cfg.commits; ++c) {
+                int lane = c % lanes;
+                ws.checkout(branchName(lane));
+                commitOn(ws, lane, "commit " + std::to_string(c));
+                if (cfg.branches > 0 && cfg.merge_every > 0 && c % cfg.merge_every == 0) {
+                    ws.checkout("master");
+                    //a side branch with nothing new since its last merge is fine
+                    std::string error;
+                    if (!ws.tryGit({"merge", branchName(merged++ % cfg.branches + 1)}, error) &&
+                        error != "Given branch is an ancestor of the current branch.") {
+                        throw GitliteException("generating: merge failed: " + error);
+                    }
+                }
+            }
+            ws.checkout("master");
+        }
+    };
+
+    //checks of a timed run: what it printed -> "" if it did what it should, else why not
+    using Check = std::function<std::string(const std::string& output)>;
+
+    //the command printed nothing, as gitlite does on success for most commands
+    std::string silent(const std::string& output) {
+        return output.empty() ? "" : "unexpected output: " + output.substr(0, 200);
+    }
+
+    //the output starts with PREFIX
+    Check startsWith(const std::string& prefix) {
+        return [prefix](const std::string& output) -> std::string {
+            if (output.compare(0, prefix.size(), prefix) == 0) return "";
+            return "unexpected output: " + output.substr(0, 200);
+        };
+    }
+
+    //"" if ACTUAL is EXPECTED, else a message saying what WHAT is instead
+    std::string expectEqual(const std::string& what, const std::string& actual, const std::string& expected) {
+        return actual == expected ? "" : what + " is " + actual + ", expected " + expected;
+    }
+
+    class Bench {
+    private:
+        const Config& cfg;
+        std::string output_file;
+        std::map<std::string, Summary> results;
+
+        bool wanted(const std::string& name) const {
+            return cfg.only.empty() || std::find(cfg.only.begin(), cfg.only.end(), name) != cfg.only.end();
+        }
+
+    public:
+        Bench(const Config& config, std::string outputFile) : cfg(config), output_file(std::move(outputFile)) {}
+
+        const std::map<std::string, Summary>& getResults() const { return results; }
+
+        //PREPARE runs untimed before each rep and returns the command to time. CHECK then
+        //looks at its output and the repositories: a failed run is an error, not a sample
+        void measure(const std::string& name, const std::string& dir,
+                     const std::function<std::vector<std::string>(int)>& prepare, const Check& check) {
+            if (!wanted(name)) return;
+            std::vector<double> samples;
+            for (int rep = 0; rep < cfg.reps; ++rep) {
+                std::vector<std::string> args = prepare(rep);
+                samples.push_back(timeProcess(cfg.gitlite, dir, args, output_file));
+                std::string problem = check(Utils::readContentsAsString(output_file));
+                if (!problem.empty()) {
+                    throw GitliteException(name + " (rep " + std::to_string(rep) + ") failed: " + problem);
+                }
+            }
+            results[name] = summarize(samples);
+        }
+    };
+
+    std::string makeTempDir() {
+        const char* tmp = std::getenv("TMPDIR");
+        std::string templ = std::string(tmp && *tmp ? tmp : "/tmp") + "/gitlite-bench-XXXXXX";
+        std::vector<char> buf(templ.begin(), templ.end());
+        buf.push_back('\0');
+        if (!mkdtemp(buf.data())) {
+            throw GitliteException("cannot create a temporary directory");
+        }
+        return std::string(buf.data());
+    }
+
+    std::string absolutePath(const std::string& path) {
+        if (path.empty() || path[0] == '/') return path;
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd))) return path;
+        return Utils::join(cwd, path);
+    }
+
+    std::vector<std::string> splitList(const std::string& list) {
+        std::vector<std::string> out;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (!item.empty()) out.push_back(item);
+        }
+        return out;
+    }
+
+    bool parseArgs(int argc, char* argv[], Config& cfg) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            size_t eq = arg.find('=');
+            std::string key = arg.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            try {
+                if (key == "--files") cfg.files = std::stoi(value);
+                else if (key == "--min-size") cfg.min_size = std::stoul(value);
+                else if (key == "--max-size") cfg.max_size = std::stoul(value);
+                else if (key == "--commits") cfg.commits = std::stoi(value);
+                else if (key == "--branches") cfg.branches = std::stoi(value);
+                else if (key == "--merge-every") cfg.merge_every = std::stoi(value);
+                else if (key == "--files-per-commit") cfg.files_per_commit = std::stoi(value);
+                else if (key == "--seed") cfg.seed = static_cast<unsigned>(std::stoul(value));
+                else if (key == "--reps") cfg.reps = std::stoi(value);
+                else if (key == "--only") cfg.only = splitList(value);
+                else if (key == "--gitlite") cfg.gitlite = value;
+                else if (key == "--out") cfg.out = value;
+                else if (key == "--baseline") cfg.baseline = value;
+                else if (key == "--threshold") cfg.threshold = std::stod(value);
+                else if (key == "--keep") cfg.keep = true;
+                else return false;
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        for (const std::string& name : cfg.only) {
+            if (std::find(COMMANDS.begin(), COMMANDS.end(), name) == COMMANDS.end()) return false;
+        }
+        return cfg.files > 0 && cfg.reps > 0 && cfg.branches >= 0 && cfg.files_per_commit > 0;
+    }
+
+    std::string toJson(const Config& cfg, double generate_seconds, const std::map<std::string, Summary>& results) {
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        out << "{\n  \"config\": {\"files\": " << cfg.files
+            << ", \"min_size\": " << cfg.min_size << ", \"max_size\": " << cfg.max_size
+            << ", \"commits\": " << cfg.commits << ", \"branches\": " << cfg.branches
+            << ", \"merge_every\": " << cfg.merge_every << ", \"files_per_commit\": " << cfg.files_per_commit
+            << ", \"seed\": " << cfg.seed << ", \"reps\": " << cfg.reps
+            << ", \"generate_s\": " << generate_seconds << "},\n";
+        out << "  \"results\": {\n";
+        size_t n = 0;
+        for (const std::string& name : COMMANDS) {
+            auto it = results.find(name);
+            if (it == results.end()) continue;
+            const Summary& s = it->second;
+            out << "    \"" << name << "\": {\"reps\": " << s.reps
+                << ", \"min_ms\": " << s.min << ", \"p50_ms\": " << s.p50
+                << ", \"p90_ms\": " << s.p90 << ", \"p99_ms\": " << s.p99
+                << ", \"max_ms\": " << s.max << ", \"mean_ms\": " << s.mean << "}"
+                << (++n < results.size() ? ",\n" : "\n");
+        }
+        out << "  }\n}\n";
+        return out.str();
+    }
+
+    //command -> p50_ms of a report written by toJson (one command per line)
+    std::map<std::string, double> readBaseline(const std::string& path) {
+        std::map<std::string, double> p50;
+        std::stringstream ss(Utils::readContentsAsString(path));
+        std::string line;
+        while (std::getline(ss, line)) {
+            size_t open = line.find('"');
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            size_t key = line.find("\"p50_ms\": ");
+            if (close == std::string::npos || key == std::string::npos) continue;
+            p50[line.substr(open + 1, close - open - 1)] = std::stod(line.substr(key + 10));
+        }
+        return p50;
+    }
+
+    //prints the table, returns the number of regressions
+    int report(const Config& cfg, const std::map<std::string, Summary>& results) {
+        std::map<std::string, double> base;
+        if (!cfg.baseline.empty()) {
+            base = readBaseline(cfg.baseline);
+        }
+        int regressions = 0;
+        std::printf("%-12s %5s %9s %9s %9s %9s", "command", "reps", "p50 ms", "p90 ms", "p99 ms", "max ms");
+        if (!base.empty()) std::printf(" %11s %8s", "base p50", "change");
+        std::printf("\n");
+        for (const std::string& name : COMMANDS) {
+            auto it = results.find(name);
+            if (it == results.end()) continue;
+            const Summary& s = it->second;
+            std::printf("%-12s %5d %9.2f %9.2f %9.2f %9.2f", name.c_str(), s.reps, s.p50, s.p90, s.p99, s.max);
+            auto b = base.find(name);
+            if (b != base.end() && b->second > 0) {
+                double change = (s.p50 - b->second) / b->second * 100;
+                bool slower = change > cfg.threshold;
+                regressions += slower;
+                std::printf(" %11.2f %+7.1f%%%s", b->second, change, slower ? "  REGRESSION" : "");
+            }
+            std::printf("\n");
+        }
+        return regressions;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Config cfg;
+    if (!parseArgs(argc, argv, cfg)) {
+        std::fputs(USAGE, stderr);
+        return 2;
+    }
+    cfg.gitlite = absolutePath(cfg.gitlite);
+    cfg.out = absolutePath(cfg.out);
+    cfg.baseline = absolutePath(cfg.baseline);
+
+    std::string root;
+    try {
+        root = makeTempDir();
+        Workspace main_ws(Utils::join(root, "work"));
+        Workspace remote_ws(Utils::join(root, "remote"));
+        Workspace peer_ws(Utils::join(root, "peer"));
+        Generator gen(cfg);
+        Bench bench(cfg, Utils::join(root, "output"));
+
+        auto start = std::chrono::steady_clock::now();
+        gen.generate(main_ws);
+        double generate_seconds = seconds(start);
+        std::printf("generated %d files, %d commits, %d branches in %.2fs (%s)\n",
+                    cfg.files, cfg.commits, cfg.branches, generate_seconds, root.c_str());
+
+        bench.measure("add", main_ws.dir(), [&](int) {
+            int i = gen.pick(0);
+            main_ws.write(Generator::fileName(i), gen.content(gen.drawSize()));
+            return std::vector<std::string>{"add", Generator::fileName(i)};
+        }, silent);
+        std::string before_commits = main_ws.head();
+        std::string parent;
+        bench.measure("commit", main_ws.dir(), [&](int rep) {
+            gen.edit(main_ws, gen.pick(0));
+            parent = main_ws.head();
+            return std::vector<std::string>{"commit", "bench commit " + std::to_string(rep)};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() && main_ws.head() == parent ? "HEAD did not move" : problem;
+        });
+        //whatever the add runs staged (everything, when commit was not timed)
+        std::string error;
+        main_ws.tryGit({"commit", "bench leftovers"}, error);
+        std::string head = main_ws.head();
+
+        bench.measure("status", main_ws.dir(), [](int) {
+            return std::vector<std::string>{"status"};
+        }, startsWith("=== Branches ===\n"));
+        bench.measure("log", main_ws.dir(), [](int) {
+            return std::vector<std::string>{"log"};
+        }, startsWith("===\ncommit " + head + "\n"));
+        bench.measure("global-log", main_ws.dir(), [](int) {
+            return std::vector<std::string>{"global-log"};
+        }, startsWith("===\ncommit "));
+        bench.measure("find", main_ws.dir(), [](int) {
+            return std::vector<std::string>{"find", "import"};
+        }, [](const std::string& output) -> std::string {
+            return output.size() == 41 && output.back() == '\n' ? "" : "unexpected output: " + output.substr(0, 200);
+        });
+        //a side branch to switch to; without any, one at HEAD (checkout still rewrites the index)
+        std::string side = "b1";
+        if (cfg.branches == 0) {
+            side = "bench-checkout";
+            main_ws.git({"branch", side});
+        }
+        std::string checkout_to;
+        bench.measure("checkout", main_ws.dir(), [&](int rep) {
+            checkout_to = rep % 2 == 0 ? side : "master";
+            return std::vector<std::string>{"checkout", checkout_to};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() ? expectEqual("current branch", main_ws.branch(), checkout_to) : problem;
+        });
+        main_ws.checkout("master");
+        std::string reset_to;
+        bench.measure("reset", main_ws.dir(), [&](int rep) {
+            reset_to = rep % 2 == 0 ? before_commits : head;
+            return std::vector<std::string>{"reset", reset_to};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() ? expectEqual("HEAD", main_ws.head(), reset_to) : problem;
+        });
+        main_ws.git({"reset", head});
+
+        //master and bench-merge both move on from HEAD, touching different files
+        main_ws.git({"branch", "bench-merge"});
+        main_ws.git({"checkout", "bench-merge"});
+        gen.commitOn(main_ws, cfg.branches > 0 ? 1 : 0, "bench merge side");
+        main_ws.git({"checkout", "master"});
+        gen.commitOn(main_ws, 0, "bench merge base");
+        std::string merge_base = main_ws.head();
+        bench.measure("merge", main_ws.dir(), [&](int) {
+            main_ws.git({"reset", merge_base});
+            return std::vector<std::string>{"merge", "bench-merge"};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() && main_ws.head() == merge_base ? "no merge commit" : problem;
+        });
+        main_ws.git({"reset", merge_base});
+
+        remote_ws.git({"init"});
+        main_ws.git({"add-remote", "origin", "../remote/.gitlite"});
+        main_ws.git({"push", "origin", "master"});
+        bench.measure("push", main_ws.dir(), [&](int rep) {
+            gen.commitOn(main_ws, 0, "bench push " + std::to_string(rep));
+            return std::vector<std::string>{"push", "origin", "master"};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() ? expectEqual("remote master", remote_ws.ref("refs/heads/master"), main_ws.head())
+                                   : problem;
+        });
+
+        peer_ws.git({"init"});
+        peer_ws.git({"add-remote", "origin", "../remote/.gitlite"});
+        bench.measure("fetch", main_ws.dir(), [&](int rep) {
+            for (int k = 0; k < cfg.files_per_commit; ++k) {
+                peer_ws.write("p" + std::to_string(k) + ".txt", gen.content(gen.drawSize()));
+                peer_ws.git({"add", "p" + std::to_string(k) + ".txt"});
+            }
+            peer_ws.git({"commit", "peer " + std::to_string(rep)});
+            peer_ws.git({"push", "origin", "peer"});
+            return std::vector<std::string>{"fetch", "origin", "peer"};
+        }, [&](const std::string& output) {
+            std::string problem = silent(output);
+            return problem.empty() ? expectEqual("origin/peer", main_ws.ref("refs/remotes/origin/peer"), peer_ws.head())
+                                   : problem;
+        });
+
+        int regressions = report(cfg, bench.getResults());
+        if (!cfg.out.empty()) {
+            Utils::writeContents(cfg.out, toJson(cfg, generate_seconds, bench.getResults()));
+        }
+        if (cfg.keep) {
+            std::printf("repositories kept in %s\n", root.c_str());
+        } else {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+        if (regressions > 0) {
+            std::printf("%d command(s) slower than the baseline by more than %.0f%%\n", regressions, cfg.threshold);
+            return 1;
+        }
+    } catch (const GitliteException& e) {
+        std::fprintf(stderr, "gitlite_bench: %s\n", e.what());
+        if (!root.empty() && !cfg.keep) std::system(("rm -rf '" + root + "'").c_str());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,490 @@
+/*
+ * gitlite_micro_bench: per-component timings, to tell which layer moved when
+ * gitlite_bench reports a regression.
+ *
+ * Every case runs a calibration pass that grows the iteration count until one
+ * batch takes at least --min-time, then times --repetitions batches of that
+ * size and reports the median (and min) time per operation. --iterations=N
+ * pins the batch size instead, so two builds can be compared op for op.
+ * Untimed per-iteration setup (evicting a file from the page cache, bumping
+ * the index mtime) runs inside pause()/resume().
+ *
+ * Cases that touch disk run in a scratch repository under $TMPDIR.
+ */
+
+#include "Gitlite.hpp"
+#include "MergeEngine.hpp"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    const char* USAGE =
+        "Usage: gitlite_micro_bench [options]\n"
+        "    --filter=TEXT       run only cases whose name contains TEXT\n"
+        "    --min-time=SEC      calibrate each batch to at least SEC seconds (0.1)\n"
+        "    --iterations=N      fixed batch size, skips calibration\n"
+        "    --repetitions=N     timed batches per case, median is reported (5)\n"
+        "    --out=FILE          also write the results as JSON\n"
+        "    --list              print case names and exit\n";
+
+    struct Options {
+        std::string filter;
+        double min_time = 0.1;
+        long iterations = 0;
+        int repetitions = 5;
+        std::string out;
+        bool list = false;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    //handed to each case; time between pause() and resume() is not counted
+    class Timer {
+    private:
+        Clock::time_point started;
+        Clock::duration paused_for{0};
+        Clock::time_point paused_at;
+
+    public:
+        void start() {
+            paused_for = Clock::duration(0);
+            started = Clock::now();
+        }
+        void pause() { paused_at = Clock::now(); }
+        void resume() { paused_for += Clock::now() - paused_at; }
+        double elapsed() const {
+            return std::chrono::duration<double>(Clock::now() - started - paused_for).count();
+        }
+    };
+
+    struct Case {
+        std::string name;
+        //bytes processed per iteration, 0 if throughput makes no sense
+        size_t bytes;
+        std::function<void(Timer&, long)> body;
+    };
+
+    struct Result {
+        std::string name;
+        long iterations;
+        double median_ns;
+        double min_ns;
+        double mb_per_s;
+    };
+
+    //keeps results observable so the optimizer cannot drop the work
+    volatile size_t sink = 0;
+
+    template<typename T>
+    void keep(const T& value) {
+        sink += value.size();
+    }
+
+    void keep(const ObjectId& oid) {
+        sink += oid.hash();
+    }
+
+    std::string randomBytes(size_t n, unsigned seed) {
+        std::string s(n, '\0');
+        unsigned x = seed * 2654435761u + 1;
+        for (size_t i = 0; i < n; ++i) {
+            x = x * 1103515245u + 12345u;
+            s[i] = static_cast<char>('a' + (x >> 16) % 26);
+            if (i % 64 == 63) s[i] = '\n';
+        }
+        return s;
+    }
+
+    ObjectId fakeHash(size_t i) {
+        return ObjectId::hashOf(std::to_string(i));
+    }
+
+    std::string sizeName(size_t n) {
+        if (n >= (1 << 20) && n % (1 << 20) == 0) return std::to_string(n >> 20) + "M";
+        if (n >= 1024 && n % 1024 == 0) return std::to_string(n >> 10) + "K";
+        return std::to_string(n);
+    }
+
+    Commit makeCommit(size_t entries) {
+        Commit c;
+        c.setMetadata("micro bench", "Thu Jan 01 00:00:00 1970 +0000");
+        c.addFather(fakeHash(0));
+        std::map<std::string, ObjectId> blobs;
+        for (size_t i = 0; i < entries; ++i) {
+            blobs["dir" + std::to_string(i / 100) + "/file" + std::to_string(i) + ".txt"] = fakeHash(i + 1);
+        }
+        c.getBlobsRef() = Manifest::fromMap(blobs);
+        return c;
+    }
+
+    //content part of a serialized object, what ObjectDatabase hands to deserialize
+    std::string bodyOf(const std::string& serialized) {
+        return serialized.substr(serialized.find('\0') + 2);
+    }
+
+    //drop PATH from the page cache. only clean pages go, so it is synced first
+    void evict(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    //new mtime, so the next index::load cannot reuse its in-process copy
+    void touch(const std::string& path) {
+        static long tick = 0;
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = 1000000000 + (++tick);
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+
+    std::string makeScratchRepo() {
+        const char* tmp = std::getenv("TMPDIR");
+        std::string templ = std::string(tmp && *tmp ? tmp : "/tmp") + "/gitlite-micro-XXXXXX";
+        std::vector<char> buf(templ.begin(), templ.end());
+        buf.push_back('\0');
+        if (!mkdtemp(buf.data()) || chdir(buf.data()) != 0) {
+            throw GitliteException("cannot create a scratch repository");
+        }
+        Repository repo;
+        std::ostringstream quiet;
+        std::streambuf* saved = std::cout.rdbuf(quiet.rdbuf());
+        repo.init();
+        std::cout.rdbuf(saved);
+        return std::string(buf.data());
+    }
+
+    std::vector<Case> makeCases() {
+        std::vector<Case> cases;
+
+        for (size_t size : {64ul, 1024ul, 64ul << 10, 1ul << 20}) {
+            std::string input = randomBytes(size, 1);
+            cases.push_back({"sha1/legacy/" + sizeName(size), size, [input](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(SHA1::sha.sha(input));
+            }});
+            cases.push_back({"sha1/hasher/" + sizeName(size), size, [input](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(SHA1::sha1(input));
+            }});
+        }
+
+        for (size_t entries : {10ul, 1000ul, 100000ul}) {
+            auto commit = std::make_shared<Commit>(makeCommit(entries));
+            std::string body = bodyOf(commit->serialize());
+            cases.push_back({"commit/serialize/" + std::to_string(entries), body.size(), [commit](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(commit->serialize());
+            }});
+            cases.push_back({"commit/deserialize/" + std::to_string(entries), body.size(), [body](Timer&, long n) {
+                Commit c;
+                for (long i = 0; i < n; ++i) {
+                    c.deserialize(body);
+                    keep(c.getBlobs());
+                }
+            }});
+            //what log and ancestor walks read: the manifest is skipped, not decoded
+            cases.push_back({"commit/read-header/" + std::to_string(entries), body.size(), [body](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(Commit::parseHeader(body).parents);
+            }});
+            //binary search per path, and the merge-join behind checkout/merge
+            cases.push_back({"manifest/find/" + std::to_string(entries), 0, [commit, entries](Timer&, long n) {
+                std::vector<std::string> paths;
+                for (const Manifest::Entry& e : commit->getBlobs()) paths.push_back(e.path.str());
+                for (long i = 0; i < n; ++i) keep(commit->getBlobHash(paths[i % entries]));
+            }});
+            Commit next = makeCommit(entries);
+            for (size_t i = 0; i < entries; i += 100) {
+                next.addBlob("dir" + std::to_string(i / 100) + "/file" + std::to_string(i) + ".txt", fakeHash(i));
+            }
+            auto changed = std::make_shared<Commit>(next);
+            cases.push_back({"manifest/join/" + std::to_string(entries), 2 * entries * sizeof(Manifest::Entry), [commit, changed](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(Merge::changesBetween(commit->getBlobs(), changed->getBlobs()));
+            }});
+        }
+
+        //numbered lines; the new side changes every 1000th and inserts after every 5000th
+        for (size_t lines : {10000ul, 100000ul, 2000000ul}) {
+            std::string before, after;
+            for (size_t i = 0; i < lines; ++i) {
+                std::string line = "line " + std::to_string(i) + " of the generated file\n";
+                before += line;
+                after += i % 1000 == 7 ? "changed " + line : line;
+                if (i % 5000 == 11) after += "inserted\n";
+            }
+            std::string tag = lines % 1000000 == 0 ? std::to_string(lines / 1000000) + "M-lines"
+                                                   : std::to_string(lines / 1000) + "K-lines";
+            cases.push_back({"diff/unified/" + tag, before.size(), [before, after](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(Diff::unified(before, after));
+            }});
+        }
+
+        //both sides edit every 100th line of the base, offset so the edits never touch
+        for (size_t size : {64ul << 10, 1ul << 20, 8ul << 20}) {
+            std::string base = randomBytes(size, 3);
+            std::string ours = base;
+            std::string theirs = base;
+            for (size_t line = 0; line * 64 < size; line += 100) {
+                ours[line * 64] = '#';
+                if ((line + 50) * 64 < size) theirs[(line + 50) * 64] = '#';
+            }
+            cases.push_back({"merge3/clean/" + sizeName(size), size, [base, ours, theirs](Timer&, long n) {
+                for (long i = 0; i < n; ++i) keep(Diff::merge3(base, ours, theirs).text);
+            }});
+        }
+
+        for (size_t size : {1024ul, 1ul << 20}) {
+            std::string content = randomBytes(size, 2);
+            cases.push_back({"blob/roundtrip/" + sizeName(size), size, [content](Timer&, long n) {
+                Blob out(content);
+                Blob in;
+                for (long i = 0; i < n; ++i) {
+                    in.deserialize(bodyOf(out.serialize()));
+                    keep(in.getContent());
+                }
+            }});
+        }
+
+        //cases below run inside the scratch repository
+        for (size_t entries : {1000ul, 100000ul}) {
+            std::string tag = std::to_string(entries);
+            auto fill = [entries]() {
+                index idx;
+                idx.clear();
+                for (size_t i = 0; i < entries; ++i) {
+                    idx.add_entry("dir" + std::to_string(i / 100) + "/file" + std::to_string(i) + ".txt", fakeHash(i));
+                }
+                idx.write();
+            };
+            cases.push_back({"index/write/" + tag, 0, [fill](Timer& t, long n) {
+                t.pause();
+                fill();
+                index idx;
+                t.resume();
+                for (long i = 0; i < n; ++i) idx.write();
+            }});
+            cases.push_back({"index/load/" + tag, 0, [fill](Timer& t, long n) {
+                t.pause();
+                fill();
+                t.resume();
+                for (long i = 0; i < n; ++i) {
+                    t.pause();
+                    touch(".gitlite/index");
+                    t.resume();
+                    index idx;
+                    keep(idx.getEntries());
+                }
+            }});
+            cases.push_back({"index/load-unchanged/" + tag, 0, [fill](Timer& t, long n) {
+                t.pause();
+                fill();
+                { index warm; }
+                t.resume();
+                for (long i = 0; i < n; ++i) {
+                    index idx;
+                    keep(idx.getEntries());
+                }
+            }});
+        }
+
+        cases.push_back({"refs/resolve-head/loose", 0, [](Timer&, long n) {
+            RefManager refs;
+            for (long i = 0; i < n; ++i) keep(refs.resolveHead());
+        }});
+        cases.push_back({"refs/resolve-head/packed", 0, [](Timer& t, long n) {
+            t.pause();
+            RefManager refs;
+            static bool packed = false;
+            if (!packed) {
+                for (int b = 0; b < 1000; ++b) {
+                    refs.createBranch("bench" + std::to_string(b));
+                }
+                refs.packRefs();
+                packed = true;
+            }
+            t.resume();
+            for (long i = 0; i < n; ++i) keep(refs.resolveHead());
+        }});
+
+        for (size_t size : {1024ul, 1ul << 20}) {
+            std::string content = randomBytes(size, 3);
+            std::string tag = sizeName(size);
+            cases.push_back({"odb/write/" + tag, size, [content](Timer& t, long n) {
+                ObjectDatabase db;
+                static long unique = 0;
+                for (long i = 0; i < n; ++i) {
+                    t.pause();
+                    Blob blob(std::to_string(++unique) + content);
+                    t.resume();
+                    keep(db.writeObject(blob));
+                }
+                t.pause();
+                Utils::syncPendingWrites();
+                t.resume();
+            }});
+
+            auto stored = [content]() {
+                ObjectDatabase db;
+                Blob blob(content);
+                ObjectId oid = db.writeObject(blob);
+                Utils::syncPendingWrites();
+                return oid;
+            };
+            //a fresh ObjectDatabase per read: no in-memory cache, file in the page cache
+            cases.push_back({"odb/read-warm/" + tag, size, [stored](Timer& t, long n) {
+                t.pause();
+                ObjectId oid = stored();
+                t.resume();
+                for (long i = 0; i < n; ++i) {
+                    ObjectDatabase db;
+                    keep(std::dynamic_pointer_cast<Blob>(db.readObject(oid))->getContent());
+                }
+            }});
+            cases.push_back({"odb/read-cold/" + tag, size, [stored](Timer& t, long n) {
+                t.pause();
+                ObjectId oid = stored();
+                std::string path = Utils::join(".gitlite/objects", oid.hex().substr(0, 2), oid.hex().substr(2));
+                t.resume();
+                for (long i = 0; i < n; ++i) {
+                    t.pause();
+                    evict(path);
+                    t.resume();
+                    ObjectDatabase db;
+                    keep(std::dynamic_pointer_cast<Blob>(db.readObject(oid))->getContent());
+                }
+            }});
+            cases.push_back({"odb/read-cached/" + tag, size, [stored](Timer& t, long n) {
+                t.pause();
+                ObjectId oid = stored();
+                ObjectDatabase db;
+                db.readObject(oid);
+                t.resume();
+                for (long i = 0; i < n; ++i) {
+                    keep(std::dynamic_pointer_cast<Blob>(db.readObject(oid))->getContent());
+                }
+            }});
+        }
+        return cases;
+    }
+
+    double runBatch(const Case& c, long n) {
+        Timer t;
+        t.start();
+        c.body(t, n);
+        return t.elapsed();
+    }
+
+    Result run(const Case& c, const Options& opt) {
+        long n = opt.iterations;
+        if (n <= 0) {
+            n = 1;
+            while (true) {
+                double s = runBatch(c, n);
+                if (s >= opt.min_time || n >= (1L << 30)) break;
+                //aim a little past min_time, grow at most 10x per step
+                double scale = s > 0 ? opt.min_time * 1.2 / s : 10;
+                n = std::max(n + 1, static_cast<long>(n * std::min(10.0, scale)));
+            }
+        }
+        std::vector<double> per_op;
+        for (int r = 0; r < opt.repetitions; ++r) {
+            per_op.push_back(runBatch(c, n) / n * 1e9);
+        }
+        std::sort(per_op.begin(), per_op.end());
+        Result res{c.name, n, per_op[per_op.size() / 2], per_op.front(), 0};
+        if (c.bytes > 0) {
+            res.mb_per_s = c.bytes / (res.median_ns / 1e9) / (1 << 20);
+        }
+        return res;
+    }
+
+    bool parseArgs(int argc, char* argv[], Options& opt) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            size_t eq = arg.find('=');
+            std::string key = arg.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            try {
+                if (key == "--filter") opt.filter = value;
+                else if (key == "--min-time") opt.min_time = std::stod(value);
+                else if (key == "--iterations") opt.iterations = std::stol(value);
+                else if (key == "--repetitions") opt.repetitions = std::stoi(value);
+                else if (key == "--out") opt.out = value;
+                else if (key == "--list") opt.list = true;
+                else return false;
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        return opt.repetitions > 0 && opt.min_time > 0;
+    }
+
+    std::string toJson(const std::vector<Result>& results) {
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(1);
+        out << "{\n  \"results\": {\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            out << "    \"" << r.name << "\": {\"iterations\": " << r.iterations
+                << ", \"median_ns\": " << r.median_ns << ", \"min_ns\": " << r.min_ns
+                << ", \"mb_per_s\": " << r.mb_per_s << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  }\n}\n";
+        return out.str();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        std::fputs(USAGE, stderr);
+        return 2;
+    }
+    if (!opt.out.empty() && opt.out[0] != '/') {
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd))) opt.out = Utils::join(cwd, opt.out);
+    }
+
+    std::string scratch;
+    try {
+        std::vector<Case> cases = makeCases();
+        if (opt.list) {
+            for (const Case& c : cases) std::printf("%s\n", c.name.c_str());
+            return 0;
+        }
+        scratch = makeScratchRepo();
+
+        std::vector<Result> results;
+        std::printf("%-32s %12s %14s %14s %10s\n", "case", "iterations", "median ns/op", "min ns/op", "MB/s");
+        for (const Case& c : cases) {
+            if (c.name.find(opt.filter) == std::string::npos) continue;
+            Result r = run(c, opt);
+            std::printf("%-32s %12ld %14.0f %14.0f", r.name.c_str(), r.iterations, r.median_ns, r.min_ns);
+            if (r.mb_per_s > 0) std::printf(" %10.1f", r.mb_per_s);
+            std::printf("\n");
+            std::fflush(stdout);
+            results.push_back(r);
+        }
+        if (!opt.out.empty()) {
+            Utils::writeContents(opt.out, toJson(results));
+        }
+    } catch (const GitliteException& e) {
+        std::fprintf(stderr, "gitlite_micro_bench: %s\n", e.what());
+        if (!scratch.empty()) std::system(("rm -rf '" + scratch + "'").c_str());
+        return 2;
+    }
+    if (!scratch.empty()) std::system(("rm -rf '" + scratch + "'").c_str());
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef GITLITE_COMMANDRUNNER_HPP
+#define GITLITE_COMMANDRUNNER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Repository.hpp"
+
+//maps command lines onto a Repository. errors come out as GitliteException
+class CommandRunner {
+private:
+    Repository& repo;
+
+    void dispatch(const std::vector<std::string>& args);
+
+public:
+    explicit CommandRunner(Repository& repository) : repo(repository) {}
+
+    //run one command, ARGS[0] is the command name. traced when GITLITE_TRACE is set
+    void run(const std::vector<std::string>& args);
+
+    /*
+     * `gitlite batch`: one command per line on IN (words split on blanks,
+     * "double quotes" group, backslash escapes), all against the same warm
+     * Repository. each command answers on OUT with a frame
+     *
+     *   ok <n>\n<n bytes of output>      or      error <n>\n<n bytes of message>
+     *
+     * an empty line is skipped, "quit" or end of input stops.
+     */
+    void batch(std::istream& in, std::ostream& out);
+
+    static std::vector<std::string> splitLine(const std::string& line);
+};
+
+#endif //GITLITE_COMMANDRUNNER_HPP
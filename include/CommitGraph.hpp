@@ -0,0 +1,66 @@
+#ifndef GITLITE_COMMITGRAPH_HPP
+#define GITLITE_COMMITGRAPH_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ObjectDataBase.hpp"
+
+/*
+ * .gitlite/commit-graph: parents of every commit plus a Bloom filter of the
+ * paths it changed against its first parent, so history walks and
+ * `log -- <path>` can skip most commit objects.
+ *
+ *   "GITLITE-COMMIT-GRAPH 1 <count>\n"
+ *   count x "<oid> <parent>[,<parent2>]|- <filter hex>|*|-\n"     sorted by oid
+ *
+ * A filter uses BITS_PER_PATH bits per changed path and HASHES probes; "*"
+ * means the commit changed more than MAX_PATHS paths and always matches,
+ * "-" that it changed nothing.
+ * Written by `gitlite commit-graph`; commits made since are simply absent
+ * and callers fall back to reading the objects.
+ */
+class CommitGraph {
+public:
+    static const size_t BITS_PER_PATH = 10;
+    static const int HASHES = 7;
+    static const size_t MAX_PATHS = 512;
+
+    struct Entry {
+        ObjectId oid;
+        std::vector<ObjectId> parents;
+        //filter bytes, empty when the commit changed nothing (matches no path)
+        std::string filter;
+        bool overflow = false;
+    };
+
+    explicit CommitGraph(const std::string& gitlite_dir = ".gitlite");
+
+    //read the file if there is one, false otherwise
+    bool load();
+
+    //nullptr if OID is not in the graph
+    const Entry* find(const ObjectId& oid) const;
+
+    size_t size() const { return entries.size(); }
+
+    //false only if ENTRY certainly did not change PATH
+    static bool mayHaveChanged(const Entry& entry, const std::string& path);
+
+    //paths whose blob differs between COMMIT and its first parent (all of them for a root)
+    static std::vector<std::string> changedPaths(const ObjectDatabase& db, const Commit& commit);
+
+    static Entry makeEntry(const ObjectDatabase& db, const Commit& commit);
+
+    //graph over every commit reachable from TIPS, reusing entries already in the
+    //file (those are kept even if no longer reachable).
+    //returns {commits in the graph, commits added}
+    std::pair<size_t, size_t> write(const ObjectDatabase& db, const std::vector<ObjectId>& tips);
+
+private:
+    std::string path;
+    std::vector<Entry> entries;
+};
+
+#endif //GITLITE_COMMITGRAPH_HPP
@@ -0,0 +1,114 @@
+#ifndef GITLITE_DAEMON_HPP
+#define GITLITE_DAEMON_HPP
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#include "ObjectDataBase.hpp"
+#include "Pack.hpp"
+
+/*
+ * `gitlite serve` protocol. Control messages are single lines, object data
+ * travels as a pack stream:
+ *
+ *   client: list-refs                      server: <hash> <refname>  ... end
+ *   client: fetch <want>                   server: pack stream | error <msg>
+ *           have <hash> ... done
+ *   client: push <ref> <old|-> <new>       server: ok | error <msg>
+ *           pack stream
+ *   client: quit
+ *
+ *   pack stream: see Pack.hpp. blobs come first, commits last with parents
+ *   ahead of children.
+ */
+
+//buffered line/byte io over a pair of file descriptors
+class FdStream {
+private:
+    int in_fd;
+    int out_fd;
+    std::string buffer;
+    size_t pos = 0;
+
+    bool fill();
+
+public:
+    FdStream(int in, int out) : in_fd(in), out_fd(out) {}
+
+    //false on eof
+    bool readLine(std::string& line);
+    //hand buffered and incoming bytes to RECEIVER until its stream is complete
+    void feed(PackReceiver& receiver);
+    void write(const std::string& data);
+    void write(const char* data, size_t len);
+};
+
+namespace PackStream {
+    void write(FdStream& stream, PackBuilder& objects);
+    //take the incoming pack into RECEIVER and verify it, nothing is installed yet
+    void receive(FdStream& stream, PackReceiver& receiver);
+    //receive() then install the pack into DB, return the number of objects received
+    size_t read(FdStream& stream, ObjectDatabase& db);
+}
+
+//serves the repository in the current directory
+class DaemonServer {
+private:
+    FdStream& stream;
+
+    void listRefs();
+    void uploadPack(const std::string& want);
+    void receivePack(const std::string& ref, const std::string& old_hash, const std::string& new_hash);
+
+public:
+    explicit DaemonServer(FdStream& s) : stream(s) {}
+
+    //handle requests until quit or eof
+    void run();
+
+    static void serveStdio();
+    static void serveSocket(const std::string& socket_path);
+};
+
+//client side of a remote that names the daemon transport:
+//  serve:<path>   spawn `gitlite serve` in <path> (a repository or its .gitlite dir)
+//  unix:<socket>  connect to a running `gitlite serve --socket <socket>`
+class DaemonClient {
+private:
+    int in_fd = -1;
+    int out_fd = -1;
+    pid_t child = -1;
+    FdStream* stream = nullptr;
+
+public:
+    //push error when the ref no longer held the old value (a concurrent push won)
+    static const std::string REF_MOVED;
+
+    explicit DaemonClient(const std::string& url);
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    static bool isDaemonUrl(const std::string& url);
+
+    //executable started as `<exe> serve` for serve:<path> remotes. the gitlite CLI
+    //passes itself; otherwise GITLITE_EXECUTABLE, then `gitlite` on PATH
+    static void setServerExecutable(const std::string& path);
+
+    //refname -> hash
+    std::map<std::string, ObjectId> listRefs();
+
+    //fetch the closure of WANT minus what HAVES reach, return objects received
+    size_t fetch(const ObjectId& want, const std::vector<ObjectId>& haves, ObjectDatabase& db);
+
+    //send OBJECTS then move REF from OLD_HASH (null: REF is new) to NEW_HASH;
+    //returns "" or the server's error
+    std::string push(const std::string& ref, const ObjectId& old_hash, const ObjectId& new_hash,
+                     PackBuilder& objects);
+};
+
+#endif //GITLITE_DAEMON_HPP
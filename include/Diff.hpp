@@ -0,0 +1,81 @@
+#ifndef GITLITE_DIFF_HPP
+#define GITLITE_DIFF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Line diff and three-way line merge, shared by `diff` and `merge`.
+ *
+ * Lines are views into the caller's text, hashed once and interned to small
+ * integers, so the diff itself only compares ints. diff() drops lines that
+ * appear on one side only (they can never match), then runs Myers' O(ND)
+ * algorithm in its linear space form (divide and conquer on the middle
+ * snake): memory stays O(N + M) however large the files are.
+ */
+namespace Diff {
+    //one line of a text, '\n' included (except maybe for the last line)
+    struct Line {
+        const char* data;
+        size_t size;
+
+        std::string str() const { return std::string(data, size); }
+        bool hasNewline() const { return size > 0 && data[size - 1] == '\n'; }
+    };
+
+    //TEXT cut after every '\n'. the lines point into TEXT, keep it alive
+    std::vector<Line> splitLines(const std::string& text);
+
+    //64 bit hash of the line bytes, the one the interning table uses
+    size_t hashLine(const Line& line);
+
+    //gives equal lines equal ids, across every text interned through the same
+    //table. the table keeps pointers to the lines, their texts must outlive it
+    class LineTable {
+    private:
+        //open addressing on the line hash; the hash sits in the slot so a probe
+        //only touches the line itself when the hashes agree
+        struct Slot {
+            uint32_t hash;
+            int id;
+        };
+        std::vector<Slot> slots;
+        std::vector<Line> lines;
+
+        void grow(size_t capacity);
+
+    public:
+        std::vector<int> intern(const std::vector<Line>& text);
+        size_t size() const { return lines.size(); }
+    };
+
+    //a[a_start, a_start + a_count) is replaced by b[b_start, b_start + b_count)
+    struct Hunk {
+        size_t a_start;
+        size_t a_count;
+        size_t b_start;
+        size_t b_count;
+    };
+
+    //shortest edit script from A to B, as changed regions in order
+    std::vector<Hunk> diff(const std::vector<int>& a, const std::vector<int>& b);
+
+    //`diff -u` style body ("@@ -1,3 +1,4 @@" and the lines) with CONTEXT lines
+    //around each change, empty if the texts are equal. no file header
+    std::string unified(const std::string& a_text, const std::string& b_text, size_t context = 3);
+
+    struct MergeResult {
+        std::string text;
+        size_t conflicts = 0;
+    };
+
+    //merge OURS and THEIRS, both edited from BASE. a region changed on one side
+    //takes that side; a region changed on both sides (or where their changes
+    //touch) takes either if they agree and becomes a conflict block otherwise:
+    //  "<<<<<<< HEAD\n" ours "=======\n" theirs ">>>>>>>\n"
+    MergeResult merge3(const std::string& base, const std::string& ours, const std::string& theirs);
+}
+
+#endif //GITLITE_DIFF_HPP
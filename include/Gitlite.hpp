@@ -0,0 +1,35 @@
+#ifndef GITLITE_GITLITE_HPP
+#define GITLITE_GITLITE_HPP
+
+/*
+ * libgitlite public API.
+ *
+ * Every failure is reported by throwing GitliteException, nothing in the
+ * library calls exit(). Paths are relative to the current working directory,
+ * which has to be the root of the repository (the directory holding .gitlite).
+ *
+ *   Repository repo;              // porcelain: add, commit, merge, push, ...
+ *   CommandRunner(repo).run(args) // same as the command line, args[0] = command
+ *   ObjectDatabase db;            // objects by id (ObjectId, 20 raw bytes)
+ *   RefManager refs;              // HEAD, branches, packed-refs
+ *   index idx;                    // staging area
+ *   Diff::merge3(base, ours, theirs) // line merge used by `merge`
+ *
+ * Commands print their normal output to std::cout.
+ *
+ * serve:<path> remotes run a gitlite server process: call
+ * DaemonClient::setServerExecutable (Daemon.hpp) with the gitlite binary,
+ * or set GITLITE_EXECUTABLE, or have `gitlite` on PATH.
+ */
+
+#include "GitliteException.h"
+#include "ObjectId.hpp"
+#include "Objects.hpp"
+#include "ObjectDataBase.hpp"
+#include "RefManager.hpp"
+#include "index.hpp"
+#include "Repository.hpp"
+#include "CommandRunner.hpp"
+#include "Diff.hpp"
+
+#endif //GITLITE_GITLITE_HPP
@@ -0,0 +1,131 @@
+#ifndef GITLITE_MANIFEST_HPP
+#define GITLITE_MANIFEST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ObjectId.hpp"
+
+/*
+ * A path interned in the PathPool.
+ *
+ * The bytes live in the pool's arena and never move, so a Path is just a
+ * pointer: two Paths name the same file iff they are the same pointer.
+ * Ordering is byte order, the order std::string (and the commit format) uses.
+ */
+class Path {
+public:
+    const char* data() const { return bytes; }
+    size_t size() const;
+    std::string str() const { return std::string(bytes, size()); }
+
+    //<0, 0, >0 like std::string::compare
+    int compare(const char* other, size_t len) const;
+    int compare(const Path& other) const;
+
+    bool operator==(const Path& other) const { return bytes == other.bytes; }
+    bool operator!=(const Path& other) const { return bytes != other.bytes; }
+    bool operator<(const Path& other) const { return bytes != other.bytes && compare(other) < 0; }
+
+private:
+    friend class PathPool;
+    explicit Path(const char* interned) : bytes(interned) {}
+
+    //length in the 4 bytes before, a '\0' after
+    const char* bytes;
+};
+
+/*
+ * Process-wide set of the paths every manifest refers to, each stored once.
+ * Paths are appended to fixed size blocks (an arena) and found again through
+ * an open addressing table on their hash. intern() may be called from any
+ * thread; reading a Path needs no lock.
+ */
+class PathPool {
+public:
+    static PathPool& shared();
+
+    Path intern(const char* data, size_t size);
+    Path intern(const std::string& path) { return intern(path.data(), path.size()); }
+
+    //distinct paths, arena bytes in use
+    size_t size();
+    size_t bytes();
+
+private:
+    static const size_t BLOCK_SIZE = 64 << 10;
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    //block the next path goes to
+    char* block = nullptr;
+    size_t blockUsed = BLOCK_SIZE;
+    size_t arenaBytes = 0;
+    //empty slots are null
+    std::vector<const char*> slots;
+    size_t count = 0;
+
+    PathPool() = default;
+    const char* store(const char* data, size_t size);
+    void grow();
+};
+
+/*
+ * Blob manifest of a commit (path -> blob id) as one array sorted by path.
+ *
+ * An entry is an interned Path and an ObjectId, 32 bytes with no allocation of
+ * its own. Lookups are binary searches; two manifests are compared with one
+ * linear merge-join over the arrays. Copying one is a single allocation.
+ */
+class Manifest {
+public:
+    struct Entry {
+        Path path;
+        ObjectId blob;
+    };
+    typedef std::vector<Entry>::const_iterator const_iterator;
+
+    Manifest() = default;
+
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void reserve(size_t n) { entries.reserve(n); }
+    void clear() { entries.clear(); }
+
+    //nullptr if PATH is not in the manifest
+    const Entry* find(const std::string& path) const;
+    bool contains(const std::string& path) const { return find(path) != nullptr; }
+    //null id if PATH is not in the manifest
+    ObjectId blobOf(const std::string& path) const;
+
+    //insert or replace / remove one path, O(n)
+    void set(const std::string& path, const ObjectId& blob);
+    bool erase(const std::string& path);
+
+    //apply CHANGES (a null id removes the path) in one pass over both
+    void update(const std::map<std::string, ObjectId>& changes);
+
+    //add an entry after every other one; PATH must sort after the last entry
+    void append(const Path& path, const ObjectId& blob) { entries.push_back({path, blob}); }
+    //sort (and drop duplicate paths, the last one wins) after out of order appends
+    void normalize();
+
+    std::map<std::string, ObjectId> toMap() const;
+    static Manifest fromMap(const std::map<std::string, ObjectId>& blobs);
+
+private:
+    std::vector<Entry> entries;
+
+    //index of the first entry not before PATH
+    size_t lowerBound(const std::string& path) const;
+    bool isAt(size_t i, const std::string& path) const;
+};
+
+#endif //GITLITE_MANIFEST_HPP
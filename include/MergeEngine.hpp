@@ -0,0 +1,69 @@
+#ifndef GITLITE_MERGEENGINE_HPP
+#define GITLITE_MERGEENGINE_HPP
+
+#include <string>
+#include <vector>
+
+#include "Manifest.hpp"
+#include "ObjectDataBase.hpp"
+#include "index.hpp"
+
+/*
+ * Three-way merge of manifests (path -> blob id), computed in memory.
+ *
+ * Merge::merge() only reads blobs: it returns the merged manifest, the paths
+ * whose result differs from OURS and the conflicts, and touches nothing else.
+ * Applying the result is a separate step: writeObjects() stores the blobs the
+ * merge created (enough for a repository without a worktree), apply() also
+ * updates the worktree and the index, for the changed paths only.
+ */
+namespace Merge {
+    struct Change {
+        std::string path;
+        //result blob id, null when the merge deletes the path
+        ObjectId blob;
+        //the merge produced BLOB (merged text or conflict markers): its content,
+        //which is not in the store until writeObjects()/apply()
+        bool created = false;
+        std::string content;
+        bool conflict = false;
+    };
+
+    struct Result {
+        //full merged manifest, conflicted files included with their markers
+        Manifest manifest;
+        //paths whose blob differs from OURS, sorted
+        std::vector<Change> changes;
+        //conflicted paths, sorted
+        std::vector<std::string> conflicts;
+
+        bool clean() const { return conflicts.empty(); }
+    };
+
+    //merge THEIRS into OURS with BASE as the common ancestor. a file renamed on
+    //one side and edited on the other is merged under its new name (see Rename.hpp)
+    Result merge(ObjectDatabase& db,
+                 const Manifest& base,
+                 const Manifest& ours,
+                 const Manifest& theirs,
+                 bool detectRenames = true);
+
+    //paths whose blob differs between FROM and TO, sorted (none of them created)
+    std::vector<Change> changesBetween(const Manifest& from, const Manifest& to);
+
+    //store the blobs RESULT created
+    void writeObjects(ObjectDatabase& db, const Result& result);
+
+    //write (or delete) the worktree file of every change on a worker pool,
+    //storing the blobs the changes created. other paths are left alone
+    void writeWorktree(ObjectDatabase& db, const std::vector<Change>& changes);
+
+    //add (or mark removed) every change in IDX, in path order. the blobs must be stored
+    void stage(const std::vector<Change>& changes, index& idx);
+
+    //writeWorktree() for RESULT, then stage() its changes on the calling thread:
+    //brings the worktree and IDX from OURS to RESULT
+    void apply(ObjectDatabase& db, const Result& result, index& idx);
+}
+
+#endif //GITLITE_MERGEENGINE_HPP
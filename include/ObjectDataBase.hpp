@@ -7,56 +7,134 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "Utils.h"
+#include "ObjectId.hpp"
 #include "Objects.hpp"
 
 class GitObject;
 class Commit;
 class Blob;
 
+class PackFile;
+
 class ObjectDatabase {
 private:
-    friend class RemoteObjectDatabase;
     // root path
-    const std::string BASE_DIR = ".gitlite/objects";
+    std::string BASE_DIR;
+
+    // packs under objects/pack, loaded on first use
+    mutable std::mutex pack_mtx;
+    mutable bool packs_loaded = false;
+    mutable std::vector<std::shared_ptr<PackFile>> packs;
+
+    // parsed objects by id. a stored object never changes, so entries never go stale;
+    // the whole cache is dropped once it holds more than CACHE_LIMIT bytes
+    static const size_t CACHE_LIMIT = 64 << 20;
+    mutable std::mutex cache_mtx;
+    mutable std::unordered_map<ObjectId, std::shared_ptr<GitLiteObject>> cache;
+    // commit headers read without their manifest, counted against the same limit
+    mutable std::unordered_map<ObjectId, std::shared_ptr<const CommitHeader>> header_cache;
+    mutable size_t cache_bytes = 0;
+
+    // sorted ids of one loose fan-out directory ("ab"), reused while the directory
+    // keeps its inode and mtime (adding or removing an entry changes the mtime)
+    struct FanoutListing {
+        uint64_t ino = 0;
+        int64_t mtime_sec = 0;
+        int64_t mtime_nsec = 0;
+        std::shared_ptr<const std::vector<ObjectId>> ids;
+    };
+    mutable std::mutex fanout_mtx;
+    mutable std::unordered_map<std::string, FanoutListing> fanout_cache;
+    std::shared_ptr<const std::vector<ObjectId>> looseIdsIn(const std::string& fanout) const;
+
+    // caller holds cache_mtx: make room for BYTES more
+    void reserveCache(size_t bytes) const;
 
     //path is like objects/ab/(40 bits hash)
-    std::string getObjectPath(const std::string& oid) const;
+    std::string getObjectPath(const ObjectId& oid) const;
+
+    std::vector<std::shared_ptr<PackFile>> getPacks() const;
+
+    std::shared_ptr<GitLiteObject> parseObject(const ObjectId& oid, const std::string& raw_data) const;
 
 public:
+    // gitlite_dir is the .gitlite directory of the repository (local one by default)
+    explicit ObjectDatabase(const std::string& gitlite_dir = ".gitlite");
+
     void initDatabase();
 
+    const std::string& getObjectsDir() const { return BASE_DIR; }
+
      // write in
      //param obj is commit/blob return obj's OID(hash)。
-    std::string writeObject(GitLiteObject &obj);
+    ObjectId writeObject(GitLiteObject &obj);
 
      // read & deseriaze
-     // param OID  return obj
-    std::shared_ptr<GitLiteObject> readObject(const std::string& oid);
+     // param OID  return obj. the object may be shared with other readers: do not modify it
+    std::shared_ptr<GitLiteObject> readObject(const ObjectId& oid) const;
+
+    // parents, message and timestamp of commit OID, for history walks: the blob manifest
+    // is skipped over, not parsed. nullptr if OID is not a commit, throws if it is missing.
+    // shared with other readers
+    std::shared_ptr<const CommitHeader> readCommitHeader(const ObjectId& oid) const;
+
+    // every id starting with PREFIX (at least 2 hex digits), loose and packed, sorted.
+    // each store is a sorted table searched by bisection: the prefix's fan-out directory
+    // listing (read once, then only stat'ed while unchanged) and every pack .idx
+    std::vector<ObjectId> findObjectsByPrefix(const std::string& prefix) const;
 
-    std::string findObjectByPrefix(const std::string& prefix);
+    // "blob" or "commit", read from the object header only. "" if absent
+    std::string objectType(const ObjectId& oid) const;
 
-    std::string readBlobContent(const std::string &blobHash);
+    // "" for the null id or a missing blob
+    std::string readBlobContent(const ObjectId &blobHash);
 
-    bool hasObject(const std::string &oid) const;
+    bool hasObject(const ObjectId &oid) const;
 
-    void copyObjectFromRemote(const std::string &hash, const std::string &remote_gitlite_path);
+    // serialized bytes of an object, as stored on disk
+    std::string readRawObject(const ObjectId &oid) const;
 
-    void copyToRemote(const std::string &oid, const std::string &remote_gitlite_path) const;
+    // store already serialized bytes under oid, return bytes written (0 if present)
+    size_t writeRawObject(const ObjectId &oid, const std::string &data);
+
+    // every object id in the store (loose and packed), sorted
+    std::vector<ObjectId> listObjects() const;
+
+    // forget cached pack indexes, e.g. after a pack was installed
+    void reloadPacks() const;
+
+    // every received pack adds one more .idx to search on a lookup: once there are
+    // AUTO_REPACK_PACKS of them, transfers fold them back into one
+    static const size_t AUTO_REPACK_PACKS = 8;
+
+    // merge all packs into a single one if there are at least MIN_PACKS, streaming the
+    // objects through a PackWriter. loose objects are left alone.
+    // returns the objects in the new pack, 0 if nothing was done
+    size_t repack(size_t min_packs = 2);
 };
 
+//object store of a remote repository given by its .gitlite path
 class RemoteObjectDatabase {
 private:
-    std::string remote_root_dir;
-
-    std::string getRemoteObjectPath(const std::string& oid) const;
+    ObjectDatabase db;
 
 public:
     explicit RemoteObjectDatabase(const std::string& gitlite_root_dir);
 
-    std::shared_ptr<GitLiteObject> readObject(const std::string& oid) const;
+    std::shared_ptr<GitLiteObject> readObject(const ObjectId& oid) const;
+
+    // parents, message and timestamp of commit OID, for history walks: the blob manifest
+    // is skipped over, not parsed. nullptr if OID is not a commit, throws if it is missing.
+    // shared with other readers
+    std::shared_ptr<const CommitHeader> readCommitHeader(const ObjectId& oid) const;
+
+    bool hasObject(const ObjectId& oid) const;
 
-    void copyToLocal(const std::string& oid, ObjectDatabase& localDB);
+    ObjectDatabase& getDatabase() { return db; }
 };
 
 
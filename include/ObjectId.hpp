@@ -0,0 +1,76 @@
+#ifndef GITLITE_OBJECTID_HPP
+#define GITLITE_OBJECTID_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+
+/*
+ * The SHA-1 an object is stored under, as its 20 raw bytes.
+ *
+ * Ids are held, hashed and compared in this form; the 40 digit hex spelling
+ * only exists where an id is read or written as text: object file names,
+ * commit/index/ref/pack index files, the daemon protocol and command output.
+ * Byte order equals hex order, so sorted ids stay sorted either way.
+ * The null id (all zero) means "no object".
+ */
+class ObjectId {
+public:
+    static const size_t RAW_SIZE = 20;
+    static const size_t HEX_SIZE = 40;
+
+    ObjectId() : bytes() {}
+
+    static ObjectId fromRaw(const unsigned char* raw);
+
+    //throws GitliteException unless HEX is 40 lowercase hex digits
+    static ObjectId fromHex(const std::string& hex);
+
+    //false, OUT untouched, unless DATA[0, LEN) is 40 lowercase hex digits
+    static bool parseHex(const char* data, size_t len, ObjectId& out);
+
+    //id of the serialized object DATA ("<type> <size>\0\n<content>")
+    static ObjectId hashOf(const std::string& data);
+
+    std::string hex() const;
+
+    //first LEN hex digits, for messages
+    std::string abbrev(size_t len = 7) const { return hex().substr(0, len); }
+
+    //true if hex() starts with the hex digits PREFIX
+    bool hasPrefix(const std::string& prefix) const;
+
+    bool isNull() const;
+
+    const unsigned char* raw() const { return bytes; }
+
+    bool operator==(const ObjectId& other) const { return std::equal(bytes, bytes + RAW_SIZE, other.bytes); }
+    bool operator!=(const ObjectId& other) const { return !(*this == other); }
+    bool operator<(const ObjectId& other) const {
+        return std::lexicographical_compare(bytes, bytes + RAW_SIZE, other.bytes, other.bytes + RAW_SIZE);
+    }
+
+    //the bytes are already uniformly distributed: the first word is the hash
+    size_t hash() const {
+        size_t h = 0;
+        for (size_t i = 0; i < sizeof(h); ++i) h = h << 8 | bytes[i];
+        return h;
+    }
+
+private:
+    unsigned char bytes[RAW_SIZE];
+};
+
+//writes the hex spelling
+std::ostream& operator<<(std::ostream& out, const ObjectId& oid);
+
+namespace std {
+    template<>
+    struct hash<ObjectId> {
+        size_t operator()(const ObjectId& oid) const { return oid.hash(); }
+    };
+}
+
+#endif //GITLITE_OBJECTID_HPP
@@ -4,17 +4,19 @@
 #include <string>
 #include <vector>
 
+#include "Manifest.hpp"
+#include "ObjectId.hpp"
 #include "index.hpp"
 
 class index;
 //GitLiteObject class is the base class for all git classes
 class GitLiteObject {
 protected:
-    std::string hashid;
+    ObjectId hashid;
     unsigned obj_type{};
 public:
-    std::string get_hashid(){return hashid;}
-    void set_hash(std::string);
+    const ObjectId& get_hashid() const {return hashid;}
+    void set_hash(const ObjectId&);
 
     GitLiteObject() = default;
     virtual ~GitLiteObject() = default;
@@ -31,53 +33,66 @@ struct MetaData {
     explicit MetaData(std::string  , std::string);
 };
 
+//parents and metadata of a commit, without its blob manifest
+struct CommitHeader {
+    ObjectId oid;
+    std::vector<ObjectId> parents;
+    std::string message;
+    std::string timestamp;
+};
+
 //Commit class
 class Commit:public GitLiteObject {
 private:
     MetaData Commit_Metadata;
-    std::vector<std::string> Father_Commit;
-    std::map<std::string, std::string> Blobs;  //file path & blob hash
+    std::vector<ObjectId> Father_Commit;
+    Manifest Blobs;  //file path & blob hash, sorted by path
 public:
     Commit();
     //explicit Commit(MetaData , std::string , std::string);
     std::string serialize() override;
     void deserialize(const std::string &data) override;
-    std::string getBlobHash(const std::string& path) const ;
+    //header of the commit body at DATA[BEGIN, end): the blob lines are skipped, not parsed.
+    //the oid is left null
+    static CommitHeader parseHeader(const std::string& data, size_t begin = 0);
+    CommitHeader header() const;
+    //null id if PATH is not tracked
+    ObjectId getBlobHash(const std::string& path) const ;
     void setMetadata(std::string _message , std::string _time_stamp);
-    void addFather(const std::string & father_hash);
+    void addFather(const ObjectId & father_hash);
 
 
     // add Blob
-    void addBlob(const std::string& path, const std::string& hash) {
-        Blobs[path] = hash;
+    void addBlob(const std::string& path, const ObjectId& hash) {
+        Blobs.set(path, hash);
     }
     void rmBlob(const std::string& path);
 
     void setBlobsFromIndex(index &idx);
 
     // get blob
-    const std::map<std::string, std::string>& getBlobs() const {
+    const Manifest& getBlobs() const {
         return Blobs;
     }
 
-    std::map<std::string, std::string>& getBlobsRef()  {
+    Manifest& getBlobsRef()  {
         return Blobs;
     }
 
     //see if Commit track the file
     bool isTracking(const std::string& path) const {
-        return Blobs.find(path) != Blobs.end();
+        return Blobs.contains(path);
     }
 
-    std::vector<std::string> getFatherCommits() {
+    const std::vector<ObjectId>& getFatherCommits() const {
         return Father_Commit;
     }
 
-    std::string  getTimestamp() {
+    std::string  getTimestamp() const {
         return Commit_Metadata.timestamp;
     }
 
-    std::string getMessage() {
+    std::string getMessage() const {
         return Commit_Metadata.message;
     }
 };
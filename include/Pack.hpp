@@ -0,0 +1,180 @@
+#ifndef GITLITE_PACK_HPP
+#define GITLITE_PACK_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ObjectId.hpp"
+#include "Utils.h"
+
+class ObjectDatabase;
+
+/*
+ * Pack stream, used by push/fetch for both directory and daemon remotes:
+ *
+ *   "GITLITE-PACK 1 <count>\n"
+ *   count x ( "<type> <size>\n" <size bytes of object content> )
+ *   "<40 hex sha1 of every byte above>\n"
+ *
+ * An object's id is the sha1 of "<type> <size>\0\n<content>", i.e. exactly what
+ * ObjectDatabase stores for a loose object, so ids are never sent: the receiver
+ * recomputes them while the bytes go by.
+ *
+ * On disk the receiver keeps the stream as .gitlite/objects/pack/pack-<sum>.pack
+ * next to pack-<sum>.idx, a sorted "<oid> <offset>" table built in the same pass.
+ */
+
+//writes a pack stream to SINK, buffering into large chunks
+class PackWriter {
+public:
+    using Sink = std::function<void(const char*, size_t)>;
+
+    PackWriter(Sink sink, size_t count);
+
+    //RAW is a serialized object as stored by ObjectDatabase
+    void add(const std::string& raw);
+
+    //flush and append the trailer, return the checksum
+    std::string finish();
+
+    uint64_t bytesWritten() const { return written; }
+
+private:
+    Sink sink;
+    std::string buffer;
+    SHA1::Hasher stream_hash;
+    uint64_t written = 0;
+
+    void emit(const std::string& data, bool hashed = true);
+    void flush();
+};
+
+//consumes a pack stream incrementally, verifies it and installs it into a store
+class PackReceiver {
+public:
+    explicit PackReceiver(ObjectDatabase& db);
+    ~PackReceiver();
+
+    PackReceiver(const PackReceiver&) = delete;
+    PackReceiver& operator=(const PackReceiver&) = delete;
+
+    //feed the next bytes of the stream, returns how many were used.
+    //bytes after the trailer are left to the caller
+    size_t feed(const char* data, size_t len);
+
+    bool done() const { return state == DONE; }
+
+    //check the finished stream while the pack is still a temp file: complete,
+    //trailer matches, repeated objects dropped. ids are computed from the bytes
+    //received, so no object can claim an id it does not hash to
+    void verify();
+    //after verify(): true if the pack holds OID
+    bool contains(const ObjectId& oid) const;
+    //after verify(): write the index and move the pack in place.
+    //returns the number of distinct objects received
+    size_t install();
+    //verify() then install()
+    size_t finish();
+
+    uint64_t bytesReceived() const { return offset; }
+
+    //where install() put the index, "" for an empty pack
+    const std::string& getIdxPath() const { return idx_path; }
+
+private:
+    enum State { HEADER, OBJECT_HEADER, BODY, TRAILER, DONE };
+
+    ObjectDatabase& db;
+    State state = HEADER;
+    std::string line;
+    size_t expected = 0;
+    size_t remaining = 0;
+    uint64_t offset = 0;
+    uint64_t object_offset = 0;
+    std::string trailer;
+    SHA1::Hasher stream_hash;
+    SHA1::Hasher object_hash;
+    std::vector<std::pair<ObjectId, uint64_t>> entries;
+    std::string tmp_path;
+    std::string idx_path;
+    FILE* out = nullptr;
+    bool verified = false;
+
+    void write(const char* data, size_t len, bool hashed);
+    void lineComplete();
+    //the current object's bytes are all in: record its id
+    void objectComplete();
+};
+
+//read side of an installed pack
+class PackFile {
+public:
+    struct Entry {
+        ObjectId oid;
+        uint64_t offset;
+    };
+
+    ~PackFile();
+
+    //open pack-<sum>.idx and its .pack
+    static std::shared_ptr<PackFile> open(const std::string& idx_path);
+
+    bool contains(const ObjectId& oid) const;
+
+    //serialized object ("<type> <size>\0\n<content>"), "" if absent
+    std::string readRaw(const ObjectId& oid) const;
+
+    //just "<type> <size>", "" if absent
+    std::string readHeader(const ObjectId& oid) const;
+
+    //sorted by oid
+    const std::vector<Entry>& getEntries() const { return entries; }
+
+    const std::string& getIdxPath() const { return idx_path; }
+
+private:
+    int fd = -1;
+    std::string idx_path;
+    std::vector<Entry> entries;
+
+    const Entry* find(const ObjectId& oid) const;
+};
+
+//thread safe collector used as the transfer engine's copier:
+//loads raw objects from SOURCE, keeps them in send order.
+//the copy workers read ahead, but at most MEMORY_LIMIT bytes of objects are held:
+//beyond that only ids are kept and writeTo() reads those objects again
+class PackBuilder {
+public:
+    static const size_t MEMORY_LIMIT = 64 << 20;
+
+    explicit PackBuilder(ObjectDatabase& source) : source(source) {}
+
+    //returns the object's size
+    size_t add(const ObjectId& oid);
+
+    size_t size() const { return objects.size(); }
+
+    //stream everything as one pack, return bytes written
+    uint64_t writeTo(const PackWriter::Sink& sink);
+
+private:
+    struct Item {
+        ObjectId oid;
+        //empty once past the limit
+        std::string raw;
+    };
+
+    ObjectDatabase& source;
+    std::mutex mtx;
+    std::vector<Item> objects;
+    size_t held = 0;
+};
+
+#endif //GITLITE_PACK_HPP
@@ -3,27 +3,128 @@
 #ifndef GITLITE_REFMANAGER_HPP
 #define GITLITE_REFMANAGER_HPP
 
+#include <memory>
 #include<string>
+#include <utility>
+#include <vector>
+#include "ObjectId.hpp"
 #include "Objects.hpp"
 
+// .gitlite/packed-refs: one "<hash> <refname>" line per ref, sorted by refname.
+// a loose file under refs/ overrides the packed entry of the same name.
+// the content is read once per process and shared by every PackedRefs of that
+// directory; constructing one only stats the file and rereads it if it changed
+class PackedRefs {
+private:
+    std::string path;
+    std::shared_ptr<const std::string> data;   //file content, searched in place
+    bool locked = false;                       //we hold packed-refs.lock
+
+    // [begin, end) of the line holding the first entry whose name is >= KEY
+    size_t lowerBound(const std::string& key) const;
+
+public:
+    explicit PackedRefs(const std::string& gitlite_dir = ".gitlite");
+    ~PackedRefs();
+
+    PackedRefs(const PackedRefs&) = delete;
+    PackedRefs& operator=(const PackedRefs&) = delete;
+
+    // take packed-refs.lock and reread the file under it, so an edit starts from
+    // what is there now and cannot drop refs another writer packed meanwhile.
+    // held until write() or destruction
+    void lock();
+
+    // binary search, "" if absent
+    std::string lookup(const std::string& refName) const;
+
+    // (refname, hash) of every entry under PREFIX, in order
+    std::vector<std::pair<std::string, std::string>> withPrefix(const std::string& prefix) const;
+
+    // atomically replace the file with ENTRIES (any order) and release the lock.
+    // lock() must have been called first
+    void write(std::vector<std::pair<std::string, std::string>> entries);
+};
+
+// all-or-nothing update of refs under one .gitlite dir.
+// every ref is locked through "<ref>.lock" (created O_EXCL, sorted order, retried with
+// backoff while another writer holds it), checked against its expected old value,
+// and only then are the locks renamed over the refs
+class RefTransaction {
+public:
+    // expected value that matches whatever the ref holds
+    static const std::string ANY;
+
+    // process wide contention counters
+    struct Stats {
+        size_t lock_waits = 0;      // times a lock was busy and we backed off
+        double wait_seconds = 0;    // time spent backing off
+        size_t conflicts = 0;       // commits refused because a ref moved
+        std::string summary() const;
+    };
+    static Stats& stats();
+
+    // sleep before retry number ATTEMPT (0 based), exponential with jitter
+    static void backoff(unsigned attempt);
+
+    explicit RefTransaction(const std::string& gitlite_dir = ".gitlite");
+    ~RefTransaction();
+
+    RefTransaction(const RefTransaction&) = delete;
+    RefTransaction& operator=(const RefTransaction&) = delete;
+
+    // REF_NAME relative to the .gitlite dir ("HEAD", "refs/heads/x").
+    // EXPECTED_OLD "" means the ref must not exist yet
+    void update(const std::string& refName, const std::string& newValue, const std::string& expectedOld = ANY);
+
+    // false if a lock could not be taken or a ref did not hold its expected value;
+    // nothing is changed then and getError() says why
+    bool commit();
+
+    const std::string& getError() const { return error; }
+
+private:
+    struct Update {
+        std::string name;
+        std::string value;
+        std::string expected;
+        std::string lock_path;
+        bool locked = false;
+    };
+
+    std::string dir;
+    std::vector<Update> updates;
+    std::string error;
+
+    void releaseLocks();
+};
+
 class RefManager {
 private:
     //root path
     const std::string MASTER_DIR = ".gitlite/refs/heads";
     const std::string HEAD_FILE = ".gitlite/HEAD";
 
+    // EXPECTED_OLD as RefTransaction::update() takes it
+    void writeRef(const std::string& refName, const ObjectId& newHash, const std::string& expectedOld);
+
 public:
     void initManager(Commit& init_commit);
     std::string getBranchPath(const std::string& branchName) const;
-    void updateRef(const std::string& refName, const std::string& newHash);
+    void updateRef(const std::string& refName, const ObjectId& newHash);
+    // compare-and-swap: the ref must still hold EXPECTED_OLD (null: must not exist yet)
+    void updateRef(const std::string& refName, const ObjectId& newHash, const ObjectId& expectedOld);
 
     void updateRemoteRef(const std::string &remoteName, const std::string &remoteBranchName,
-                         const std::string &newHash);
+                         const ObjectId &newHash);
 
     std::string getRemoteTrackingBranchPath(const std::string &remoteTrackingName) const;
 
-    // 解析 HEAD
-    std::string resolveHead();
+    // commit hashes of every .gitlite/refs/remotes/[remoteName]/* ref
+    std::vector<ObjectId> getRemoteTrackingHashes(const std::string &remoteName) const;
+
+    // 解析 HEAD, null id if it names nothing
+    ObjectId resolveHead();
 
     std::string getCurrentBranchName();
 
@@ -33,19 +134,28 @@ public:
     void removeBranch(const std::string& branchName);
 
     std::vector<std::string> getAllBranchNames() const;
+
+    // hash of "refs/heads/x" or "refs/remotes/r/x": loose file first, then packed-refs. null if absent
+    ObjectId readRef(const std::string& refName) const;
+
+    // fold every loose branch and remote tracking ref into packed-refs
+    size_t packRefs();
 };
 
 
 class RemoteRefManager {
 private:
     std::string remote_root_dir;
+    PackedRefs packed;
     std::string getRefPath(const std::string& refName) const;
 public:
     explicit RemoteRefManager(const std::string& gitlite_root_dir);
 
-    std::string resolveRef(const std::string& refName) const;
+    // null if absent
+    ObjectId resolveRef(const std::string& refName) const;
 
-    void updateRef(const std::string& refName, const std::string& newHash);
+    // compare-and-swap, EXPECTED_OLD null for a new ref. false if the ref moved meanwhile
+    bool updateRef(const std::string& refName, const ObjectId& newHash, const ObjectId& expectedOld);
 };
 
 class Ref {
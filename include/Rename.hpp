@@ -0,0 +1,72 @@
+#ifndef GITLITE_RENAME_HPP
+#define GITLITE_RENAME_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ObjectDataBase.hpp"
+
+/*
+ * Rename detection between the paths one side of a merge deleted and the
+ * paths it added.
+ *
+ * Same blob id pairs up without reading anything. The rest are read once
+ * each and reduced to a MinHash sketch of their lines: SKETCH_SIZE minima,
+ * one per hash function, whose agreement estimates the Jaccard similarity of
+ * the two line sets. Sketches of the deleted files go into a SimilarityIndex
+ * (locality sensitive hashing: BANDS groups of ROWS minima, bucketed), so an
+ * added file is only compared with deleted files sharing a bucket instead of
+ * with every one of them.
+ */
+namespace Rename {
+    const size_t SKETCH_SIZE = 64;
+    const size_t ROWS = 2;
+    const size_t BANDS = SKETCH_SIZE / ROWS;
+
+    //default minimum similarity, in percent
+    const int MIN_SIMILARITY = 50;
+
+    struct Sketch {
+        uint32_t mins[SKETCH_SIZE];
+        //distinct lines could be 0: such a sketch matches nothing
+        bool empty = true;
+    };
+
+    Sketch sketch(const std::string& content);
+
+    //estimated Jaccard similarity of the two line sets, 0..100
+    int similarity(const Sketch& a, const Sketch& b);
+
+    class SimilarityIndex {
+    private:
+        std::vector<Sketch> sketches;
+        std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+
+    public:
+        //returns the id of the sketch, ids count from 0
+        size_t add(const Sketch& s);
+
+        //ids sharing at least one band with S, each once
+        std::vector<size_t> candidates(const Sketch& s) const;
+
+        const Sketch& at(size_t id) const { return sketches[id]; }
+    };
+
+    struct Match {
+        std::string from;
+        std::string to;
+        int similarity;
+    };
+
+    //pairs each deleted path with at most one added path and the other way
+    //round, best similarity first. DELETED and ADDED map path -> blob id
+    std::vector<Match> detect(ObjectDatabase& db,
+                              const std::map<std::string, ObjectId>& deleted,
+                              const std::map<std::string, ObjectId>& added,
+                              int min_similarity = MIN_SIMILARITY);
+}
+
+#endif //GITLITE_RENAME_HPP
@@ -2,22 +2,37 @@
 #define GITLITE_REPOSITORY_HPP
 #include<string>
 #include<vector>
+#include <unordered_set>
 #include"ObjectDataBase.hpp"
 #include"index.hpp"
 #include "RefManager.hpp"
 
+class PackBuilder;
+
 class Repository {
+private:
+    // lives as long as the Repository, so its object cache stays warm across commands
+    ObjectDatabase objects;
+
+    // cherry-pick (REVERT false) or revert each of COMMITIDS in order on top of HEAD
+    void replayCommits(const std::vector<std::string> &commitIds, bool revert);
+
 public:
 
     void init();
 
-    void add(std::string &);
+    void add(const std::string &);
 
-    void commit(std::string &);
+    void commit(const std::string &);
 
-    void rm(std::string &);
+    void rm(const std::string &);
 
     void log();
+    // `gitlite log -- <path>`: first-parent history limited to commits that changed PATH
+    void logPath(const std::string& path);
+    // `gitlite diff [<commit> [<commit>]] [-- <path>...]`: staged view or COMMITIDS[0] against
+    // the worktree, or COMMITIDS[0] against COMMITIDS[1]; PATHS limits the files shown
+    void diff(const std::vector<std::string>& commitIds, const std::vector<std::string>& paths);
     void globalLog();
 
     void find(const std::string& message);
@@ -35,23 +50,31 @@ public:
 
     void merge(const std::string &givenBranchName);
 
+    // `gitlite cherry-pick <commit>...` / `gitlite revert <commit>...`: each commit's change
+    // against its parent is merged into HEAD (or taken back out of it) and committed
+    void cherryPick(const std::vector<std::string> &commitIds);
+    void revert(const std::vector<std::string> &commitIds);
+
 
-    void performThreeWayMerge(const std::map<std::string, std::string> &splitBlobs,
-                              const std::map<std::string, std::string> &currentBlobs,
-                              const std::map<std::string, std::string> &givenBlobs, index &idx, ObjectDatabase &db,
-                              RefManager &refManager, const std::string &givenBranchName, const std::string &currentBranchName, const std::string &
-                              currentHash, const std::string &givenHash);
+    void performThreeWayMerge(const Manifest &splitBlobs,
+                              const Manifest &currentBlobs,
+                              const Manifest &givenBlobs, index &idx, ObjectDatabase &db,
+                              RefManager &refManager, const std::string &givenBranchName, const std::string &currentBranchName, const ObjectId &
+                              currentHash, const ObjectId &givenHash);
 
-    void writeBlobToWD(ObjectDatabase &db, const std::string &path, const std::string &blobHash);
+    void writeBlobToWD(ObjectDatabase &db, const std::string &path, const ObjectId &blobHash);
 
-    std::string findCommonAncestor(const std::string &hash1, const std::string &hash2);
+    // null id if the two histories share no commit
+    ObjectId findCommonAncestor(const ObjectId &hash1, const ObjectId &hash2);
 
     void addRemote(const std::string &name, const std::string &path);
 
     void rmRemote(const std::string &name);
 
-    void traverseAndCopy(const std::string &start_hash, const std::string &end_hash, ObjectDatabase &local_db,
-                         const std::string &remote_gitlite_path);
+    void traverseAndCopy(const std::unordered_set<ObjectId> &remote_has, const ObjectId &end_hash,
+                         ObjectDatabase &local_db, const std::string &remote_gitlite_path);
+
+    void sendPack(PackBuilder &pack, ObjectDatabase &dest);
 
     void push(const std::string &remoteName, const std::string &remoteBranchName);
 
@@ -59,6 +82,30 @@ public:
 
     void pull(const std::string &remoteName, const std::string &remoteBranchName);
 
+    // push / fetch for remotes named "serve:<path>" or "unix:<socket>"
+    void pushToDaemon(const std::string &remoteName, const std::string &url, const std::string &remoteBranchName);
+
+    void fetchFromDaemon(const std::string &remoteName, const std::string &url, const std::string &remoteBranchName);
+
+    // `gitlite merge-tree <commit> <commit>`: merge in memory and store the result blobs only,
+    // no worktree, index or ref is touched (usable in a repository without a worktree)
+    void mergeTree(const std::string &oursId, const std::string &theirsId);
+
+    // `gitlite hash-object [-w] <file>`
+    void hashObject(const std::string &file, bool write);
+
+    // fold loose refs into .gitlite/packed-refs
+    void packRefs();
+
+    // merge every pack under .gitlite/objects/pack into one
+    void repack();
+
+    // (re)write .gitlite/commit-graph for every commit reachable from a branch
+    void writeCommitGraph();
+
+    // `gitlite serve [--socket <path>]`
+    void serve(const std::string &socketPath);
+
     static std::string  getGitliteDir();
 };
 
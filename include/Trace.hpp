@@ -0,0 +1,102 @@
+#ifndef GITLITE_TRACE_HPP
+#define GITLITE_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * GITLITE_TRACE=<file>: per command timings and counters, appended to <file>
+ * as one JSON object per line:
+ *
+ *   {"pid": 4242, "cmd": "checkout", "args": ["b1"], "ok": true, "wall_ms": 41.7,
+ *    "phases": {"checkout.write-worktree": {"ms": 30.2, "count": 1}, ...},
+ *    "counters": {"objects_read": 203, "bytes_hashed": 0, "stat_calls": 612, ...}}
+ *
+ * Phases may nest, their times are inclusive. Each line is written with a
+ * single append, so several processes can share one file.
+ *
+ * Unset (the default), every hook is one load of a global flag and a branch.
+ */
+namespace Trace {
+    enum Counter {
+        OBJECTS_READ,
+        OBJECTS_WRITTEN,
+        OBJECT_BYTES_READ,
+        OBJECT_BYTES_WRITTEN,
+        OBJECT_CACHE_HITS,
+        INDEX_CACHE_HITS,
+        BYTES_HASHED,
+        FILES_READ,
+        FILES_WRITTEN,
+        FILE_BYTES_READ,
+        FILE_BYTES_WRITTEN,
+        STAT_CALLS,
+        READDIR_CALLS,
+        FSYNC_CALLS,
+        BLOOM_CHECKS,
+        BLOOM_NEGATIVES,
+        COUNTER_COUNT
+    };
+
+    namespace detail {
+        extern bool on;
+        extern std::atomic<uint64_t> counters[COUNTER_COUNT];
+        void addPhase(const char* name, std::chrono::steady_clock::duration elapsed);
+    }
+
+    inline bool enabled() {
+        return detail::on;
+    }
+
+    inline void count(Counter c, uint64_t n = 1) {
+        if (detail::on) {
+            detail::counters[c].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    //adds the time until the end of the scope to phase NAME (a string literal)
+    class Phase {
+    private:
+        const char* name = nullptr;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit Phase(const char* phase_name) {
+            if (detail::on) {
+                name = phase_name;
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~Phase() {
+            if (name) detail::addPhase(name, std::chrono::steady_clock::now() - start);
+        }
+
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+    };
+
+    //one traced command: emits its line when it goes out of scope and starts the
+    //next command from zero
+    class Command {
+    private:
+        bool active;
+        std::vector<std::string> args;
+        std::string error;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        //ARGS[0] is the command name
+        explicit Command(const std::vector<std::string>& command_args);
+        ~Command();
+
+        void fail(const std::string& message);
+
+        Command(const Command&) = delete;
+        Command& operator=(const Command&) = delete;
+    };
+}
+
+#endif //GITLITE_TRACE_HPP
@@ -0,0 +1,71 @@
+#ifndef GITLITE_TRANSFERENGINE_HPP
+#define GITLITE_TRANSFERENGINE_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "ObjectId.hpp"
+#include "Objects.hpp"
+
+struct TransferStats {
+    size_t commits = 0;     //commits visited by the traversal
+    size_t objects = 0;     //objects actually written on the destination
+    size_t bytes = 0;       //bytes written on the destination
+    double seconds = 0;
+
+    double objectsPerSec() const;
+    double bytesPerSec() const;
+    std::string summary() const;
+};
+
+//moves the closure of a commit from one object store to another
+//stage 1: a traversal thread walks the commit graph
+//       and diffs each commit against its parents, so only blobs that changed are listed
+//stage 2: the caller enumerates commit + blob ids and drops duplicates
+//stage 3: a worker pool copies the blobs while the traversal keeps going
+//commits are written last, parents first, once all their blobs are in place
+//push and fetch only differ by the callbacks they plug in
+class TransferEngine {
+public:
+    //read a commit on the source side
+    using CommitReader = std::function<std::shared_ptr<Commit>(const ObjectId&)>;
+    //read only the parents and metadata of a commit (nullptr if unknown)
+    using HeaderReader = std::function<std::shared_ptr<const CommitHeader>(const ObjectId&)>;
+    //copy one object to the destination, return bytes written (0 if it was already there)
+    using ObjectCopier = std::function<size_t(const ObjectId&)>;
+    //true if the destination already has this commit (and therefore its history)
+    using StopPredicate = std::function<bool(const ObjectId&)>;
+
+    TransferEngine(CommitReader reader, ObjectCopier copier, unsigned workers = 0);
+
+    void setStopPredicate(StopPredicate pred) { stop_at = std::move(pred); }
+
+    //nothing to do for a null TIP
+    TransferStats run(const ObjectId& tip);
+
+    //print stats to stderr when GITLITE_TRANSFER_STATS is set
+    static void report(const std::string& what, const TransferStats& stats);
+    static void report(const std::string& what, const std::string& summary);
+
+    //stop predicate for "the destination has TIPS": true for commits reachable from TIPS.
+    //their history is walked lazily, STEPS commits per call, so the cost follows the
+    //traversal asking instead of the whole history behind TIPS. a commit the walk has
+    //not reached yet is answered false and just sent again
+    static StopPredicate reachableFrom(const std::vector<ObjectId>& tips, HeaderReader reader,
+                                       size_t steps = 2);
+
+    //(commit, parents) pairs -> commit ids with every parent ahead of its children
+    static std::vector<ObjectId> orderParentsFirst(
+        const std::vector<std::pair<ObjectId, std::vector<ObjectId>>>& commits);
+
+private:
+    CommitReader read_commit;
+    ObjectCopier copy_object;
+    StopPredicate stop_at;
+    unsigned worker_count;
+};
+
+#endif //GITLITE_TRANSFERENGINE_HPP
@@ -32,6 +32,24 @@ namespace SHA1 {
         std::string sha(std::string message);
     };
     extern SHA sha;
+
+    // incremental SHA-1: feed data in pieces, read the digest at the end.
+    // unlike the shared `sha` object it carries no global state, so it is safe across threads
+    class Hasher {
+    private:
+        uint32_t h[5];
+        unsigned char block[64];
+        size_t block_len;
+        uint64_t total_len;
+        void compress(const unsigned char* chunk);
+    public:
+        Hasher();
+        void update(const char* data, size_t len);
+        void update(const std::string& data) { update(data.data(), data.size()); }
+        // the 20 digest bytes; either of these ends the hasher
+        void digest(unsigned char out[20]);
+        std::string hexdigest();
+    };
     std::string sha1(std::string message);
     std::string sha1(std::string s1, std::string s2);
     std::string sha1(std::string s1, std::string s2, std::string s3, std::string s4);
@@ -55,6 +73,19 @@ public:
     static void writeContents(const std::string& filepath, const std::string& content);
     static void writeContents(const std::string& filepath, const std::vector<unsigned char>& content);
 
+    // Durability, picked by GITLITE_FSYNC:
+    //   none     temp file + rename only
+    //   batched  (default) like none, but the objects written are fsynced (with their
+    //            directories) before the first ref/index write, the other .gitlite files
+    //            when the command ends. worktree files are not synced
+    //   strict   fsync every file before its rename and its directory after
+    enum class FsyncMode { None, Batched, Strict };
+    static FsyncMode fsyncMode();
+    // move a fully written TMP_PATH over FILEPATH under the current mode (thread safe)
+    static void commitFile(const std::string& tmpPath, const std::string& filepath);
+    // make everything written so far durable, by any thread
+    static void syncPendingWrites();
+
     // Directory operations
     static std::vector<std::string> plainFilenamesIn(const std::string& dirPath);
     static std::string join(const std::string& first, const std::string& second);
@@ -65,7 +96,8 @@ public:
 
     // Message and error reporting
     static void message(const std::string& msg);
-    static void exitWithMessage(const std::string& msg);
+    // throws GitliteException(msg), never returns
+    [[noreturn]] static void exitWithMessage(const std::string& msg);
 
     // File existence check
     static bool exists(const std::string& path);
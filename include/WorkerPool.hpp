@@ -0,0 +1,45 @@
+#ifndef GITLITE_WORKERPOOL_HPP
+#define GITLITE_WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//fixed-size pool of threads draining a FIFO of tasks
+//the first exception thrown by a task is kept and rethrown by wait()
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+    size_t in_flight = 0;
+    bool stopping = false;
+    std::exception_ptr first_error;
+
+    void workerLoop();
+
+public:
+    // 0 means one thread per hardware core
+    explicit WorkerPool(unsigned threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    //block until every submitted task finished
+    void wait();
+
+    size_t size() const { return workers.size(); }
+
+    static unsigned defaultThreads();
+};
+
+#endif //GITLITE_WORKERPOOL_HPP
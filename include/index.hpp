@@ -5,18 +5,19 @@
 #include <map>
 #include <string>
 #include<memory>
+#include <sys/stat.h>
 #include"Objects.hpp"
 
 class Blob;
 class index {
-    std::map<std::string, std::string> entries;     //file path & blob hashid
+    std::map<std::string, ObjectId> entries;     //file path & blob hashid
     std::vector<std::string> removed_entries;  //removed files (path only)
     const std::string INDEX_PATH = ".gitlite/index";
 
 public:
     index(){ load();}
 
-    void add_entry(std::string path , std::string hash);
+    void add_entry(std::string path , const ObjectId& hash);
     void add_rm_entry(std::string path);
 
     void rm_entry(const std::string& path);
@@ -26,7 +27,7 @@ public:
     bool contains_in_entries(const std::string& path);
     bool indentical(const std::string& path , Blob&);
 
-    const std::map<std::string, std::string>& getEntries() const {
+    const std::map<std::string, ObjectId>& getEntries() const {
         return entries;
     }
     const std::vector<std::string>& getRmEntries() const {
@@ -45,4 +46,30 @@ public:
 
 };
 
+//worktree path -> content hash, valid while the file keeps its ino/size/mtime,
+//so diff only reads files that were touched since they were last hashed
+class StatCache {
+    struct Stamp {
+        ino_t ino = 0;
+        off_t size = 0;
+        struct timespec mtime = {0, 0};
+        ObjectId oid;
+    };
+    std::map<std::string, Stamp> stamps;
+    bool dirty = false;
+    const std::string STAT_PATH = ".gitlite/index-stat";
+
+public:
+    StatCache() { load(); }
+
+    //hash of PATH when ST still matches what was recorded for it
+    bool lookup(const std::string& path, const struct stat& st, ObjectId& oid) const;
+    //remember that PATH with ST hashes to OID (skipped while ST is too fresh to trust)
+    void record(const std::string& path, const struct stat& st, const ObjectId& oid);
+
+    //no-op unless something was recorded
+    void write();
+    void load();
+};
+
 #endif //GITLITE_INDEX_HPP
\ No newline at end of file
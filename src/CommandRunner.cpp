@@ -0,0 +1,298 @@
+#include "CommandRunner.hpp"
+
+#include <sstream>
+
+#include "GitliteException.h"
+#include "Trace.hpp"
+#include "Utils.h"
+
+namespace {
+    void checkCWD() {
+        if (!Utils::isDirectory(Repository::getGitliteDir())) {
+            Utils::exitWithMessage("Not in an initialized Gitlite directory.");
+        }
+    }
+
+    void checkNoArgs(const std::vector<std::string>& args) {
+        if (args.empty()) {
+            Utils::exitWithMessage("Please enter a command.");
+        }
+    }
+
+    void checkArgsNum(const std::vector<std::string>& args, int n) {
+        if (static_cast<int>(args.size()) != n) {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+    }
+
+    //points std::cout at a buffer for the lifetime of the object
+    class CaptureStdout {
+    private:
+        std::streambuf* saved;
+
+    public:
+        std::stringstream buffer;
+
+        CaptureStdout() : saved(std::cout.rdbuf(buffer.rdbuf())) {}
+        ~CaptureStdout() { std::cout.rdbuf(saved); }
+    };
+}
+
+void CommandRunner::run(const std::vector<std::string>& args) {
+    Trace::Command trace(args);
+    try {
+        dispatch(args);
+    } catch (const GitliteException& e) {
+        trace.fail(e.what());
+        throw;
+    }
+}
+
+void CommandRunner::dispatch(const std::vector<std::string>& args) {
+    checkNoArgs(args);
+    std::string firstArg = args[0];
+
+    if (firstArg == "init") {
+        checkArgsNum(args, 1);
+        repo.init();
+    }
+    else if (firstArg == "add-remote") {
+        checkCWD();
+        checkArgsNum(args, 3);
+        repo.addRemote(args[1], args[2]);
+    }
+    else if (firstArg == "rm-remote") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.rmRemote(args[1]);
+    }
+    else if (firstArg == "add") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.add(args[1]);
+    }
+    else if (firstArg == "commit") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.commit(args[1]);
+    }
+    else if (firstArg == "rm") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.rm(args[1]);
+    }
+    else if (firstArg == "log") {
+        checkCWD();
+        if (args.size() == 1) {
+            repo.log();
+        } else if (args.size() == 3 && args[1] == "--") {
+            repo.logPath(args[2]);
+        } else {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+    }
+    else if (firstArg == "diff") {
+        checkCWD();
+        auto dashes = std::find(args.begin() + 1, args.end(), std::string("--"));
+        std::vector<std::string> commitIds(args.begin() + 1, dashes);
+        std::vector<std::string> paths;
+        if (dashes != args.end()) {
+            paths.assign(dashes + 1, args.end());
+        }
+        if (commitIds.size() > 2) {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        repo.diff(commitIds, paths);
+    }
+    else if (firstArg == "global-log") {
+        checkCWD();
+        checkArgsNum(args, 1);
+        repo.globalLog();
+    }
+    else if (firstArg == "find") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.find(args[1]);
+    }
+    else if (firstArg == "status") {
+        checkCWD();
+        checkArgsNum(args, 1);
+        repo.status();
+    }
+    else if (firstArg == "checkout") {
+        checkCWD();
+        if (args.size() == 2) {
+            repo.checkoutBranch(args[1]);
+        } else if (args.size() == 3) {
+            if (args[1] != "--") {
+                Utils::exitWithMessage("Incorrect operands.");
+            }
+            repo.checkoutFile(args[2]);
+        } else if (args.size() == 4) {
+            if (args[2] != "--") {
+                Utils::exitWithMessage("Incorrect operands.");
+            }
+            repo.checkoutFileInCommit(args[1], args[3]);
+        } else {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+    }
+    else if (firstArg == "branch") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.branch(args[1]);
+    }
+    else if (firstArg == "rm-branch") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.rm_branch(args[1]);
+    }
+    else if (firstArg == "reset") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.reset(args[1]);
+    }
+    else if (firstArg == "merge") {
+        checkCWD();
+        checkArgsNum(args, 2);
+        repo.merge(args[1]);
+    }
+    else if (firstArg == "push") {
+        checkCWD();
+        checkArgsNum(args, 3);
+        repo.push(args[1], args[2]);
+    }
+    else if (firstArg == "fetch") {
+        checkCWD();
+        checkArgsNum(args, 3);
+        repo.fetch(args[1], args[2]);
+    }
+    else if (firstArg == "pull") {
+        checkCWD();
+        checkArgsNum(args, 3);
+        repo.pull(args[1], args[2]);
+    }
+    else if (firstArg == "cherry-pick" || firstArg == "revert") {
+        checkCWD();
+        if (args.size() < 2) {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        std::vector<std::string> commitIds(args.begin() + 1, args.end());
+        if (firstArg == "cherry-pick") {
+            repo.cherryPick(commitIds);
+        } else {
+            repo.revert(commitIds);
+        }
+    }
+    else if (firstArg == "merge-tree") {
+        checkCWD();
+        checkArgsNum(args, 3);
+        repo.mergeTree(args[1], args[2]);
+    }
+    else if (firstArg == "hash-object") {
+        if (args.size() == 2) {
+            repo.hashObject(args[1], false);
+        } else if (args.size() == 3 && args[1] == "-w") {
+            checkCWD();
+            repo.hashObject(args[2], true);
+        } else {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+    }
+    else if (firstArg == "pack-refs") {
+        checkCWD();
+        checkArgsNum(args, 1);
+        repo.packRefs();
+    }
+    else if (firstArg == "repack") {
+        checkCWD();
+        checkArgsNum(args, 1);
+        repo.repack();
+    }
+    else if (firstArg == "commit-graph") {
+        checkCWD();
+        checkArgsNum(args, 1);
+        repo.writeCommitGraph();
+    }
+    else if (firstArg == "serve") {
+        checkCWD();
+        if (args.size() == 1) {
+            repo.serve("");
+        } else if (args.size() == 3 && args[1] == "--socket") {
+            repo.serve(args[2]);
+        } else {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+    }
+    else if (firstArg == "batch") {
+        Utils::exitWithMessage("Incorrect operands.");
+    }
+    else {
+        Utils::exitWithMessage("No command with that name exists.");
+    }
+}
+
+void CommandRunner::batch(std::istream& in, std::ostream& out) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> args = splitLine(line);
+        if (args.empty()) continue;
+        if (args.size() == 1 && args[0] == "quit") break;
+
+        bool ok = true;
+        std::string payload;
+        {
+            CaptureStdout capture;
+            try {
+                //serving would take over our stdin
+                if (args[0] == "serve") {
+                    Utils::exitWithMessage("serve is not available in batch mode.");
+                }
+                run(args);
+            } catch (const std::exception& e) {
+                ok = false;
+                std::cout << e.what() << "\n";
+            }
+            payload = capture.buffer.str();
+        }
+        //each command is durable before its answer goes out
+        Utils::syncPendingWrites();
+
+        out << (ok ? "ok " : "error ") << payload.size() << "\n" << payload;
+        out.flush();
+    }
+}
+
+std::vector<std::string> CommandRunner::splitLine(const std::string& line) {
+    std::vector<std::string> words;
+    std::string word;
+    bool in_word = false;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '\\' && i + 1 < line.size()) {
+            char next = line[++i];
+            word += next == 'n' ? '\n' : next;
+            in_word = true;
+        } else if (c == '"') {
+            quoted = !quoted;
+            in_word = true;
+        } else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+            if (in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (quoted) {
+        Utils::exitWithMessage("Unterminated quote.");
+    }
+    if (in_word) {
+        words.push_back(word);
+    }
+    return words;
+}
@@ -0,0 +1,260 @@
+#include "CommitGraph.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_set>
+
+#include "GitliteException.h"
+#include "Trace.hpp"
+#include "Utils.h"
+
+namespace {
+    const std::string GRAPH_MAGIC = "GITLITE-COMMIT-GRAPH 1 ";
+
+    uint32_t fnv1a(const std::string& s, uint32_t seed) {
+        uint32_t h = seed;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        //final avalanche, fnv alone leaves the low bits weak for short keys
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+
+    //bit positions of PATH in a filter of NBITS bits (double hashing)
+    template<typename F>
+    void probe(const std::string& path, size_t nbits, F visit) {
+        uint32_t h1 = fnv1a(path, 2166136261u);
+        uint32_t h2 = fnv1a(path, 0x9e3779b9u) | 1;
+        for (int i = 0; i < CommitGraph::HASHES; ++i) {
+            visit((h1 + static_cast<uint32_t>(i) * h2) % nbits);
+        }
+    }
+
+    std::string toHex(const std::string& bytes) {
+        static const char* hex = "0123456789abcdef";
+        std::string out;
+        out.reserve(bytes.size() * 2);
+        for (unsigned char c : bytes) {
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        }
+        return out;
+    }
+
+    int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    //bytes written by toHex; throws on anything else
+    std::string fromHex(const std::string& text) {
+        if (text.size() % 2 != 0) {
+            throw GitliteException("Corrupted commit-graph.");
+        }
+        std::string out(text.size() / 2, '\0');
+        for (size_t i = 0; i < out.size(); ++i) {
+            int hi = hexDigit(text[i * 2]);
+            int lo = hexDigit(text[i * 2 + 1]);
+            if (hi < 0 || lo < 0) {
+                throw GitliteException("Corrupted commit-graph.");
+            }
+            out[i] = static_cast<char>(hi << 4 | lo);
+        }
+        return out;
+    }
+
+    bool parseCount(const std::string& text, size_t& out) {
+        if (text.empty() || text.size() > 18) return false;
+        size_t value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + (c - '0');
+        }
+        out = value;
+        return true;
+    }
+
+    std::shared_ptr<Commit> readCommit(const ObjectDatabase& db, const ObjectId& oid) {
+        return std::dynamic_pointer_cast<Commit>(db.readObject(oid));
+    }
+}
+
+CommitGraph::CommitGraph(const std::string& gitlite_dir) : path(Utils::join(gitlite_dir, "commit-graph")) {
+}
+
+bool CommitGraph::load() {
+    entries.clear();
+    if (!Utils::isFile(path)) {
+        return false;
+    }
+    std::stringstream ss(Utils::readContentsAsString(path));
+    std::string line;
+    if (!std::getline(ss, line) || line.compare(0, GRAPH_MAGIC.size(), GRAPH_MAGIC) != 0) {
+        throw GitliteException("Corrupted commit-graph.");
+    }
+    size_t count = 0;
+    if (!parseCount(line.substr(GRAPH_MAGIC.size()), count)) {
+        throw GitliteException("Corrupted commit-graph.");
+    }
+    //only a hint, the lines below are what counts
+    entries.reserve(std::min<size_t>(count, 1 << 20));
+
+    while (std::getline(ss, line)) {
+        std::stringstream fields(line);
+        std::string oid, parents, filter;
+        Entry e;
+        if (!(fields >> oid >> parents >> filter) || !ObjectId::parseHex(oid.data(), oid.size(), e.oid)) {
+            throw GitliteException("Corrupted commit-graph.");
+        }
+        if (parents != "-") {
+            std::stringstream ps(parents);
+            std::string p;
+            while (std::getline(ps, p, ',')) {
+                ObjectId parent;
+                if (!ObjectId::parseHex(p.data(), p.size(), parent)) {
+                    throw GitliteException("Corrupted commit-graph.");
+                }
+                e.parents.push_back(parent);
+            }
+        }
+        if (filter == "*") {
+            e.overflow = true;
+        } else if (filter != "-") {
+            e.filter = fromHex(filter);
+            if (e.filter.empty()) {
+                throw GitliteException("Corrupted commit-graph.");
+            }
+        }
+        //find() bisects
+        if (!entries.empty() && !(entries.back().oid < e.oid)) {
+            throw GitliteException("Corrupted commit-graph.");
+        }
+        entries.push_back(std::move(e));
+    }
+    return true;
+}
+
+const CommitGraph::Entry* CommitGraph::find(const ObjectId& oid) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), oid,
+                               [](const Entry& e, const ObjectId& key) { return e.oid < key; });
+    if (it == entries.end() || it->oid != oid) return nullptr;
+    return &*it;
+}
+
+bool CommitGraph::mayHaveChanged(const Entry& entry, const std::string& changed_path) {
+    Trace::count(Trace::BLOOM_CHECKS);
+    if (entry.overflow) return true;
+    if (entry.filter.empty()) {
+        Trace::count(Trace::BLOOM_NEGATIVES);
+        return false;
+    }
+    bool hit = true;
+    size_t nbits = entry.filter.size() * 8;
+    probe(changed_path, nbits, [&](size_t bit) {
+        if (!(static_cast<unsigned char>(entry.filter[bit / 8]) & (1u << (bit % 8)))) hit = false;
+    });
+    if (!hit) Trace::count(Trace::BLOOM_NEGATIVES);
+    return hit;
+}
+
+std::vector<std::string> CommitGraph::changedPaths(const ObjectDatabase& db, const Commit& commit) {
+    static const Manifest empty;
+    std::shared_ptr<Commit> parent;
+    const auto& fathers = commit.getFatherCommits();
+    if (!fathers.empty()) {
+        parent = readCommit(db, fathers[0]);
+    }
+    const auto& mine = commit.getBlobs();
+    const auto& theirs = parent ? parent->getBlobs() : empty;
+
+    //both manifests are sorted: one merge pass
+    std::vector<std::string> changed;
+    auto a = mine.begin();
+    auto b = theirs.begin();
+    while (a != mine.end() || b != theirs.end()) {
+        if (b == theirs.end() || (a != mine.end() && a->path < b->path)) {
+            changed.push_back((a++)->path.str());
+        } else if (a == mine.end() || b->path < a->path) {
+            changed.push_back((b++)->path.str());
+        } else {
+            if (a->blob != b->blob) changed.push_back(a->path.str());
+            ++a;
+            ++b;
+        }
+    }
+    return changed;
+}
+
+CommitGraph::Entry CommitGraph::makeEntry(const ObjectDatabase& db, const Commit& commit) {
+    Entry e;
+    e.oid = commit.get_hashid();
+    e.parents = commit.getFatherCommits();
+
+    std::vector<std::string> changed = changedPaths(db, commit);
+    if (changed.size() > MAX_PATHS) {
+        e.overflow = true;
+        return e;
+    }
+    if (changed.empty()) {
+        return e;
+    }
+    size_t nbytes = std::max<size_t>(8, (changed.size() * BITS_PER_PATH + 7) / 8);
+    e.filter.assign(nbytes, '\0');
+    for (const std::string& p : changed) {
+        probe(p, nbytes * 8, [&e](size_t bit) {
+            e.filter[bit / 8] = static_cast<char>(static_cast<unsigned char>(e.filter[bit / 8]) | (1u << (bit % 8)));
+        });
+    }
+    return e;
+}
+
+std::pair<size_t, size_t> CommitGraph::write(const ObjectDatabase& db, const std::vector<ObjectId>& tips) {
+    Trace::Phase phase("commit-graph.write");
+    load();
+    std::vector<Entry> updated = entries;
+    size_t added = 0;
+
+    //walk down from the tips, stopping at commits the file already covers
+    //(their ancestors were covered when they were added)
+    std::unordered_set<ObjectId> seen;
+    std::vector<ObjectId> todo;
+    for (const ObjectId& tip : tips) {
+        if (!tip.isNull() && seen.insert(tip).second) todo.push_back(tip);
+    }
+    while (!todo.empty()) {
+        ObjectId oid = todo.back();
+        todo.pop_back();
+        if (find(oid)) continue;
+        std::shared_ptr<Commit> commit = readCommit(db, oid);
+        if (!commit) {
+            throw GitliteException("Corrupted object: " + oid.abbrev() + " is not a Commit.");
+        }
+        updated.push_back(makeEntry(db, *commit));
+        added++;
+        for (const ObjectId& parent : commit->getFatherCommits()) {
+            if (seen.insert(parent).second) todo.push_back(parent);
+        }
+    }
+
+    std::sort(updated.begin(), updated.end(), [](const Entry& a, const Entry& b) { return a.oid < b.oid; });
+    std::ostringstream out;
+    out << GRAPH_MAGIC << updated.size() << "\n";
+    for (const Entry& e : updated) {
+        out << e.oid << " ";
+        if (e.parents.empty()) {
+            out << "-";
+        }
+        for (size_t i = 0; i < e.parents.size(); ++i) {
+            out << (i ? "," : "") << e.parents[i];
+        }
+        out << " " << (e.overflow ? "*" : e.filter.empty() ? "-" : toHex(e.filter)) << "\n";
+    }
+    Utils::writeContents(path, out.str());
+    entries.swap(updated);
+    return {entries.size(), added};
+}
@@ -0,0 +1,427 @@
+#include "Daemon.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "GitliteException.h"
+#include "RefManager.hpp"
+#include "TransferEngine.hpp"
+#include "Utils.h"
+
+namespace {
+    const size_t READ_CHUNK = 64 * 1024;
+
+    std::shared_ptr<Commit> readLocalCommit(ObjectDatabase& db, const ObjectId& oid) {
+        if (!db.hasObject(oid)) return nullptr;
+        return std::dynamic_pointer_cast<Commit>(db.readObject(oid));
+    }
+
+    std::string& serverExecutable() {
+        static std::string path;
+        return path;
+    }
+
+    //what to run as `<exe> serve`: set by the host program, else GITLITE_EXECUTABLE,
+    //else `gitlite` looked up on PATH. never /proc/self/exe here: in a program that
+    //embeds the library that is the host, not gitlite
+    std::string gitliteExecutable() {
+        if (!serverExecutable().empty()) return serverExecutable();
+        const char* env = std::getenv("GITLITE_EXECUTABLE");
+        if (env && *env) return env;
+        return "gitlite";
+    }
+
+    //"../D1/.gitlite" and "../D1" both name the repository in ../D1
+    std::string repositoryDirOf(std::string path) {
+        while (path.size() > 1 && path.back() == '/') path.pop_back();
+        const std::string suffix = ".gitlite";
+        if (path == suffix) return ".";
+        if (path.size() > suffix.size() &&
+            path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0 &&
+            path[path.size() - suffix.size() - 1] == '/') {
+            path.erase(path.size() - suffix.size() - 1);
+            if (path.empty()) path = "/";
+        }
+        return path;
+    }
+
+    //null unless HASH is a full hex id
+    ObjectId parseHash(const std::string& hash) {
+        ObjectId oid;
+        ObjectId::parseHex(hash.data(), hash.size(), oid);
+        return oid;
+    }
+}
+
+/* FdStream */
+
+bool FdStream::fill() {
+    if (pos > 0) {
+        buffer.erase(0, pos);
+        pos = 0;
+    }
+    char chunk[READ_CHUNK];
+    ssize_t n;
+    do {
+        n = ::read(in_fd, chunk, sizeof(chunk));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    buffer.append(chunk, n);
+    return true;
+}
+
+bool FdStream::readLine(std::string& line) {
+    while (true) {
+        size_t nl = buffer.find('\n', pos);
+        if (nl != std::string::npos) {
+            line = buffer.substr(pos, nl - pos);
+            pos = nl + 1;
+            return true;
+        }
+        if (!fill()) return false;
+    }
+}
+
+void FdStream::feed(PackReceiver& receiver) {
+    while (true) {
+        if (pos < buffer.size()) {
+            pos += receiver.feed(buffer.data() + pos, buffer.size() - pos);
+        }
+        if (receiver.done()) return;
+        if (!fill()) {
+            throw GitliteException("Connection closed in the middle of a pack.");
+        }
+    }
+}
+
+void FdStream::write(const std::string& data) {
+    write(data.data(), data.size());
+}
+
+void FdStream::write(const char* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::write(out_fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw GitliteException("Connection to the remote was lost.");
+        }
+        done += n;
+    }
+}
+
+/* pack stream */
+
+void PackStream::write(FdStream& stream, PackBuilder& objects) {
+    objects.writeTo([&stream](const char* data, size_t len) {
+        stream.write(data, len);
+    });
+}
+
+void PackStream::receive(FdStream& stream, PackReceiver& receiver) {
+    std::string header;
+    if (!stream.readLine(header)) {
+        throw GitliteException("Connection to the remote was lost.");
+    }
+    if (header.compare(0, 6, "error ") == 0) {
+        throw GitliteException(header.substr(6));
+    }
+    header += "\n";
+
+    receiver.feed(header.data(), header.size());
+    stream.feed(receiver);
+    receiver.verify();
+}
+
+size_t PackStream::read(FdStream& stream, ObjectDatabase& db) {
+    PackReceiver receiver(db);
+    receive(stream, receiver);
+    size_t received = receiver.install();
+    db.repack(ObjectDatabase::AUTO_REPACK_PACKS);
+    return received;
+}
+
+/* server */
+
+void DaemonServer::run() {
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::string line;
+    while (stream.readLine(line)) {
+        std::stringstream ss(line);
+        std::string cmd;
+        ss >> cmd;
+
+        try {
+            if (cmd == "list-refs") {
+                listRefs();
+            } else if (cmd == "fetch") {
+                std::string want;
+                ss >> want;
+                uploadPack(want);
+            } else if (cmd == "push") {
+                std::string ref, old_hash, new_hash;
+                ss >> ref >> old_hash >> new_hash;
+                receivePack(ref, old_hash, new_hash);
+            } else if (cmd == "quit") {
+                return;
+            } else {
+                stream.write("error unknown request\n");
+            }
+        } catch (const std::exception& e) {
+            stream.write(std::string("error ") + e.what() + "\n");
+        }
+    }
+}
+
+void DaemonServer::listRefs() {
+    RefManager refs;
+    RemoteRefManager reader(".gitlite");
+    std::string out;
+    for (const std::string& branch : refs.getAllBranchNames()) {
+        std::string ref = "refs/heads/" + branch;
+        ObjectId hash = reader.resolveRef(ref);
+        if (!hash.isNull()) {
+            out += hash.hex() + " " + ref + "\n";
+        }
+    }
+    out += "end\n";
+    stream.write(out);
+}
+
+void DaemonServer::uploadPack(const std::string& want) {
+    std::vector<ObjectId> haves;
+    std::string line;
+    while (stream.readLine(line) && line != "done") {
+        if (line.compare(0, 5, "have ") == 0) {
+            ObjectId have = parseHash(line.substr(5));
+            if (!have.isNull()) haves.push_back(have);
+        }
+    }
+
+    ObjectDatabase db;
+    ObjectId want_id = parseHash(want);
+    if (want_id.isNull() || !db.hasObject(want_id)) {
+        throw GitliteException("That remote does not have that branch.");
+    }
+
+    TransferEngine::CommitReader reader = [&db](const ObjectId& oid) {
+        return readLocalCommit(db, oid);
+    };
+    //haves we do not know about are simply ignored
+    TransferEngine::HeaderReader header_reader = [&db](const ObjectId& oid) -> std::shared_ptr<const CommitHeader> {
+        if (!db.hasObject(oid)) return nullptr;
+        return db.readCommitHeader(oid);
+    };
+
+    PackBuilder objects(db);
+    TransferEngine engine(reader, [&objects](const ObjectId& oid) {
+        return objects.add(oid);
+    });
+    engine.setStopPredicate(TransferEngine::reachableFrom(haves, header_reader));
+    engine.run(want_id);
+
+    PackStream::write(stream, objects);
+}
+
+void DaemonServer::receivePack(const std::string& ref, const std::string& old_hash, const std::string& new_hash) {
+    ObjectDatabase db;
+    //always drain the pack so the connection stays usable. it stays a temp file
+    //until both it and the request check out: a bad push leaves no trace
+    PackReceiver receiver(db);
+    PackStream::receive(stream, receiver);
+
+    if (ref.compare(0, 11, "refs/heads/") != 0 || ref.size() == 11) {
+        throw GitliteException("Unsupported reference name: " + ref);
+    }
+    ObjectId new_id = parseHash(new_hash);
+    if (new_id.isNull() || !(receiver.contains(new_id) || db.hasObject(new_id))) {
+        throw GitliteException("Pushed commit is missing from the pack.");
+    }
+    ObjectId expected = parseHash(old_hash);
+    if (expected.isNull() && old_hash != "-") {
+        throw GitliteException("Invalid hash provided for reference update.");
+    }
+
+    receiver.install();
+    db.repack(ObjectDatabase::AUTO_REPACK_PACKS);
+
+    RemoteRefManager refs(".gitlite");
+    if (!refs.updateRef(ref, new_id, expected)) {
+        throw GitliteException(DaemonClient::REF_MOVED);
+    }
+    stream.write("ok\n");
+}
+
+void DaemonServer::serveStdio() {
+    FdStream s(STDIN_FILENO, STDOUT_FILENO);
+    DaemonServer server(s);
+    server.run();
+}
+
+void DaemonServer::serveSocket(const std::string& socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw GitliteException("Socket path too long.");
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw GitliteException("Cannot create socket.");
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        close(listen_fd);
+        throw GitliteException("Cannot listen on " + socket_path);
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        //one client at a time keeps ref updates on this repository serialized
+        try {
+            FdStream s(fd, fd);
+            DaemonServer server(s);
+            server.run();
+        } catch (const std::exception&) {
+            //a broken client must not take the daemon down
+        }
+        close(fd);
+    }
+    close(listen_fd);
+}
+
+/* client */
+
+const std::string DaemonClient::REF_MOVED = "Remote branch was updated by another push.";
+
+void DaemonClient::setServerExecutable(const std::string& path) {
+    serverExecutable() = path;
+}
+
+bool DaemonClient::isDaemonUrl(const std::string& url) {
+    return url.compare(0, 6, "serve:") == 0 || url.compare(0, 5, "unix:") == 0;
+}
+
+DaemonClient::DaemonClient(const std::string& url) {
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (url.compare(0, 5, "unix:") == 0) {
+        std::string socket_path = url.substr(5);
+        sockaddr_un addr{};
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            throw GitliteException("Remote directory not found.");
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            if (fd >= 0) close(fd);
+            throw GitliteException("Remote directory not found.");
+        }
+        in_fd = fd;
+        out_fd = fd;
+    } else {
+        std::string dir = repositoryDirOf(url.substr(6));
+        if (!Utils::isDirectory(Utils::join(dir, ".gitlite"))) {
+            throw GitliteException("Remote directory not found.");
+        }
+        std::string exe = gitliteExecutable();
+
+        int to_server[2];
+        int from_server[2];
+        if (pipe(to_server) != 0 || pipe(from_server) != 0) {
+            throw GitliteException("Cannot start the remote daemon.");
+        }
+        child = fork();
+        if (child < 0) {
+            throw GitliteException("Cannot start the remote daemon.");
+        }
+        if (child == 0) {
+            dup2(to_server[0], STDIN_FILENO);
+            dup2(from_server[1], STDOUT_FILENO);
+            close(to_server[0]);
+            close(to_server[1]);
+            close(from_server[0]);
+            close(from_server[1]);
+            if (chdir(dir.c_str()) != 0) _exit(1);
+            //execlp: a bare name is searched on PATH, a path is used as is
+            execlp(exe.c_str(), "gitlite", "serve", static_cast<char*>(nullptr));
+            _exit(1);
+        }
+        close(to_server[0]);
+        close(from_server[1]);
+        in_fd = from_server[0];
+        out_fd = to_server[1];
+    }
+    stream = new FdStream(in_fd, out_fd);
+}
+
+DaemonClient::~DaemonClient() {
+    if (stream) {
+        try {
+            stream->write("quit\n");
+        } catch (...) {
+        }
+        delete stream;
+    }
+    if (in_fd >= 0) close(in_fd);
+    if (out_fd >= 0 && out_fd != in_fd) close(out_fd);
+    if (child > 0) {
+        int status;
+        waitpid(child, &status, 0);
+    }
+}
+
+std::map<std::string, ObjectId> DaemonClient::listRefs() {
+    stream->write("list-refs\n");
+    std::map<std::string, ObjectId> refs;
+    std::string line;
+    while (true) {
+        if (!stream->readLine(line)) {
+            throw GitliteException("Connection to the remote was lost.");
+        }
+        if (line == "end") break;
+        size_t space = line.find(' ');
+        ObjectId hash;
+        if (space == std::string::npos || !ObjectId::parseHex(line.data(), space, hash)) continue;
+        refs[line.substr(space + 1)] = hash;
+    }
+    return refs;
+}
+
+size_t DaemonClient::fetch(const ObjectId& want, const std::vector<ObjectId>& haves, ObjectDatabase& db) {
+    std::string request = "fetch " + want.hex() + "\n";
+    for (const ObjectId& have : haves) {
+        if (!have.isNull()) request += "have " + have.hex() + "\n";
+    }
+    request += "done\n";
+    stream->write(request);
+    return PackStream::read(*stream, db);
+}
+
+std::string DaemonClient::push(const std::string& ref, const ObjectId& old_hash, const ObjectId& new_hash,
+                               PackBuilder& objects) {
+    stream->write("push " + ref + " " + (old_hash.isNull() ? "-" : old_hash.hex()) + " " + new_hash.hex() + "\n");
+    PackStream::write(*stream, objects);
+
+    std::string reply;
+    if (!stream->readLine(reply)) {
+        throw GitliteException("Connection to the remote was lost.");
+    }
+    if (reply == "ok") return "";
+    if (reply.compare(0, 6, "error ") == 0) return reply.substr(6);
+    return reply;
+}
@@ -0,0 +1,380 @@
+#include "Diff.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    //Myers' linear space diff: marks the lines of A that are deleted and the
+    //lines of B that are inserted
+    class Myers {
+    private:
+        const std::vector<int>& a;
+        const std::vector<int>& b;
+        std::vector<bool>& del;
+        std::vector<bool>& ins;
+        //furthest reaching x per diagonal, forward and backward, offset by `mid`
+        std::vector<long> vf;
+        std::vector<long> vb;
+        long mid;
+
+        void markAll(long a0, long a1, long b0, long b1) {
+            for (long i = a0; i < a1; ++i) del[i] = true;
+            for (long j = b0; j < b1; ++j) ins[j] = true;
+        }
+
+        //a point on an optimal path through a[a0,a1) x b[b0,b1), both non empty
+        //and without common prefix or suffix
+        void middleSnake(long a0, long a1, long b0, long b1, long& xmid, long& ymid) {
+            long n = a1 - a0;
+            long m = b1 - b0;
+            long delta = n - m;
+            bool odd = (delta & 1) != 0;
+            long dmax = (n + m + 1) / 2;
+
+            vf[mid + 1] = 0;
+            vb[mid + 1] = 0;
+            for (long d = 0; d <= dmax; ++d) {
+                for (long k = -d; k <= d; k += 2) {
+                    long x = (k == -d || (k != d && vf[mid + k - 1] < vf[mid + k + 1]))
+                             ? vf[mid + k + 1] : vf[mid + k - 1] + 1;
+                    long y = x - k;
+                    while (x < n && y < m && a[a0 + x] == b[b0 + y]) {
+                        ++x;
+                        ++y;
+                    }
+                    vf[mid + k] = x;
+                    long rk = delta - k;
+                    if (odd && rk >= -(d - 1) && rk <= d - 1 && x + vb[mid + rk] >= n) {
+                        xmid = a0 + x;
+                        ymid = b0 + y;
+                        return;
+                    }
+                }
+                for (long k = -d; k <= d; k += 2) {
+                    long x = (k == -d || (k != d && vb[mid + k - 1] < vb[mid + k + 1]))
+                             ? vb[mid + k + 1] : vb[mid + k - 1] + 1;
+                    long y = x - k;
+                    while (x < n && y < m && a[a1 - 1 - x] == b[b1 - 1 - y]) {
+                        ++x;
+                        ++y;
+                    }
+                    vb[mid + k] = x;
+                    long fk = delta - k;
+                    if (!odd && fk >= -d && fk <= d && x + vf[mid + fk] >= n) {
+                        xmid = a1 - x;
+                        ymid = b1 - y;
+                        return;
+                    }
+                }
+            }
+            //not reached: d = dmax always overlaps
+            xmid = a0;
+            ymid = b0;
+        }
+
+    public:
+        Myers(const std::vector<int>& a_lines, const std::vector<int>& b_lines,
+              std::vector<bool>& deleted, std::vector<bool>& inserted)
+            : a(a_lines), b(b_lines), del(deleted), ins(inserted) {
+            long size = static_cast<long>(a.size() + b.size()) + 2;
+            vf.assign(2 * size + 1, 0);
+            vb.assign(2 * size + 1, 0);
+            mid = size;
+        }
+
+        void compare(long a0, long a1, long b0, long b1) {
+            while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) {
+                ++a0;
+                ++b0;
+            }
+            while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) {
+                --a1;
+                --b1;
+            }
+            if (a0 == a1 || b0 == b1) {
+                markAll(a0, a1, b0, b1);
+                return;
+            }
+            long xmid, ymid;
+            middleSnake(a0, a1, b0, b1, xmid, ymid);
+            if ((xmid == a0 && ymid == b0) || (xmid == a1 && ymid == b1)) {
+                //no progress (cannot happen after the trimming above); give up on this box
+                markAll(a0, a1, b0, b1);
+                return;
+            }
+            compare(a0, xmid, b0, ymid);
+            compare(xmid, a1, ymid, b1);
+        }
+    };
+
+    //one side's change, in base coordinates
+    struct Change {
+        size_t o_start;
+        size_t o_end;
+        size_t s_start;
+        size_t s_end;
+        int side;
+    };
+
+    void append(std::string& out, const std::vector<Diff::Line>& lines, size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) out.append(lines[i].data, lines[i].size);
+    }
+
+    void appendBlock(std::string& out, const std::vector<Diff::Line>& lines, size_t from, size_t to) {
+        append(out, lines, from, to);
+        if (to > from && !lines[to - 1].hasNewline()) out += '\n';
+    }
+
+    //"@@ -start,count" half of a hunk header; an empty range names the line before it
+    std::string range(size_t start, size_t count) {
+        std::string out = std::to_string(count == 0 ? start : start + 1);
+        if (count != 1) out += "," + std::to_string(count);
+        return out;
+    }
+
+    void appendPrefixed(std::string& out, char prefix, const Diff::Line& line) {
+        out += prefix;
+        out.append(line.data, line.size);
+        if (!line.hasNewline()) out += "\n\\ No newline at end of file\n";
+    }
+}
+
+namespace Diff {
+    //FNV-1a, 64 bit
+    size_t hashLine(const Line& line) {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < line.size; ++i) {
+            h ^= static_cast<unsigned char>(line.data[i]);
+            h *= 1099511628211ull;
+        }
+        //fold the high bits in, the table indexes by the low ones
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 32;
+        return static_cast<size_t>(h);
+    }
+
+    std::vector<Line> splitLines(const std::string& text) {
+        std::vector<Line> lines;
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (p < end) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            const char* next = nl ? nl + 1 : end;
+            lines.push_back({p, static_cast<size_t>(next - p)});
+            p = next;
+        }
+        return lines;
+    }
+
+    //at least twice CAPACITY slots, so the table stays at most half full
+    void LineTable::grow(size_t capacity) {
+        size_t n = std::max<size_t>(1024, slots.size());
+        while (n < capacity * 2) n <<= 1;
+        if (n == slots.size()) return;
+        std::vector<Slot> old(n, Slot{0, -1});
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.id < 0) continue;
+            size_t s = slot.hash & mask;
+            while (slots[s].id >= 0) s = (s + 1) & mask;
+            slots[s] = slot;
+        }
+    }
+
+    std::vector<int> LineTable::intern(const std::vector<Line>& text) {
+        //sized for the worst case (every line new) once, instead of rehashing as it fills
+        grow(lines.size() + text.size());
+        size_t mask = slots.size() - 1;
+        std::vector<int> out;
+        out.reserve(text.size());
+        for (const Line& line : text) {
+            uint32_t h = static_cast<uint32_t>(hashLine(line));
+            size_t s = h & mask;
+            while (true) {
+                Slot& slot = slots[s];
+                if (slot.id < 0) {
+                    slot.hash = h;
+                    slot.id = static_cast<int>(lines.size());
+                    lines.push_back(line);
+                    out.push_back(slot.id);
+                    break;
+                }
+                if (slot.hash == h) {
+                    const Line& other = lines[slot.id];
+                    if (other.size == line.size && std::memcmp(other.data, line.data, line.size) == 0) {
+                        out.push_back(slot.id);
+                        break;
+                    }
+                }
+                s = (s + 1) & mask;
+            }
+        }
+        return out;
+    }
+
+    std::vector<Hunk> diff(const std::vector<int>& a, const std::vector<int>& b) {
+        std::vector<bool> deleted(a.size(), false);
+        std::vector<bool> inserted(b.size(), false);
+
+        //a line missing from the other side is changed whatever the rest does;
+        //leaving those out keeps D (and so the Myers run) small for typical edits
+        int max_id = -1;
+        for (int id : a) max_id = std::max(max_id, id);
+        for (int id : b) max_id = std::max(max_id, id);
+        std::vector<unsigned char> in_a(max_id + 1, 0), in_b(max_id + 1, 0);
+        for (int id : a) in_a[id] = 1;
+        for (int id : b) in_b[id] = 1;
+
+        std::vector<int> ka, kb;
+        std::vector<size_t> ia, ib;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (in_b[a[i]]) {
+                ka.push_back(a[i]);
+                ia.push_back(i);
+            } else {
+                deleted[i] = true;
+            }
+        }
+        for (size_t j = 0; j < b.size(); ++j) {
+            if (in_a[b[j]]) {
+                kb.push_back(b[j]);
+                ib.push_back(j);
+            } else {
+                inserted[j] = true;
+            }
+        }
+
+        std::vector<bool> kdel(ka.size(), false);
+        std::vector<bool> kins(kb.size(), false);
+        Myers(ka, kb, kdel, kins).compare(0, static_cast<long>(ka.size()), 0, static_cast<long>(kb.size()));
+        for (size_t i = 0; i < ka.size(); ++i) {
+            if (kdel[i]) deleted[ia[i]] = true;
+        }
+        for (size_t j = 0; j < kb.size(); ++j) {
+            if (kins[j]) inserted[ib[j]] = true;
+        }
+
+        //unmarked lines pair up in order; every run of marks between them is a hunk
+        std::vector<Hunk> hunks;
+        size_t i = 0, j = 0;
+        while (i < a.size() || j < b.size()) {
+            if (i < a.size() && j < b.size() && !deleted[i] && !inserted[j]) {
+                ++i;
+                ++j;
+                continue;
+            }
+            Hunk h{i, 0, j, 0};
+            while (i < a.size() && deleted[i]) ++i;
+            while (j < b.size() && inserted[j]) ++j;
+            h.a_count = i - h.a_start;
+            h.b_count = j - h.b_start;
+            hunks.push_back(h);
+        }
+        return hunks;
+    }
+
+    std::string unified(const std::string& a_text, const std::string& b_text, size_t context) {
+        std::vector<Line> a = splitLines(a_text);
+        std::vector<Line> b = splitLines(b_text);
+        LineTable table;
+        std::vector<Hunk> hunks = diff(table.intern(a), table.intern(b));
+
+        std::string out;
+        size_t h = 0;
+        while (h < hunks.size()) {
+            //hunks whose context would meet print as one
+            size_t last = h;
+            while (last + 1 < hunks.size() &&
+                   hunks[last + 1].a_start - (hunks[last].a_start + hunks[last].a_count) <= 2 * context) {
+                ++last;
+            }
+            size_t a_from = hunks[h].a_start - std::min(context, hunks[h].a_start);
+            size_t b_from = hunks[h].b_start - (hunks[h].a_start - a_from);
+            size_t a_end = hunks[last].a_start + hunks[last].a_count;
+            size_t tail = std::min(context, a.size() - a_end);
+            size_t a_to = a_end + tail;
+            size_t b_to = hunks[last].b_start + hunks[last].b_count + tail;
+
+            out += "@@ -" + range(a_from, a_to - a_from) + " +" + range(b_from, b_to - b_from) + " @@\n";
+            size_t i = a_from;
+            for (size_t k = h; k <= last; ++k) {
+                for (; i < hunks[k].a_start; ++i) appendPrefixed(out, ' ', a[i]);
+                for (size_t n = 0; n < hunks[k].a_count; ++n) appendPrefixed(out, '-', a[i + n]);
+                for (size_t n = 0; n < hunks[k].b_count; ++n) appendPrefixed(out, '+', b[hunks[k].b_start + n]);
+                i += hunks[k].a_count;
+            }
+            for (; i < a_to; ++i) appendPrefixed(out, ' ', a[i]);
+            h = last + 1;
+        }
+        return out;
+    }
+
+    MergeResult merge3(const std::string& base, const std::string& ours, const std::string& theirs) {
+        std::vector<Line> lines[3] = {splitLines(base), splitLines(ours), splitLines(theirs)};
+        LineTable table;
+        std::vector<int> ids[3] = {table.intern(lines[0]), table.intern(lines[1]), table.intern(lines[2])};
+
+        std::vector<Change> changes;
+        for (int side = 1; side <= 2; ++side) {
+            for (const Hunk& h : diff(ids[0], ids[side])) {
+                changes.push_back({h.a_start, h.a_start + h.a_count, h.b_start, h.b_start + h.b_count, side});
+            }
+        }
+        std::stable_sort(changes.begin(), changes.end(),
+                         [](const Change& x, const Change& y) { return x.o_start < y.o_start; });
+
+        MergeResult result;
+        size_t copied = 0;
+        size_t c = 0;
+        while (c < changes.size()) {
+            //a group: changes that overlap or touch in the base
+            size_t first = c;
+            size_t o_start = changes[c].o_start;
+            size_t o_end = changes[c].o_end;
+            for (++c; c < changes.size() && changes[c].o_start <= o_end; ++c) {
+                o_end = std::max(o_end, changes[c].o_end);
+            }
+            append(result.text, lines[0], copied, o_start);
+            copied = o_end;
+
+            //each side's text for base[o_start, o_end): its own changes plus
+            //the unchanged base around them
+            size_t from[3] = {o_start, o_start, o_start};
+            size_t to[3] = {o_end, o_end, o_end};
+            bool touched[3] = {true, false, false};
+            for (size_t k = first; k < c; ++k) {
+                const Change& ch = changes[k];
+                if (!touched[ch.side]) {
+                    from[ch.side] = ch.s_start - (ch.o_start - o_start);
+                    touched[ch.side] = true;
+                }
+                to[ch.side] = ch.s_end + (o_end - ch.o_end);
+            }
+
+            int pick = 0;
+            if (!touched[2]) {
+                pick = 1;
+            } else if (!touched[1]) {
+                pick = 2;
+            } else if (to[1] - from[1] == to[2] - from[2] &&
+                       std::equal(ids[1].begin() + from[1], ids[1].begin() + to[1], ids[2].begin() + from[2])) {
+                pick = 1;
+            }
+            if (pick) {
+                append(result.text, lines[pick], from[pick], to[pick]);
+                continue;
+            }
+            result.conflicts++;
+            result.text += "<<<<<<< HEAD\n";
+            appendBlock(result.text, lines[1], from[1], to[1]);
+            result.text += "=======\n";
+            appendBlock(result.text, lines[2], from[2], to[2]);
+            result.text += ">>>>>>>\n";
+        }
+        append(result.text, lines[0], copied, lines[0].size());
+        return result;
+    }
+}
@@ -0,0 +1,193 @@
+#include "Manifest.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    //FNV-1a, 64 bit
+    uint64_t hashPath(const char* data, size_t size) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < size; ++i) {
+            h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    int compareBytes(const char* a, size_t a_size, const char* b, size_t b_size) {
+        int r = std::memcmp(a, b, std::min(a_size, b_size));
+        if (r != 0) return r;
+        return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+    }
+}
+
+size_t Path::size() const {
+    uint32_t n;
+    std::memcpy(&n, bytes - sizeof(n), sizeof(n));
+    return n;
+}
+
+int Path::compare(const char* other, size_t len) const {
+    return compareBytes(bytes, size(), other, len);
+}
+
+int Path::compare(const Path& other) const {
+    if (bytes == other.bytes) return 0;
+    return compareBytes(bytes, size(), other.bytes, other.size());
+}
+
+PathPool& PathPool::shared() {
+    static PathPool pool;
+    return pool;
+}
+
+const char* PathPool::store(const char* data, size_t size) {
+    size_t need = sizeof(uint32_t) + size + 1;
+    char* at;
+    if (need > BLOCK_SIZE) {
+        //a path that does not fit a block gets one of its own
+        blocks.emplace_back(new char[need]);
+        at = blocks.back().get();
+    } else {
+        if (blockUsed + need > BLOCK_SIZE) {
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            block = blocks.back().get();
+            blockUsed = 0;
+        }
+        at = block + blockUsed;
+        blockUsed += need;
+    }
+    arenaBytes += need;
+    uint32_t n = static_cast<uint32_t>(size);
+    std::memcpy(at, &n, sizeof(n));
+    std::memcpy(at + sizeof(n), data, size);
+    at[sizeof(n) + size] = '\0';
+    return at + sizeof(n);
+}
+
+void PathPool::grow() {
+    std::vector<const char*> old;
+    old.swap(slots);
+    slots.assign(old.empty() ? 1024 : old.size() * 2, nullptr);
+    size_t mask = slots.size() - 1;
+    for (const char* p : old) {
+        if (!p) continue;
+        Path path(p);
+        size_t i = hashPath(p, path.size()) & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = p;
+    }
+}
+
+Path PathPool::intern(const char* data, size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    //at most half full
+    if ((count + 1) * 2 > slots.size()) grow();
+    size_t mask = slots.size() - 1;
+    size_t i = hashPath(data, size) & mask;
+    while (slots[i]) {
+        Path path(slots[i]);
+        if (path.size() == size && std::memcmp(slots[i], data, size) == 0) return path;
+        i = (i + 1) & mask;
+    }
+    slots[i] = store(data, size);
+    count++;
+    return Path(slots[i]);
+}
+
+size_t PathPool::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+}
+
+size_t PathPool::bytes() {
+    std::lock_guard<std::mutex> guard(lock);
+    return arenaBytes;
+}
+
+size_t Manifest::lowerBound(const std::string& path) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), path, [](const Entry& e, const std::string& p) {
+        return e.path.compare(p.data(), p.size()) < 0;
+    });
+    return it - entries.begin();
+}
+
+bool Manifest::isAt(size_t i, const std::string& path) const {
+    return i < entries.size() && entries[i].path.compare(path.data(), path.size()) == 0;
+}
+
+const Manifest::Entry* Manifest::find(const std::string& path) const {
+    size_t i = lowerBound(path);
+    return isAt(i, path) ? &entries[i] : nullptr;
+}
+
+ObjectId Manifest::blobOf(const std::string& path) const {
+    const Entry* e = find(path);
+    return e ? e->blob : ObjectId();
+}
+
+void Manifest::set(const std::string& path, const ObjectId& blob) {
+    size_t i = lowerBound(path);
+    if (isAt(i, path)) {
+        entries[i].blob = blob;
+    } else {
+        entries.insert(entries.begin() + i, {PathPool::shared().intern(path), blob});
+    }
+}
+
+bool Manifest::erase(const std::string& path) {
+    size_t i = lowerBound(path);
+    if (!isAt(i, path)) return false;
+    entries.erase(entries.begin() + i);
+    return true;
+}
+
+void Manifest::update(const std::map<std::string, ObjectId>& changes) {
+    if (changes.empty()) return;
+    //both sides sorted: merge into a new array
+    std::vector<Entry> merged;
+    merged.reserve(entries.size() + changes.size());
+    auto e = entries.begin();
+    for (const auto& change : changes) {
+        const std::string& path = change.first;
+        while (e != entries.end() && e->path.compare(path.data(), path.size()) < 0) merged.push_back(*e++);
+        bool present = e != entries.end() && e->path.compare(path.data(), path.size()) == 0;
+        if (!change.second.isNull()) {
+            merged.push_back({present ? e->path : PathPool::shared().intern(path), change.second});
+        }
+        if (present) ++e;
+    }
+    merged.insert(merged.end(), e, entries.end());
+    entries.swap(merged);
+}
+
+void Manifest::normalize() {
+    auto notAscending = [](const Entry& a, const Entry& b) { return !(a.path < b.path); };
+    if (std::adjacent_find(entries.begin(), entries.end(), notAscending) == entries.end()) return;
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.path < b.path;
+    });
+    //the last of equal paths wins
+    std::vector<Entry> unique;
+    unique.reserve(entries.size());
+    for (const Entry& e : entries) {
+        if (!unique.empty() && unique.back().path == e.path) {
+            unique.back() = e;
+        } else {
+            unique.push_back(e);
+        }
+    }
+    entries.swap(unique);
+}
+
+std::map<std::string, ObjectId> Manifest::toMap() const {
+    std::map<std::string, ObjectId> blobs;
+    for (const Entry& e : entries) blobs.emplace_hint(blobs.end(), e.path.str(), e.blob);
+    return blobs;
+}
+
+Manifest Manifest::fromMap(const std::map<std::string, ObjectId>& blobs) {
+    Manifest m;
+    m.reserve(blobs.size());
+    for (const auto& pair : blobs) m.append(PathPool::shared().intern(pair.first), pair.second);
+    return m;
+}
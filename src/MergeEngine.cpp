@@ -0,0 +1,333 @@
+#include "MergeEngine.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <sstream>
+
+#include "Diff.hpp"
+#include "GitliteException.h"
+#include "Rename.hpp"
+#include "Trace.hpp"
+#include "Utils.h"
+#include "WorkerPool.hpp"
+
+namespace {
+    // SIDE 相对 SPLIT 删除 / 新增的路径 (path -> blob)
+    void sideChanges(const Manifest& split,
+                     const Manifest& side,
+                     std::map<std::string, ObjectId>& deleted,
+                     std::map<std::string, ObjectId>& added) {
+        // 两个有序清单一起扫一遍
+        auto s = split.begin();
+        auto d = side.begin();
+        while (s != split.end() || d != side.end()) {
+            if (d == side.end() || (s != split.end() && s->path < d->path)) {
+                deleted.emplace_hint(deleted.end(), s->path.str(), s->blob);
+                ++s;
+            } else if (s == split.end() || d->path < s->path) {
+                added.emplace_hint(added.end(), d->path.str(), d->blob);
+                ++d;
+            } else {
+                ++s;
+                ++d;
+            }
+        }
+    }
+
+    void movePath(Manifest& blobs, const std::string& from, const std::string& to) {
+        blobs.set(to, blobs.blobOf(from));
+        blobs.erase(from);
+    }
+
+    // 一侧把 A 重命名为 B 时，把 split 和另一侧的 A 也挪到 B，三向合并就在 B 上进行，
+    // 而不是 "一边修改一边删除" 的冲突 (current 的文件被挪动时，结果相对 ours 就是
+    // 删除 A、新增 B)。另一侧删除了 A、已有 B、或把 A 改名成别的路径时保持原样
+    void alignRenames(ObjectDatabase& db,
+                      Manifest& splitBlobs,
+                      Manifest& currentBlobs,
+                      Manifest& givenBlobs) {
+        std::map<std::string, ObjectId> deleted, added;
+        sideChanges(splitBlobs, currentBlobs, deleted, added);
+        std::vector<Rename::Match> currentRenames = Rename::detect(db, deleted, added);
+        deleted.clear();
+        added.clear();
+        sideChanges(splitBlobs, givenBlobs, deleted, added);
+        std::vector<Rename::Match> givenRenames = Rename::detect(db, deleted, added);
+
+        std::map<std::string, std::string> givenTo;
+        for (const Rename::Match& m : givenRenames) givenTo[m.from] = m.to;
+
+        std::set<std::string> renamedInCurrent;
+        for (const Rename::Match& m : currentRenames) {
+            renamedInCurrent.insert(m.from);
+            if (givenTo.count(m.from)) {
+                // 两边改成同一个名字：以 A 为共同祖先合并 B
+                if (givenTo.at(m.from) == m.to) movePath(splitBlobs, m.from, m.to);
+                continue;
+            }
+            if (!givenBlobs.contains(m.from) || givenBlobs.contains(m.to)) continue;
+            movePath(splitBlobs, m.from, m.to);
+            movePath(givenBlobs, m.from, m.to);
+        }
+        for (const Rename::Match& m : givenRenames) {
+            if (renamedInCurrent.count(m.from)) continue;
+            if (!currentBlobs.contains(m.from) || currentBlobs.contains(m.to)) continue;
+            movePath(splitBlobs, m.from, m.to);
+            movePath(currentBlobs, m.from, m.to);
+        }
+    }
+
+    // 三向合并中一个路径要做的事 (blob id 为 null 表示该版本不存在)
+    struct MergeStep {
+        enum Kind {
+            DELETE,         // 只有 given 删除 -> 删除
+            TAKE_GIVEN,     // 只有 given 修改 / 新增 -> 取 given
+            CONTENT_MERGE,  // 两边都修改 / 新增且不同 -> 按行合并
+            MODIFY_DELETE   // 一边修改一边删除 -> 整个文件作为冲突
+        } kind;
+        std::string path;
+        ObjectId split;
+        ObjectId current;
+        ObjectId given;
+        // CONTENT_MERGE / MODIFY_DELETE 的结果
+        std::string content;
+        bool conflict = false;
+    };
+
+    // 三个有序清单一起扫描一遍 (sorted merge-join)，没有变化的路径不产生步骤
+    std::vector<MergeStep> planMerge(const Manifest& splitBlobs,
+                                     const Manifest& currentBlobs,
+                                     const Manifest& givenBlobs) {
+        std::vector<MergeStep> steps;
+        auto s = splitBlobs.begin();
+        auto c = currentBlobs.begin();
+        auto g = givenBlobs.begin();
+        static const ObjectId NONE;
+        while (s != splitBlobs.end() || c != currentBlobs.end() || g != givenBlobs.end()) {
+            // 三者中最小的路径
+            // (路径已驻留，相同路径即相同指针)
+            const Path* path = nullptr;
+            if (s != splitBlobs.end()) path = &s->path;
+            if (c != currentBlobs.end() && (!path || c->path < *path)) path = &c->path;
+            if (g != givenBlobs.end() && (!path || g->path < *path)) path = &g->path;
+
+            const ObjectId& h_split = (s != splitBlobs.end() && s->path == *path) ? s->blob : NONE;
+            const ObjectId& h_current = (c != currentBlobs.end() && c->path == *path) ? c->blob : NONE;
+            const ObjectId& h_given = (g != givenBlobs.end() && g->path == *path) ? g->blob : NONE;
+
+            bool exists_split = !h_split.isNull();
+            bool exists_current = !h_current.isNull();
+            bool exists_given = !h_given.isNull();
+            bool mod_current = exists_current && (h_current != h_split);
+            bool mod_given = exists_given && (h_given != h_split);
+            bool del_current = exists_split && !exists_current;
+            bool del_given = exists_split && !exists_given;
+
+            MergeStep step;
+            bool act = true;
+            if ((mod_current && mod_given && h_current != h_given) ||
+                (mod_current && del_given) || (del_current && mod_given)) {
+                // Case 8: 冲突候选 (均新增但内容不同也在第一项里)
+                step.kind = exists_current && exists_given ? MergeStep::CONTENT_MERGE : MergeStep::MODIFY_DELETE;
+            } else if (exists_split && h_current == h_split && del_given) {
+                // Case 6
+                step.kind = MergeStep::DELETE;
+            } else if (mod_given && !mod_current && !del_current) {
+                // Case 1 / 5
+                step.kind = MergeStep::TAKE_GIVEN;
+            } else {
+                // Case 2 / 3 / 4 (current 已是结果) 及未变化的路径
+                act = false;
+            }
+            if (act) {
+                step.path = path->str();
+                step.split = h_split;
+                step.current = h_current;
+                step.given = h_given;
+                steps.push_back(std::move(step));
+            }
+
+            Path key = *path;
+            if (s != splitBlobs.end() && s->path == key) ++s;
+            if (c != currentBlobs.end() && c->path == key) ++c;
+            if (g != givenBlobs.end() && g->path == key) ++g;
+        }
+        return steps;
+    }
+
+    // blob 内容，空 id (该侧不存在) 为 ""；缺失或损坏的对象直接抛出，不能当成空文件
+    std::string blobContent(ObjectDatabase& db, const ObjectId& oid) {
+        if (oid.isNull()) return "";
+        auto blob = std::dynamic_pointer_cast<Blob>(db.readObject(oid));
+        if (!blob) {
+            throw GitliteException("Corrupted object: object at " + oid.abbrev() + " is not a Blob.");
+        }
+        return blob->getContent();
+    }
+
+    // CONTENT_MERGE / MODIFY_DELETE 步骤的结果内容，只读 blob，可在工作线程中运行
+    void mergeContent(ObjectDatabase& db, MergeStep& step) {
+        std::string content_current = blobContent(db, step.current);
+        std::string content_given = blobContent(db, step.given);
+        if (step.kind == MergeStep::CONTENT_MERGE) {
+            // 按行三向合并，只有两边改动重叠的区域才是冲突
+            Diff::MergeResult merged = Diff::merge3(blobContent(db, step.split), content_current, content_given);
+            step.content = std::move(merged.text);
+            step.conflict = merged.conflicts > 0;
+            return;
+        }
+        // 修改/删除冲突，整个文件作为冲突块
+        std::stringstream conflict_ss;
+        conflict_ss << "<<<<<<< HEAD\n";
+        conflict_ss << content_current;
+        if (!content_current.empty() && content_current.back() != '\n') conflict_ss << "\n";
+        conflict_ss << "=======\n";
+        conflict_ss << content_given;
+        if (!content_given.empty() && content_given.back() != '\n') conflict_ss << "\n";
+        conflict_ss << ">>>>>>>\n";
+        step.content = conflict_ss.str();
+        step.conflict = true;
+    }
+
+    void runAll(size_t count, const std::function<void(size_t)>& task) {
+        if (count == 0) return;
+        WorkerPool pool(static_cast<unsigned>(std::min<size_t>(count, WorkerPool::defaultThreads())));
+        for (size_t i = 0; i < count; ++i) {
+            pool.submit([&task, i] { task(i); });
+        }
+        pool.wait();
+    }
+}
+
+namespace Merge {
+    Result merge(ObjectDatabase& db,
+                 const Manifest& base,
+                 const Manifest& ours,
+                 const Manifest& theirs,
+                 bool detectRenames) {
+        Trace::Phase phase("merge.three-way");
+        Manifest splitBlobs = base;
+        Manifest currentBlobs = ours;
+        Manifest givenBlobs = theirs;
+        if (detectRenames) {
+            alignRenames(db, splitBlobs, currentBlobs, givenBlobs);
+        }
+
+        // 三个清单都按路径有序：一次线性扫描得到每个路径要做的事
+        std::vector<MergeStep> steps = planMerge(splitBlobs, currentBlobs, givenBlobs);
+
+        // 需要读内容的步骤互不相关，并发执行
+        std::vector<MergeStep*> contentSteps;
+        for (MergeStep& step : steps) {
+            if (step.kind == MergeStep::CONTENT_MERGE || step.kind == MergeStep::MODIFY_DELETE) {
+                contentSteps.push_back(&step);
+            }
+        }
+        runAll(contentSteps.size(), [&db, &contentSteps](size_t i) { mergeContent(db, *contentSteps[i]); });
+
+        Result result;
+        std::map<std::string, ObjectId> stepBlobs;
+        std::map<std::string, MergeStep*> created;
+        for (MergeStep& step : steps) {
+            switch (step.kind) {
+                case MergeStep::DELETE:
+                    stepBlobs[step.path] = ObjectId();
+                    break;
+                case MergeStep::TAKE_GIVEN:
+                    stepBlobs[step.path] = step.given;
+                    break;
+                case MergeStep::CONTENT_MERGE:
+                case MergeStep::MODIFY_DELETE: {
+                    Blob blob(step.content);
+                    stepBlobs[step.path] = ObjectId::hashOf(blob.serialize());
+                    created[step.path] = &step;
+                    if (step.conflict) result.conflicts.push_back(step.path);
+                    break;
+                }
+            }
+        }
+        result.manifest = std::move(currentBlobs);
+        result.manifest.update(stepBlobs);
+
+        // 相对 ours 的变化，合并产生的 blob 附上内容
+        result.changes = changesBetween(ours, result.manifest);
+        for (Change& change : result.changes) {
+            auto it = created.find(change.path);
+            if (it != created.end()) {
+                change.created = true;
+                change.content = std::move(it->second->content);
+                change.conflict = it->second->conflict;
+            }
+        }
+        return result;
+    }
+
+    std::vector<Change> changesBetween(const Manifest& from, const Manifest& to) {
+        // 两个有序清单一起扫一遍，相同的路径只比较 blob id
+        std::vector<Change> changes;
+        auto f = from.begin();
+        auto t = to.begin();
+        while (f != from.end() || t != to.end()) {
+            Change change;
+            if (t == to.end() || (f != from.end() && f->path < t->path)) {
+                change.path = (f++)->path.str();
+            } else if (f == from.end() || t->path < f->path) {
+                change.path = t->path.str();
+                change.blob = (t++)->blob;
+            } else {
+                bool same = f->blob == t->blob;
+                if (!same) {
+                    change.path = t->path.str();
+                    change.blob = t->blob;
+                }
+                ++f;
+                ++t;
+                if (same) continue;
+            }
+            changes.push_back(std::move(change));
+        }
+        return changes;
+    }
+
+    void writeObjects(ObjectDatabase& db, const Result& result) {
+        for (const Change& change : result.changes) {
+            if (!change.created) continue;
+            Blob blob(change.content);
+            db.writeObject(blob);
+        }
+    }
+
+    void writeWorktree(ObjectDatabase& db, const std::vector<Change>& changes) {
+        runAll(changes.size(), [&db, &changes](size_t i) {
+            const Change& change = changes[i];
+            if (change.blob.isNull()) {
+                Utils::restrictedDelete(change.path);
+            } else if (change.created) {
+                Blob blob(change.content);
+                db.writeObject(blob);
+                Utils::writeContents(change.path, change.content);
+            } else {
+                Utils::writeContents(change.path, blobContent(db, change.blob));
+            }
+        });
+    }
+
+    void apply(ObjectDatabase& db, const Result& result, index& idx) {
+        Trace::Phase phase("merge.apply");
+        const std::vector<Change>& changes = result.changes;
+        writeWorktree(db, changes);
+        stage(changes, idx);
+    }
+
+    void stage(const std::vector<Change>& changes, index& idx) {
+        for (const Change& change : changes) {
+            if (change.blob.isNull()) {
+                idx.rm_entry(change.path);
+                idx.add_rm_entry(change.path);
+            } else {
+                idx.add_entry(change.path, change.blob);
+            }
+        }
+    }
+}
@@ -2,71 +2,147 @@
 
 #include "ObjectDataBase.hpp"
 #include "GitliteException.h"
+#include "Pack.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
+#include <sys/stat.h>
 #include <iomanip>
 #include <iostream>
 
 
-std::string ObjectDatabase::getObjectPath(const std::string& oid) const {
-    if (oid.length() != 40) {
-        throw GitliteException("OID must be 40 characters.");
-    }
+std::string ObjectDatabase::getObjectPath(const ObjectId& oid) const {
     //  .gitlite/objects/da/39a3...
-    std::string subdir = oid.substr(0, 2);
-    std::string filename = oid.substr(2);
+    std::string hex = oid.hex();
+    std::string subdir = hex.substr(0, 2);
+    std::string filename = hex.substr(2);
 
     return Utils::join(BASE_DIR, subdir, filename);
 }
 
+ObjectDatabase::ObjectDatabase(const std::string& gitlite_dir)
+    : BASE_DIR(Utils::join(gitlite_dir, "objects")) {
+}
+
 void ObjectDatabase::initDatabase() {
     // create .gitlite/objects
     Utils::createDirectories(BASE_DIR);
 }
 
 
-std::string ObjectDatabase::writeObject(GitLiteObject& obj) {
+ObjectId ObjectDatabase::writeObject(GitLiteObject& obj) {
+    Trace::Phase phase("odb.write");
     // se (Type + Size + \0 + Content)
     std::string serialized_data = obj.serialize();
 
     // cal oid
-    std::string oid = Utils::sha1(serialized_data);
+    ObjectId oid = ObjectId::hashOf(serialized_data);
     obj.set_hash(oid);
 
 
     std::string path = getObjectPath(oid);
 
-    if (Utils::exists(path)) {
+    if (hasObject(oid)) {
         return oid;
     }
 
     // write
+    Trace::count(Trace::OBJECTS_WRITTEN);
+    Trace::count(Trace::OBJECT_BYTES_WRITTEN, serialized_data.size());
     try {
         Utils::writeContents(path, serialized_data);
-    } catch (const std::invalid_argument& e) {
-        throw std::runtime_error("Error writing object to disk: " + std::string(e.what()));
+    } catch (const GitliteException& e) {
+        throw GitliteException("Error writing object to disk: " + std::string(e.what()));
     }
 
     return oid;
 }
 
 
-std::shared_ptr<GitLiteObject> ObjectDatabase::readObject(const std::string& oid) {
-    std::string path = getObjectPath(oid);
-    if (!Utils::exists(path)) {
-        throw std::runtime_error("Object not found in database: " + oid);
+std::shared_ptr<GitLiteObject> ObjectDatabase::readObject(const ObjectId& oid) const {
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(oid);
+        if (it != cache.end()) {
+            Trace::count(Trace::OBJECT_CACHE_HITS);
+            return it->second;
+        }
     }
 
-    // read raw data -> copy from localdatabase
-    std::string raw_data;
-    try {
-        raw_data = Utils::readContentsAsString(path);
-    } catch (const std::invalid_argument& e) {
-        throw std::runtime_error("Error reading object file: " + std::string(e.what()));
+    // read raw data (loose file or pack)
+    Trace::Phase phase("odb.read");
+    std::string raw_data = readRawObject(oid);
+    std::shared_ptr<GitLiteObject> obj = parseObject(oid, raw_data);
+    Trace::count(Trace::OBJECTS_READ);
+    Trace::count(Trace::OBJECT_BYTES_READ, raw_data.size());
+
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    reserveCache(raw_data.size());
+    if (cache.emplace(oid, obj).second) {
+        cache_bytes += raw_data.size();
+    }
+    return obj;
+}
+
+void ObjectDatabase::reserveCache(size_t bytes) const {
+    if (cache_bytes + bytes > CACHE_LIMIT) {
+        cache.clear();
+        header_cache.clear();
+        cache_bytes = 0;
+    }
+}
+
+std::shared_ptr<const CommitHeader> ObjectDatabase::readCommitHeader(const ObjectId& oid) const {
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = header_cache.find(oid);
+        if (it != header_cache.end()) {
+            Trace::count(Trace::OBJECT_CACHE_HITS);
+            return it->second;
+        }
+        auto full = cache.find(oid);
+        if (full != cache.end()) {
+            Trace::count(Trace::OBJECT_CACHE_HITS);
+            auto commit = std::dynamic_pointer_cast<Commit>(full->second);
+            return commit ? std::make_shared<const CommitHeader>(commit->header()) : nullptr;
+        }
+    }
+
+    Trace::Phase phase("odb.read");
+    std::string raw_data = readRawObject(oid);
+    Trace::count(Trace::OBJECTS_READ);
+    Trace::count(Trace::OBJECT_BYTES_READ, raw_data.size());
+    size_t null_byte_pos = raw_data.find('\0');
+    if (null_byte_pos == std::string::npos) {
+        throw GitliteException("Corrupted object format.");
+    }
+    if (raw_data.compare(0, 7, "commit ") != 0) {
+        return nullptr;
+    }
+    if (std::strtoull(raw_data.c_str() + 7, nullptr, 10) != raw_data.size() - null_byte_pos - 2) {
+        throw GitliteException("Corrupted object: size mismatch.");
+    }
+    auto header = std::make_shared<CommitHeader>(Commit::parseHeader(raw_data, null_byte_pos + 2));
+    header->oid = oid;
+
+    //what the header holds, not the object size: a manifest does not take cache room here
+    size_t bytes = sizeof(CommitHeader) + header->parents.size() * sizeof(ObjectId) +
+                   header->message.size() + header->timestamp.size();
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    reserveCache(bytes);
+    if (header_cache.emplace(oid, header).second) {
+        cache_bytes += bytes;
     }
+    return header;
+}
 
+std::shared_ptr<GitLiteObject> ObjectDatabase::parseObject(const ObjectId& oid, const std::string& raw_data) const {
     size_t null_byte_pos = raw_data.find('\0');
     if (null_byte_pos == std::string::npos) {
-        throw std::runtime_error("Corrupted object format.");
+        throw GitliteException("Corrupted object format.");
     }
 
     std::string header = raw_data.substr(0, null_byte_pos);
@@ -77,10 +153,8 @@ std::shared_ptr<GitLiteObject> ObjectDatabase::readObject(const std::string& oid
     size_t size_check;
     header_stream >> type_str >> size_check;
 
-    // std::cerr<<size_check<<std::endl;    //debug
-    // std::cerr<<content.size()<<std::endl;    //debug
     if (size_check != content.size()) {
-        throw std::runtime_error("Corrupted object: size mismatch.");
+        throw GitliteException("Corrupted object: size mismatch.");
     }
 
     if (type_str == "blob") {
@@ -98,48 +172,111 @@ std::shared_ptr<GitLiteObject> ObjectDatabase::readObject(const std::string& oid
         return commit;
 
     } else {
-        throw std::runtime_error("Unsupported object type: " + type_str);
+        throw GitliteException("Unsupported object type: " + type_str);
     }
 }
 
 
-std::string ObjectDatabase::findObjectByPrefix(const std::string& prefix) {
-    if (prefix.length() == 40) {
-        if (Utils::exists(getObjectPath(prefix))) {
-            return prefix;
+std::shared_ptr<const std::vector<ObjectId>> ObjectDatabase::looseIdsIn(const std::string& fanout) const {
+    static const std::shared_ptr<const std::vector<ObjectId>> none = std::make_shared<const std::vector<ObjectId>>();
+    std::string dir = Utils::join(BASE_DIR, fanout);
+    Trace::count(Trace::STAT_CALLS);
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return none;
+    }
+    {
+        std::lock_guard<std::mutex> lock(fanout_mtx);
+        auto it = fanout_cache.find(fanout);
+        if (it != fanout_cache.end() && it->second.ino == static_cast<uint64_t>(st.st_ino) &&
+            it->second.mtime_sec == st.st_mtim.tv_sec && it->second.mtime_nsec == st.st_mtim.tv_nsec) {
+            return it->second.ids;
         }
-        return "";
     }
 
-    //cant too short
-    if (prefix.length() < 2) {
-        return "";
+    //stat before listing: an object added meanwhile moves the mtime past what we record
+    auto ids = std::make_shared<std::vector<ObjectId>>();
+    for (const std::string& name : Utils::plainFilenamesIn(dir)) {
+        // skip temp files of a write in progress
+        std::string hex = fanout + name;
+        ObjectId oid;
+        if (ObjectId::parseHex(hex.data(), hex.size(), oid)) ids->push_back(oid);
     }
+    std::sort(ids->begin(), ids->end());
+
+    FanoutListing listing;
+    listing.ino = st.st_ino;
+    listing.mtime_sec = st.st_mtim.tv_sec;
+    listing.mtime_nsec = st.st_mtim.tv_nsec;
+    listing.ids = ids;
+    std::lock_guard<std::mutex> lock(fanout_mtx);
+    fanout_cache[fanout] = listing;
+    return listing.ids;
+}
 
-    std::string dirPrefix = prefix.substr(0, 2);
-    std::string filePrefix = prefix.substr(2);
+std::vector<ObjectId> ObjectDatabase::findObjectsByPrefix(const std::string& prefix) const {
+    std::vector<ObjectId> found;
+    if (prefix.length() < 2 || prefix.length() > 40 ||
+        prefix.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return found;
+    }
+    //smallest id with that prefix
+    ObjectId first = ObjectId::fromHex(prefix + std::string(ObjectId::HEX_SIZE - prefix.size(), '0'));
+    if (prefix.length() == 40) {
+        if (hasObject(first)) found.push_back(first);
+        return found;
+    }
 
-    std::string objectDir = Utils::join(".gitlite/objects", dirPrefix);
+    //loose: the fan-out directory's sorted ids
+    std::shared_ptr<const std::vector<ObjectId>> loose = looseIdsIn(prefix.substr(0, 2));
+    for (auto it = std::lower_bound(loose->begin(), loose->end(), first);
+         it != loose->end() && it->hasPrefix(prefix); ++it) {
+        found.push_back(*it);
+    }
 
-    if (!Utils::isDirectory(objectDir)) {
-        return "";
+    //packed: each .idx is sorted by oid
+    for (const auto& pack : getPacks()) {
+        const auto& entries = pack->getEntries();
+        for (auto it = std::lower_bound(entries.begin(), entries.end(), first,
+                                        [](const PackFile::Entry& e, const ObjectId& key) { return e.oid < key; });
+             it != entries.end() && it->oid.hasPrefix(prefix); ++it) {
+            found.push_back(it->oid);
+        }
     }
 
-    std::vector<std::string> files = Utils::plainFilenamesIn(objectDir);
-    if (prefix.length() == 2) {
-        return dirPrefix + files[0];
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+std::string ObjectDatabase::objectType(const ObjectId& oid) const {
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(oid);
+        if (it != cache.end()) {
+            return std::dynamic_pointer_cast<Commit>(it->second) ? "commit" : "blob";
+        }
     }
-    for (const std::string& file : files) {
-        if (file.rfind(filePrefix, 0) == 0) {
-            return dirPrefix + file;
+    std::string header;
+    std::ifstream file(getObjectPath(oid), std::ios::binary);
+    if (file.is_open()) {
+        char buf[32];
+        file.read(buf, sizeof(buf));
+        header.assign(buf, static_cast<size_t>(file.gcount()));
+    } else {
+        for (const auto& pack : getPacks()) {
+            if (pack->contains(oid)) {
+                header = pack->readHeader(oid);
+                break;
+            }
         }
     }
-
-    return "";
+    size_t space = header.find(' ');
+    return space == std::string::npos ? "" : header.substr(0, space);
 }
 
-std::string ObjectDatabase::readBlobContent(const std::string& blobHash) {
-    if (blobHash.empty()) {
+std::string ObjectDatabase::readBlobContent(const ObjectId& blobHash) {
+    if (blobHash.isNull()) {
         return "";
     }
     std::shared_ptr<GitLiteObject> obj = nullptr;
@@ -156,121 +293,162 @@ std::string ObjectDatabase::readBlobContent(const std::string& blobHash) {
     return blob->getContent();
 }
 
-bool ObjectDatabase::hasObject(const std::string& oid) const {
-    return Utils::exists(getObjectPath(oid));
+bool ObjectDatabase::hasObject(const ObjectId& oid) const {
+    //an empty file is what a crash can leave behind an unsynced rename (GITLITE_FSYNC=batched/none):
+    //treat it as missing so the object gets written again
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        if (cache.count(oid)) return true;
+    }
+    struct stat st;
+    Trace::count(Trace::STAT_CALLS);
+    if (stat(getObjectPath(oid).c_str(), &st) == 0 && st.st_size > 0) {
+        return true;
+    }
+    for (const auto& pack : getPacks()) {
+        if (pack->contains(oid)) return true;
+    }
+    return false;
 }
 
-
-void ObjectDatabase::copyToRemote(const std::string& oid, const std::string& remote_gitlite_path) const {
-    // build local dir
-    std::string local_obj_path = getObjectPath(oid); // getObjectPath() 适用于当前的 ObjectDatabase
-
-
-    // build remote path
-    std::string remote_subdir = oid.substr(0, 2);
-    std::string remote_filename = oid.substr(2);
-    std::string remote_obj_path = Utils::join(remote_gitlite_path, "objects");
-    remote_obj_path = Utils::join(remote_obj_path,remote_subdir);
-    remote_obj_path = Utils::join(remote_obj_path,remote_filename);
-
-    if (Utils::exists(remote_obj_path)) {
-        return;
+std::string ObjectDatabase::readRawObject(const ObjectId& oid) const {
+    std::string path = getObjectPath(oid);
+    if (Utils::exists(path)) {
+        return Utils::readContentsAsString(path);
     }
-
-    // read local content
-    std::string content = Utils::readContentsAsString(local_obj_path);
-
-    // write to remote
-    std::string remote_dir = Utils::join(remote_gitlite_path, "objects", remote_subdir);
-    Utils::createDirectories(remote_dir);
-
-    Utils::writeContents(remote_obj_path, content);
+    for (const auto& pack : getPacks()) {
+        if (pack->contains(oid)) return pack->readRaw(oid);
+    }
+    //another process may have installed a pack (or stored the object) since we looked
+    reloadPacks();
+    if (Utils::exists(path)) {
+        return Utils::readContentsAsString(path);
+    }
+    for (const auto& pack : getPacks()) {
+        if (pack->contains(oid)) return pack->readRaw(oid);
+    }
+    throw GitliteException("Object not found in database: " + oid.hex());
 }
 
-
-
-RemoteObjectDatabase::RemoteObjectDatabase(const std::string& gitlite_root_dir)
-    : remote_root_dir(gitlite_root_dir) {
+size_t ObjectDatabase::writeRawObject(const ObjectId& oid, const std::string& data) {
+    if (hasObject(oid)) {
+        return 0;
+    }
+    Trace::count(Trace::OBJECTS_WRITTEN);
+    Trace::count(Trace::OBJECT_BYTES_WRITTEN, data.size());
+    Utils::writeContents(getObjectPath(oid), data);
+    return data.size();
 }
 
-// build obj's remote path
-std::string RemoteObjectDatabase::getRemoteObjectPath(const std::string& oid) const {
-    if (oid.length() != 40) {
-        throw GitliteException("OID must be 40 characters.");
+std::vector<std::shared_ptr<PackFile>> ObjectDatabase::getPacks() const {
+    std::lock_guard<std::mutex> lock(pack_mtx);
+    if (!packs_loaded) {
+        std::string pack_dir = Utils::join(BASE_DIR, "pack");
+        for (const std::string& file : Utils::plainFilenamesIn(pack_dir)) {
+            if (file.size() > 4 && file.compare(file.size() - 4, 4, ".idx") == 0) {
+                auto pack = PackFile::open(Utils::join(pack_dir, file));
+                if (pack) packs.push_back(pack);
+            }
+        }
+        packs_loaded = true;
     }
-    // path: [remote_root_dir]/objects/da/39a3...
-    std::string subdir = oid.substr(0, 2);
-    std::string filename = oid.substr(2);
-
-    std::string remotepath = Utils::join(remote_root_dir, "objects");
-    remotepath = Utils::join(remotepath,subdir);
-    remotepath = Utils::join(remotepath,filename);
-
-    return remotepath;
+    return packs;
 }
 
-//reuse the local one
-std::shared_ptr<GitLiteObject> RemoteObjectDatabase::readObject(const std::string& oid) const {
-    std::string path = getRemoteObjectPath(oid);
+void ObjectDatabase::reloadPacks() const {
+    std::lock_guard<std::mutex> lock(pack_mtx);
+    packs.clear();
+    packs_loaded = false;
+}
 
-    if (!Utils::exists(path)) {
-        throw GitliteException("Missing object " + oid.substr(0, 7) + " in remote database.");
+size_t ObjectDatabase::repack(size_t min_packs) {
+    auto old_packs = getPacks();
+    if (old_packs.size() < std::max<size_t>(min_packs, 2)) {
+        return 0;
     }
 
-    std::string serialized_data = Utils::readContentsAsString(path);
-
-    size_t null_pos = serialized_data.find('\0');
-    if (null_pos == std::string::npos) {
-        throw GitliteException("Corrupt object file: " + oid.substr(0, 7));
+    //each id once, in id order
+    std::vector<std::pair<ObjectId, const PackFile*>> items;
+    for (const auto& pack : old_packs) {
+        for (const auto& e : pack->getEntries()) items.emplace_back(e.oid, pack.get());
     }
-
-    std::string header = serialized_data.substr(0, null_pos);
-    size_t space_pos = header.find(' ');
-    if (space_pos == std::string::npos) {
-        throw GitliteException("Corrupt object header: " + oid.substr(0, 7));
+    std::sort(items.begin(), items.end(), [](const std::pair<ObjectId, const PackFile*>& a,
+                                             const std::pair<ObjectId, const PackFile*>& b) {
+        return a.first < b.first;
+    });
+    items.erase(std::unique(items.begin(), items.end(), [](const std::pair<ObjectId, const PackFile*>& a,
+                                                           const std::pair<ObjectId, const PackFile*>& b) {
+        return a.first == b.first;
+    }), items.end());
+
+    PackReceiver receiver(*this);
+    PackWriter writer([&receiver](const char* data, size_t len) {
+        receiver.feed(data, len);
+    }, items.size());
+    for (const auto& item : items) {
+        writer.add(item.second->readRaw(item.first));
     }
-
-    std::string type_str_remote = header.substr(0, space_pos);
-    std::string content = serialized_data.substr(null_pos + 2);
-
-    // deserialize
-    if (type_str_remote == "blob") {
-        std::shared_ptr<Blob> blob = std::make_shared<Blob>();
-        blob->deserialize(content);
-        blob->set_hash(oid);
-        return blob;
-    } else if (type_str_remote == "commit") {
-        std::shared_ptr<Commit> commit = std::make_shared<Commit>();
-        commit->deserialize(content);
-        commit->set_hash(oid);
-        return commit;
-    } else {
-        throw std::runtime_error("Unsupported remote object type: " + type_str_remote);
+    writer.finish();
+    receiver.finish();
+
+    //the new pack is in place: drop the old ones, .idx first so no reader picks up a
+    //.pack without its index. readers holding one open keep reading it until they close
+    for (const auto& pack : old_packs) {
+        const std::string& idx = pack->getIdxPath();
+        //same objects as the new pack, same name
+        if (idx == receiver.getIdxPath()) continue;
+        std::remove(idx.c_str());
+        std::remove((idx.substr(0, idx.size() - 4) + ".pack").c_str());
     }
+    reloadPacks();
+    return items.size();
 }
 
-void RemoteObjectDatabase::copyToLocal(const std::string& oid, ObjectDatabase& localDB) {
-    if (localDB.hasObject(oid)) {
-        return;
+std::vector<ObjectId> ObjectDatabase::listObjects() const {
+    Trace::Phase phase("odb.list");
+    std::vector<ObjectId> oids;
+    for (const std::string& subdir : Utils::plainFilenamesIn(BASE_DIR)) {
+        if (subdir.size() != 2) continue;  // skip pack/
+        for (const std::string& file : Utils::plainFilenamesIn(Utils::join(BASE_DIR, subdir))) {
+            // temp files of a write in progress are not ids
+            std::string hex = subdir + file;
+            ObjectId oid;
+            if (ObjectId::parseHex(hex.data(), hex.size(), oid)) oids.push_back(oid);
+        }
     }
-
-    std::string remote_obj_path = getRemoteObjectPath(oid);
-
-    if (!Utils::exists(remote_obj_path)) {
-        throw GitliteException("Fatal: Missing object " + oid.substr(0, 7) + " in remote repository.");
+    auto all_packs = getPacks();
+    for (const auto& pack : all_packs) {
+        for (const auto& e : pack->getEntries()) {
+            oids.push_back(e.oid);
+        }
+    }
+    if (!all_packs.empty()) {
+        std::sort(oids.begin(), oids.end());
+        oids.erase(std::unique(oids.begin(), oids.end()), oids.end());
     }
+    return oids;
+}
 
-    std::string content = Utils::readContentsAsString(remote_obj_path);
 
-    // write(reuse local one)
-    std::string local_obj_path = localDB.getObjectPath(oid);
 
-    // path: .gitlite/objects/da
-    std::string subdir = oid.substr(0, 2);
-    std::string local_subdir = Utils::join(".gitlite", "objects", subdir);
-    Utils::createDirectories(local_subdir);
+RemoteObjectDatabase::RemoteObjectDatabase(const std::string& gitlite_root_dir)
+    : db(gitlite_root_dir) {
+}
+
+std::shared_ptr<GitLiteObject> RemoteObjectDatabase::readObject(const ObjectId& oid) const {
+    if (!db.hasObject(oid)) {
+        throw GitliteException("Missing object " + oid.abbrev() + " in remote database.");
+    }
+    return db.readObject(oid);
+}
 
-    //write
-    Utils::writeContents(local_obj_path, content);
+std::shared_ptr<const CommitHeader> RemoteObjectDatabase::readCommitHeader(const ObjectId& oid) const {
+    if (!db.hasObject(oid)) {
+        throw GitliteException("Missing object " + oid.abbrev() + " in remote database.");
+    }
+    return db.readCommitHeader(oid);
+}
 
+bool RemoteObjectDatabase::hasObject(const ObjectId& oid) const {
+    return db.hasObject(oid);
 }
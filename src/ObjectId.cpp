@@ -0,0 +1,81 @@
+#include "ObjectId.hpp"
+
+#include <cstring>
+
+#include "GitliteException.h"
+#include "Utils.h"
+
+namespace {
+    const char* HEX_DIGITS = "0123456789abcdef";
+
+    //-1 for anything but a lowercase hex digit
+    int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+}
+
+ObjectId ObjectId::fromRaw(const unsigned char* raw) {
+    ObjectId oid;
+    std::memcpy(oid.bytes, raw, RAW_SIZE);
+    return oid;
+}
+
+ObjectId ObjectId::fromHex(const std::string& hex) {
+    ObjectId oid;
+    if (!parseHex(hex.data(), hex.size(), oid)) {
+        throw GitliteException("Invalid object id: " + hex);
+    }
+    return oid;
+}
+
+bool ObjectId::parseHex(const char* data, size_t len, ObjectId& out) {
+    if (len != HEX_SIZE) return false;
+    unsigned char raw[RAW_SIZE];
+    for (size_t i = 0; i < RAW_SIZE; ++i) {
+        int hi = hexValue(data[2 * i]);
+        int lo = hexValue(data[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        raw[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    std::memcpy(out.bytes, raw, RAW_SIZE);
+    return true;
+}
+
+ObjectId ObjectId::hashOf(const std::string& data) {
+    SHA1::Hasher hasher;
+    hasher.update(data);
+    unsigned char raw[RAW_SIZE];
+    hasher.digest(raw);
+    return fromRaw(raw);
+}
+
+std::string ObjectId::hex() const {
+    std::string out(HEX_SIZE, '0');
+    for (size_t i = 0; i < RAW_SIZE; ++i) {
+        out[2 * i] = HEX_DIGITS[bytes[i] >> 4];
+        out[2 * i + 1] = HEX_DIGITS[bytes[i] & 0xf];
+    }
+    return out;
+}
+
+bool ObjectId::hasPrefix(const std::string& prefix) const {
+    if (prefix.size() > HEX_SIZE) return false;
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        unsigned char b = bytes[i / 2];
+        if (prefix[i] != HEX_DIGITS[i % 2 ? b & 0xf : b >> 4]) return false;
+    }
+    return true;
+}
+
+bool ObjectId::isNull() const {
+    for (unsigned char b : bytes) {
+        if (b) return false;
+    }
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& out, const ObjectId& oid) {
+    return out << oid.hex();
+}
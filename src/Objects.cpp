@@ -7,8 +7,8 @@
 #include "GitliteException.h"
 #include "index.hpp"
 
-void GitLiteObject::set_hash(std::string _hash) {
-    hashid = std::move(_hash);
+void GitLiteObject::set_hash(const ObjectId& _hash) {
+    hashid = _hash;
 }
 
 MetaData::MetaData(std::string _message , std::string _timestamp) : message(std::move(_message)),timestamp(std::move(_timestamp)){}
@@ -22,8 +22,9 @@ std::string Commit::serialize() {
 
     //1. serialize the blobs info
     body_ss << "blobs_of_commit:\n";
-    for (const auto& obj: this->Blobs) {
-        body_ss << obj.first <<" "<< obj.second << "\n";
+    for (const Manifest::Entry& obj: this->Blobs) {
+        body_ss.write(obj.path.data(), obj.path.size());
+        body_ss << " " << obj.blob << "\n";
     }
 
     //2. serialize father commit
@@ -48,76 +49,99 @@ std::string Commit::serialize() {
     return final_ss.str();
 }
 
-void Commit::deserialize(const std::string &content) {
-    this->Blobs.clear();
-    this->Father_Commit.clear();
-    this->Commit_Metadata.message.clear();
-    this->Commit_Metadata.timestamp.clear();
-
-    //read all
-    std::stringstream ss(content);
-    std::string line;
-    std::vector<std::string> all_lines;
-    while (std::getline(ss, line)) {
-        all_lines.push_back(line);
-    }
-    if (all_lines.empty()) return;
-
-    // read Timestamp
-    this->Commit_Metadata.timestamp = all_lines.back();
-    all_lines.pop_back();
-
+namespace {
+    const std::string BLOBS_LINE = "blobs_of_commit:\n";
+    const std::string FATHERS_LINE = "father_commit:\n";
 
+    //the body is "blobs_of_commit:\n" {"<path> <hash>\n"} "father_commit:\n" {"<hash>\n"}
+    //"\n" message "\n" timestamp. fills HEADER from DATA[BEGIN, end) and returns where
+    //the "father_commit:" line starts; the blob lines before it are only skipped over
+    size_t parseCommitHeader(const std::string& data, size_t begin, CommitHeader& header) {
+        if (data.compare(begin, BLOBS_LINE.size(), BLOBS_LINE) != 0) {
+            throw GitliteException("Illegle Form Of Commit File!");
+        }
+        size_t blobs = begin + BLOBS_LINE.size();
+        size_t fathers = blobs;
+        if (data.compare(blobs, FATHERS_LINE.size(), FATHERS_LINE) != 0) {
+            //a blob line always ends in a hash, so this is the first "father_commit:" line
+            fathers = data.find("\n" + FATHERS_LINE, blobs);
+            if (fathers == std::string::npos) {
+                throw GitliteException("Illegle Form Of Commit File!");
+            }
+            fathers++;
+        }
 
-    //left the head & blobs & father & message
-    size_t idx = 0;
+        size_t pos = fathers + FATHERS_LINE.size();
+        while (pos < data.size() && data[pos] != '\n') {
+            ObjectId oid;
+            size_t eol = data.find('\n', pos);
+            if (eol == std::string::npos || !ObjectId::parseHex(data.data() + pos, eol - pos, oid)) {
+                throw GitliteException("Illegle Form Of Commit File!");
+            }
+            header.parents.push_back(oid);
+            pos = eol + 1;
+        }
 
-    // "blobs_of_commit:"
-    if (idx < all_lines.size() && all_lines[idx] == "blobs_of_commit:") {
-        idx++;
-        while (all_lines[idx] != "father_commit:") {
-            //std::cerr<<all_lines[idx]<<std::endl;
-            std::stringstream blobline(all_lines[idx]);
-            std::string path;
-            std::string blob_hash;
-            blobline>>path>>blob_hash;
-            Blobs[path] = blob_hash;
-            //std::cerr<<"path: "<<path<<std::endl;   //debug
-            ++idx;
+        //message up to the last line, which is the timestamp
+        size_t message = pos + 1;
+        size_t last = data.rfind('\n');
+        if (pos >= data.size() || last == std::string::npos || last < message) {
+            throw GitliteException("Illegle Form Of Commit File!");
         }
-    }else {
-        throw GitliteException("Illegle Form Of Commit File!");
+        header.message.assign(data, message, last - message);
+        header.timestamp.assign(data, last + 1, std::string::npos);
+        return fathers;
     }
+}
 
+CommitHeader Commit::parseHeader(const std::string& data, size_t begin) {
+    CommitHeader header;
+    parseCommitHeader(data, begin, header);
+    return header;
+}
 
-    //read father_commit
-    if (idx < all_lines.size() && all_lines[idx] == "father_commit:") {
-        idx++;
-        while (!all_lines[idx].empty())
-        {
-            Father_Commit.emplace_back (all_lines[idx]);
-            ++idx;
-        }
-    }else {
-        throw GitliteException("Illegle Form Of Commit File!");
-    }
+CommitHeader Commit::header() const {
+    CommitHeader h;
+    h.oid = hashid;
+    h.parents = Father_Commit;
+    h.message = Commit_Metadata.message;
+    h.timestamp = Commit_Metadata.timestamp;
+    return h;
+}
 
-    // read message (剩余的所有行)
-    while (idx < all_lines.size()) {
-        if (!this->Commit_Metadata.message.empty()) {
-            this->Commit_Metadata.message += "\n";
+void Commit::deserialize(const std::string &content) {
+    this->Blobs.clear();
+    this->Father_Commit.clear();
+    this->Commit_Metadata.message.clear();
+    this->Commit_Metadata.timestamp.clear();
+    if (content.empty()) return;
+
+    CommitHeader header;
+    size_t fathers = parseCommitHeader(content, 0, header);
+    Father_Commit = std::move(header.parents);
+    Commit_Metadata.message = std::move(header.message);
+    Commit_Metadata.timestamp = std::move(header.timestamp);
+
+    //"<path> <hash>" lines, in place
+    PathPool& paths = PathPool::shared();
+    size_t pos = BLOBS_LINE.size();
+    while (pos < fathers) {
+        size_t eol = content.find('\n', pos);
+        size_t len = eol - pos;
+        ObjectId oid;
+        if (len <= ObjectId::HEX_SIZE || content[eol - ObjectId::HEX_SIZE - 1] != ' ' ||
+            !ObjectId::parseHex(content.data() + eol - ObjectId::HEX_SIZE, ObjectId::HEX_SIZE, oid)) {
+            throw GitliteException("Illegle Form Of Commit File!");
         }
-        this->Commit_Metadata.message += all_lines[idx];
-        idx++;
+        Blobs.append(paths.intern(content.data() + pos, len - ObjectId::HEX_SIZE - 1), oid);
+        pos = eol + 1;
     }
+    //written in path order; anything else is put back in order
+    Blobs.normalize();
 }
 
-std::string Commit::getBlobHash(const std::string& path) const {
-    auto it = Blobs.find(path);
-    if (it != Blobs.end()) {
-        return it->second;
-    }
-    return "";
+ObjectId Commit::getBlobHash(const std::string& path) const {
+    return Blobs.blobOf(path);
 }
 
 void Commit::setMetadata(std::string _message, std::string _time_stamp) {
@@ -125,8 +149,8 @@ void Commit::setMetadata(std::string _message, std::string _time_stamp) {
     Commit_Metadata = std::move(tmp);
 }
 
-void Commit::addFather(const std::string &father_hash) {
-    Father_Commit.emplace_back(father_hash);
+void Commit::addFather(const ObjectId &father_hash) {
+    Father_Commit.push_back(father_hash);
 }
 
 void Commit::rmBlob(const std::string &path) {
@@ -134,13 +158,12 @@ void Commit::rmBlob(const std::string &path) {
 }
 
 void Commit::setBlobsFromIndex(index& idx) {
-    for (const auto& changed_blobs : idx.getEntries()) {
-        addBlob(changed_blobs.first , changed_blobs.second);
-    }
-
+    //one pass over the manifest: removals are null ids
+    std::map<std::string, ObjectId> changes = idx.getEntries();
     for (const std::string& filePath : idx.getRmEntries()) {
-        rmBlob(filePath);
+        changes[filePath] = ObjectId();
     }
+    Blobs.update(changes);
 }
 
 std::string Blob::serialize() {
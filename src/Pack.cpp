@@ -0,0 +1,377 @@
+#include "Pack.hpp"
+//before the C headers: <strings.h> declares a function named index
+#include "ObjectDataBase.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+
+#include "GitliteException.h"
+
+namespace {
+    const char* PACK_MAGIC = "GITLITE-PACK 1 ";
+    const size_t FLUSH_SIZE = 1 << 20;
+    const size_t MAX_LINE = 256;
+
+    std::string packDir(const std::string& objects_dir) {
+        return Utils::join(objects_dir, "pack");
+    }
+
+    //a decimal size or count as written by this code: digits only, no sign, no overflow
+    bool parseSize(const std::string& text, size_t& out) {
+        if (text.empty() || text.size() > 18) return false;
+        size_t value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + (c - '0');
+        }
+        out = value;
+        return true;
+    }
+
+    //"<type> <size>" of a pack entry
+    bool parseEntryHeader(const std::string& text, std::string& type, size_t& size) {
+        size_t space = text.find(' ');
+        if (space == std::string::npos) return false;
+        type = text.substr(0, space);
+        return (type == "blob" || type == "commit") && parseSize(text.substr(space + 1), size);
+    }
+
+    bool preadAll(int fd, char* buf, size_t len, uint64_t off) {
+        while (len > 0) {
+            ssize_t n = pread(fd, buf, len, static_cast<off_t>(off));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buf += n;
+            len -= n;
+            off += n;
+        }
+        return true;
+    }
+}
+
+/* PackWriter */
+
+PackWriter::PackWriter(Sink s, size_t count) : sink(std::move(s)) {
+    emit(PACK_MAGIC + std::to_string(count) + "\n");
+}
+
+void PackWriter::emit(const std::string& data, bool hashed) {
+    if (hashed) stream_hash.update(data);
+    buffer += data;
+    written += data.size();
+    if (buffer.size() >= FLUSH_SIZE) flush();
+}
+
+void PackWriter::flush() {
+    if (!buffer.empty()) {
+        sink(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+}
+
+void PackWriter::add(const std::string& raw) {
+    size_t nul = raw.find('\0');
+    if (nul == std::string::npos || nul + 1 >= raw.size() || raw[nul + 1] != '\n') {
+        throw GitliteException("Corrupted object format.");
+    }
+    //"<type> <size>\0\n<content>" goes out as "<type> <size>\n<content>"
+    emit(raw.substr(0, nul) + "\n");
+    stream_hash.update(raw.data() + nul + 2, raw.size() - nul - 2);
+    buffer.append(raw, nul + 2, std::string::npos);
+    written += raw.size() - nul - 2;
+    if (buffer.size() >= FLUSH_SIZE) flush();
+}
+
+std::string PackWriter::finish() {
+    std::string checksum = stream_hash.hexdigest();
+    emit(checksum + "\n", false);
+    flush();
+    return checksum;
+}
+
+/* PackReceiver */
+
+PackReceiver::PackReceiver(ObjectDatabase& database) : db(database) {
+    std::string dir = packDir(db.getObjectsDir());
+    Utils::createDirectories(dir);
+    tmp_path = Utils::join(dir, "tmp_pack_" + std::to_string(getpid()) + "_" +
+                                std::to_string(reinterpret_cast<uintptr_t>(this)));
+    out = std::fopen(tmp_path.c_str(), "wb");
+    if (!out) {
+        throw GitliteException("Cannot create pack file in " + dir);
+    }
+    std::setvbuf(out, nullptr, _IOFBF, FLUSH_SIZE);
+}
+
+PackReceiver::~PackReceiver() {
+    if (out) {
+        std::fclose(out);
+    }
+    //gone already once installed; otherwise the stream failed or was rejected
+    std::remove(tmp_path.c_str());
+}
+
+void PackReceiver::write(const char* data, size_t len, bool hashed) {
+    if (len == 0) return;
+    if (hashed) stream_hash.update(data, len);
+    if (std::fwrite(data, 1, len, out) != len) {
+        throw GitliteException("Error writing pack file.");
+    }
+    offset += len;
+}
+
+size_t PackReceiver::feed(const char* data, size_t len) {
+    size_t used = 0;
+    while (used < len && state != DONE) {
+        if (state == BODY) {
+            size_t take = std::min(remaining, len - used);
+            object_hash.update(data + used, take);
+            write(data + used, take, true);
+            used += take;
+            remaining -= take;
+            if (remaining == 0) {
+                objectComplete();
+            }
+            continue;
+        }
+
+        //line oriented states
+        const char* nl = static_cast<const char*>(std::memchr(data + used, '\n', len - used));
+        size_t take = nl ? (nl - (data + used)) + 1 : len - used;
+        line.append(data + used, take);
+        used += take;
+        if (line.size() > MAX_LINE) {
+            throw GitliteException("Malformed pack stream.");
+        }
+        if (nl) {
+            lineComplete();
+        }
+    }
+    return used;
+}
+
+void PackReceiver::lineComplete() {
+    std::string text = line.substr(0, line.size() - 1);
+
+    if (state == HEADER) {
+        if (text.compare(0, std::strlen(PACK_MAGIC), PACK_MAGIC) != 0) {
+            throw GitliteException("Malformed pack header.");
+        }
+        if (!parseSize(text.substr(std::strlen(PACK_MAGIC)), expected)) {
+            throw GitliteException("Malformed pack header.");
+        }
+        write(line.data(), line.size(), true);
+        state = expected == 0 ? TRAILER : OBJECT_HEADER;
+    } else if (state == OBJECT_HEADER) {
+        std::string type;
+        size_t size = 0;
+        if (!parseEntryHeader(text, type, size)) {
+            throw GitliteException("Malformed pack entry.");
+        }
+        object_offset = offset;
+        write(line.data(), line.size(), true);
+        //the object id covers the header as ObjectDatabase stores it
+        object_hash = SHA1::Hasher();
+        object_hash.update(text);
+        object_hash.update(std::string("\0\n", 2));
+        remaining = size;
+        if (remaining == 0) {
+            objectComplete();
+        } else {
+            state = BODY;
+        }
+    } else if (state == TRAILER) {
+        trailer = text;
+        write(line.data(), line.size(), false);
+        state = DONE;
+    }
+    line.clear();
+}
+
+void PackReceiver::objectComplete() {
+    unsigned char raw[ObjectId::RAW_SIZE];
+    object_hash.digest(raw);
+    entries.emplace_back(ObjectId::fromRaw(raw), object_offset);
+    state = entries.size() == expected ? TRAILER : OBJECT_HEADER;
+}
+
+void PackReceiver::verify() {
+    if (state != DONE) {
+        throw GitliteException("Pack stream ended early.");
+    }
+    std::string checksum = stream_hash.hexdigest();
+    if (checksum != trailer) {
+        throw GitliteException("Pack checksum mismatch, transfer corrupted.");
+    }
+    if (std::fclose(out) != 0) {
+        out = nullptr;
+        std::remove(tmp_path.c_str());
+        throw GitliteException("Error writing pack file.");
+    }
+    out = nullptr;
+
+    //a sender may repeat an object: same id, same bytes, so one entry is enough.
+    //PackFile::open refuses an index whose ids are not strictly increasing
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](const std::pair<ObjectId, uint64_t>& a, const std::pair<ObjectId, uint64_t>& b) {
+                                  return a.first == b.first;
+                              }),
+                  entries.end());
+    verified = true;
+}
+
+bool PackReceiver::contains(const ObjectId& oid) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), oid,
+                               [](const std::pair<ObjectId, uint64_t>& e, const ObjectId& key) { return e.first < key; });
+    return it != entries.end() && it->first == oid;
+}
+
+size_t PackReceiver::install() {
+    if (!verified) {
+        throw GitliteException("Pack installed before it was verified.");
+    }
+    if (entries.empty()) {
+        std::remove(tmp_path.c_str());
+        return 0;
+    }
+
+    std::stringstream idx;
+    for (const auto& e : entries) {
+        idx << e.first << " " << e.second << "\n";
+    }
+
+    std::string base = Utils::join(packDir(db.getObjectsDir()), "pack-" + trailer);
+    //pack first: a .pack without its .idx is invisible to readers, the reverse would not be
+    try {
+        Utils::commitFile(tmp_path, base + ".pack");
+        Utils::writeContents(base + ".idx", idx.str());
+        idx_path = base + ".idx";
+    } catch (const GitliteException&) {
+        throw GitliteException("Cannot install pack " + base);
+    }
+    db.reloadPacks();
+    return entries.size();
+}
+
+size_t PackReceiver::finish() {
+    verify();
+    return install();
+}
+
+/* PackFile */
+
+PackFile::~PackFile() {
+    if (fd >= 0) close(fd);
+}
+
+std::shared_ptr<PackFile> PackFile::open(const std::string& idx_path) {
+    std::string pack_path = idx_path.substr(0, idx_path.size() - 4) + ".pack";
+    std::shared_ptr<PackFile> pack(new PackFile());
+    pack->fd = ::open(pack_path.c_str(), O_RDONLY);
+    if (pack->fd < 0) {
+        return nullptr;
+    }
+
+    pack->idx_path = idx_path;
+
+    //"<oid> <offset>\n" lines, sorted by oid
+    std::stringstream ss(Utils::readContentsAsString(idx_path));
+    std::string line;
+    while (std::getline(ss, line)) {
+        Entry e;
+        size_t off = 0;
+        if (line.size() < ObjectId::HEX_SIZE + 2 || line[ObjectId::HEX_SIZE] != ' ' ||
+            !ObjectId::parseHex(line.data(), ObjectId::HEX_SIZE, e.oid) ||
+            !parseSize(line.substr(ObjectId::HEX_SIZE + 1), off) ||
+            (!pack->entries.empty() && !(pack->entries.back().oid < e.oid))) {
+            throw GitliteException("Corrupted pack index " + idx_path);
+        }
+        e.offset = off;
+        pack->entries.push_back(e);
+    }
+    return pack;
+}
+
+const PackFile::Entry* PackFile::find(const ObjectId& oid) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), oid,
+                               [](const Entry& e, const ObjectId& key) { return e.oid < key; });
+    if (it == entries.end() || it->oid != oid) return nullptr;
+    return &*it;
+}
+
+bool PackFile::contains(const ObjectId& oid) const {
+    return find(oid) != nullptr;
+}
+
+std::string PackFile::readHeader(const ObjectId& oid) const {
+    const Entry* e = find(oid);
+    if (!e) return "";
+
+    char head[MAX_LINE];
+    ssize_t n = pread(fd, head, sizeof(head), static_cast<off_t>(e->offset));
+    if (n <= 0) {
+        throw GitliteException("Corrupted pack entry for " + oid.hex());
+    }
+    const char* nl = static_cast<const char*>(std::memchr(head, '\n', n));
+    if (!nl) {
+        throw GitliteException("Corrupted pack entry for " + oid.hex());
+    }
+    return std::string(head, nl - head);
+}
+
+std::string PackFile::readRaw(const ObjectId& oid) const {
+    const Entry* e = find(oid);
+    if (!e) return "";
+
+    std::string header = readHeader(oid);
+    std::string type;
+    size_t size = 0;
+    if (!parseEntryHeader(header, type, size)) {
+        throw GitliteException("Corrupted pack entry for " + oid.hex());
+    }
+
+    std::string raw = header + std::string("\0\n", 2);
+    size_t body_at = raw.size();
+    raw.resize(body_at + size);
+    if (!preadAll(fd, &raw[body_at], size, e->offset + header.size() + 1)) {
+        throw GitliteException("Corrupted pack entry for " + oid.hex());
+    }
+    return raw;
+}
+
+/* PackBuilder */
+
+size_t PackBuilder::add(const ObjectId& oid) {
+    std::string raw = source.readRawObject(oid);
+    size_t size = raw.size();
+    std::lock_guard<std::mutex> lock(mtx);
+    Item item{oid, std::string()};
+    //past the limit only the id is kept, writeTo() reads the object again
+    if (held + size <= MEMORY_LIMIT) {
+        held += size;
+        item.raw = std::move(raw);
+    }
+    objects.push_back(std::move(item));
+    return size;
+}
+
+uint64_t PackBuilder::writeTo(const PackWriter::Sink& sink) {
+    PackWriter writer(sink, objects.size());
+    for (Item& item : objects) {
+        if (item.raw.empty()) {
+            writer.add(source.readRawObject(item.oid));
+        } else {
+            writer.add(item.raw);
+            //sent: give the memory back
+            held -= item.raw.size();
+            std::string().swap(item.raw);
+        }
+    }
+    writer.finish();
+    return writer.bytesWritten();
+}
@@ -1,11 +1,346 @@
 #include "RefManager.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
 
+#include "GitliteException.h"
+#include "Trace.hpp"
 #include "Utils.h"
 
+namespace {
+    std::string trimHash(std::string hash) {
+        while (!hash.empty() && (hash.back() == '\n' || hash.back() == '\r' || hash.back() == ' ')) {
+            hash.pop_back();
+        }
+        return hash;
+    }
+
+    // the id a ref file (or packed entry) holds, null if it is not one
+    ObjectId parseHash(const std::string& text) {
+        std::string hash = trimHash(text);
+        ObjectId oid;
+        ObjectId::parseHex(hash.data(), hash.size(), oid);
+        return oid;
+    }
+
+    // what RefTransaction expects to find: "" for a ref that must not exist
+    std::string expectedValue(const ObjectId& oid) {
+        return oid.isNull() ? "" : oid.hex();
+    }
+
+    // "<hash> <refname>" line starting at POS; returns the position after it
+    size_t parseLine(const std::string& data, size_t pos, std::string& hash, std::string& name) {
+        size_t nl = data.find('\n', pos);
+        if (nl == std::string::npos) nl = data.size();
+        size_t space = data.find(' ', pos);
+        if (space == std::string::npos || space > nl) {
+            hash.clear();
+            name.clear();
+        } else {
+            hash = data.substr(pos, space - pos);
+            name = data.substr(space + 1, nl - space - 1);
+        }
+        return nl + 1;
+    }
+
+    //how long a writer keeps retrying a busy lock, GITLITE_LOCK_TIMEOUT in ms
+    double lockTimeoutSeconds() {
+        const char* env = std::getenv("GITLITE_LOCK_TIMEOUT");
+        return (env ? std::atof(env) : 10000.0) / 1000.0;
+    }
+
+    //"<ref>.lock" next to the refs: a writer holding that ref right now, not a ref
+    bool isLockFile(const std::string& name) {
+        return name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0;
+    }
+
+    //a writer holds a ref lock for milliseconds: a lock file this old was left by a crash
+    const double STALE_LOCK_SECONDS = 60;
+
+    bool isStale(const std::string& lock_path) {
+        struct stat st;
+        Trace::count(Trace::STAT_CALLS);
+        return stat(lock_path.c_str(), &st) == 0 && std::difftime(std::time(nullptr), st.st_mtime) > STALE_LOCK_SECONDS;
+    }
+
+    //create PATH exclusively, backing off while someone else holds it.
+    //on failure ERROR says why, naming WHAT and the lock file
+    bool acquireLock(const std::string& path, const std::string& what, std::string& error) {
+        auto start = std::chrono::steady_clock::now();
+        double timeout = lockTimeoutSeconds();
+        for (unsigned attempt = 0;; ++attempt) {
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+            if (fd >= 0) {
+                ::close(fd);
+                return true;
+            }
+            if (errno == ENOENT) {
+                size_t slash = path.find_last_of('/');
+                if (slash != std::string::npos && Utils::createDirectories(path.substr(0, slash))) {
+                    continue;
+                }
+            }
+            if (errno != EEXIST) {
+                error = "Unable to lock " + what + ": cannot create " + path + ".";
+                return false;
+            }
+            //not removed automatically: two processes doing so could remove a live lock
+            if (isStale(path)) {
+                error = "Unable to lock " + what + ": " + path + " was left behind by a process that "
+                        "did not finish. If no other gitlite process is running, remove that file.";
+                return false;
+            }
+            double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (waited >= timeout) {
+                error = "Unable to lock " + what + ", another process is updating it (" + path + " exists).";
+                return false;
+            }
+            auto before = std::chrono::steady_clock::now();
+            RefTransaction::backoff(attempt);
+            RefTransaction::Stats& st = RefTransaction::stats();
+            st.lock_waits++;
+            st.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+        }
+    }
+
+    //packed-refs content last read per path, with the stat it was read under.
+    //the file is only ever replaced by rename, so a new inode means new content
+    struct PackedSnapshot {
+        ino_t ino = 0;
+        off_t size = 0;
+        struct timespec mtime = {0, 0};
+        std::shared_ptr<const std::string> data;
+    };
+
+    std::shared_ptr<const std::string> loadPacked(const std::string& path) {
+        static std::mutex mtx;
+        static std::map<std::string, PackedSnapshot> snapshots;
+        static const std::shared_ptr<const std::string> none = std::make_shared<const std::string>();
+
+        Trace::count(Trace::STAT_CALLS);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            return none;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        PackedSnapshot& snap = snapshots[path];
+        if (!snap.data || snap.ino != st.st_ino || snap.size != st.st_size ||
+            snap.mtime.tv_sec != st.st_mtim.tv_sec || snap.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+            snap.ino = st.st_ino;
+            snap.size = st.st_size;
+            snap.mtime = st.st_mtim;
+            snap.data = std::make_shared<const std::string>(Utils::readContentsAsString(path));
+        }
+        return snap.data;
+    }
+
+    std::string readLooseOrPacked(const std::string& dir, const std::string& refName) {
+        std::string loose = Utils::join(dir, refName);
+        if (Utils::isFile(loose)) {
+            return trimHash(Utils::readContentsAsString(loose));
+        }
+        if (refName == "HEAD") return "";
+        return PackedRefs(dir).lookup(refName);
+    }
+}
+
+/* RefTransaction */
+
+const std::string RefTransaction::ANY = "*";
+
+RefTransaction::Stats& RefTransaction::stats() {
+    static Stats s;
+    return s;
+}
+
+std::string RefTransaction::Stats::summary() const {
+    std::stringstream ss;
+    ss << lock_waits << " lock waits (" << wait_seconds << "s), " << conflicts << " conflicts";
+    return ss.str();
+}
+
+void RefTransaction::backoff(unsigned attempt) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    unsigned cap = 1u << std::min(attempt, 7u);  // 1ms .. 128ms
+    std::uniform_int_distribution<unsigned> dist(cap * 500, cap * 1000);
+    std::this_thread::sleep_for(std::chrono::microseconds(dist(rng)));
+}
+
+RefTransaction::RefTransaction(const std::string& gitlite_dir) : dir(gitlite_dir) {
+}
+
+RefTransaction::~RefTransaction() {
+    releaseLocks();
+}
+
+void RefTransaction::update(const std::string& refName, const std::string& newValue, const std::string& expectedOld) {
+    Update u;
+    u.name = refName;
+    u.value = newValue;
+    u.expected = expectedOld;
+    u.lock_path = Utils::join(dir, refName) + ".lock";
+    updates.push_back(u);
+}
+
+void RefTransaction::releaseLocks() {
+    for (Update& u : updates) {
+        if (u.locked) {
+            std::remove(u.lock_path.c_str());
+            u.locked = false;
+        }
+    }
+}
+
+bool RefTransaction::commit() {
+    //a fixed lock order keeps two transactions from waiting on each other
+    std::sort(updates.begin(), updates.end(),
+              [](const Update& a, const Update& b) { return a.name < b.name; });
+
+    for (Update& u : updates) {
+        if (!acquireLock(u.lock_path, u.name, error)) {
+            releaseLocks();
+            return false;
+        }
+        u.locked = true;
+    }
+
+    for (const Update& u : updates) {
+        if (u.expected != ANY && readLooseOrPacked(dir, u.name) != u.expected) {
+            error = "Reference " + u.name + " was updated by another process.";
+            stats().conflicts++;
+            releaseLocks();
+            return false;
+        }
+    }
+
+    //the lock file becomes the ref: write it fully, then rename over the old one
+    for (Update& u : updates) {
+        std::string content = u.value + "\n";
+        FILE* f = std::fopen(u.lock_path.c_str(), "wb");
+        bool ok = f && std::fwrite(content.data(), 1, content.size(), f) == content.size();
+        if (f && std::fclose(f) != 0) ok = false;
+        if (!ok) {
+            error = "Unable to write " + u.name + ".";
+            releaseLocks();
+            return false;
+        }
+        u.locked = false;
+        Utils::commitFile(u.lock_path, Utils::join(dir, u.name));
+    }
+    updates.clear();
+    return true;
+}
+
+/* PackedRefs */
+
+PackedRefs::PackedRefs(const std::string& gitlite_dir)
+    : path(Utils::join(gitlite_dir, "packed-refs")), data(loadPacked(path)) {
+}
+
+PackedRefs::~PackedRefs() {
+    if (locked) {
+        std::remove((path + ".lock").c_str());
+    }
+}
+
+void PackedRefs::lock() {
+    //packed-refs.lock serializes pack-refs and branch deletion
+    std::string error;
+    if (!acquireLock(path + ".lock", "packed-refs", error)) {
+        Utils::exitWithMessage(error);
+    }
+    locked = true;
+    data = loadPacked(path);
+}
+
+size_t PackedRefs::lowerBound(const std::string& key) const {
+    const std::string& data = *this->data;
+    //bisect on byte offsets, snapping each probe to the start of its line
+    size_t lo = 0, hi = data.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t line = data.rfind('\n', mid == 0 ? 0 : mid - 1);
+        line = (line == std::string::npos || mid == 0) ? 0 : line + 1;
+        if (line < lo) line = lo;
+
+        std::string hash, name;
+        size_t next = parseLine(data, line, hash, name);
+        if (name < key) {
+            lo = next;
+        } else {
+            hi = line;
+        }
+    }
+    return lo;
+}
+
+std::string PackedRefs::lookup(const std::string& refName) const {
+    const std::string& data = *this->data;
+    if (data.empty()) return "";
+    size_t pos = lowerBound(refName);
+    if (pos >= data.size()) return "";
+    std::string hash, name;
+    parseLine(data, pos, hash, name);
+    return name == refName ? hash : "";
+}
+
+std::vector<std::pair<std::string, std::string>> PackedRefs::withPrefix(const std::string& prefix) const {
+    const std::string& data = *this->data;
+    std::vector<std::pair<std::string, std::string>> out;
+    size_t pos = data.empty() ? 0 : lowerBound(prefix);
+    while (pos < data.size()) {
+        std::string hash, name;
+        pos = parseLine(data, pos, hash, name);
+        if (name.compare(0, prefix.size(), prefix) != 0) break;
+        out.emplace_back(name, hash);
+    }
+    return out;
+}
+
+void PackedRefs::write(std::vector<std::pair<std::string, std::string>> entries) {
+    std::sort(entries.begin(), entries.end());
+    std::string out;
+    for (const auto& e : entries) {
+        out += e.second + " " + e.first + "\n";
+    }
+    if (!locked) {
+        throw GitliteException("packed-refs written without holding its lock.");
+    }
+    //the lock file becomes the new packed-refs
+    std::string lock = path + ".lock";
+    FILE* f = std::fopen(lock.c_str(), "wb");
+    bool ok = f && std::fwrite(out.data(), 1, out.size(), f) == out.size();
+    if (f && std::fclose(f) != 0) ok = false;
+    if (!ok) {
+        Utils::exitWithMessage("Unable to write packed-refs.");
+    }
+    locked = false;
+    try {
+        Utils::commitFile(lock, path);
+    } catch (...) {
+        std::remove(lock.c_str());
+        throw;
+    }
+    data = loadPacked(path);
+}
+
+/* RefManager */
+
 void RefManager::initManager(Commit& init_commit) {
-    Utils::writeContents(getBranchPath("master"),init_commit.get_hashid());
+    Utils::writeContents(getBranchPath("master"),init_commit.get_hashid().hex());
     Utils::writeContents(HEAD_FILE,"ref: refs/heads/master");
 }
 
@@ -13,13 +348,21 @@ std::string RefManager::getBranchPath(const std::string& branchName) const {
     return Utils::join(MASTER_DIR, branchName);
 }
 
-void RefManager::updateRef(const std::string &refName, const std::string &newHash) {
+void RefManager::updateRef(const std::string &refName, const ObjectId &newHash) {
+    writeRef(refName, newHash, RefTransaction::ANY);
+}
+
+void RefManager::updateRef(const std::string &refName, const ObjectId &newHash, const ObjectId &expectedOld) {
+    writeRef(refName, newHash, expectedValue(expectedOld));
+}
+
+void RefManager::writeRef(const std::string &refName, const ObjectId &newHash, const std::string &expectedOld) {
     // check hash
-    if (newHash.empty() || newHash.length() != 40) {
+    if (newHash.isNull()) {
         Utils::exitWithMessage("Invalid hash provided for reference update.");
     }
 
-    std::string refPath;
+    std::string target;
 
     //if ref is HEAD
     if (refName == "HEAD") {
@@ -32,31 +375,32 @@ void RefManager::updateRef(const std::string &refName, const std::string &newHas
         const std::string refPrefix = "ref: ";
 
         if (headContent.substr(0, refPrefix.size()) == refPrefix) {
-            //headContent = "ref: refs/heads/master"
-
-            //get "refs/heads/master" and add ".gitlite"
-            std::string symbolicRef = headContent.substr(refPrefix.size());
-            refPath = Utils::join(".gitlite", symbolicRef);
+            //headContent = "ref: refs/heads/master" -> "refs/heads/master"
+            target = headContent.substr(refPrefix.size());
         } else {
             //Detached HEAD state: HEAD file comtains only one hashid
-            refPath = HEAD_FILE;
+            target = "HEAD";
         }
     }
     //refs/heads/branchName state
     else if (refName.substr(0, 11) == "refs/heads/") {
-        refPath = Utils::join(".gitlite", refName);
+        target = refName;
     }
     else {
         Utils::exitWithMessage("Unsupported reference name: " + refName);
         return;
     }
 
-    //write
-    Utils::writeContents(refPath, newHash + "\n");
+    //write under the ref's lock
+    RefTransaction tx;
+    tx.update(target, newHash.hex(), expectedOld);
+    if (!tx.commit()) {
+        Utils::exitWithMessage(tx.getError());
+    }
 }
 
-void RefManager::updateRemoteRef(const std::string& remoteName, const std::string& remoteBranchName, const std::string& newHash) {
-    if (newHash.empty() || newHash.length() != 40) {
+void RefManager::updateRemoteRef(const std::string& remoteName, const std::string& remoteBranchName, const ObjectId& newHash) {
+    if (newHash.isNull()) {
         Utils::exitWithMessage("Invalid hash provided for remote reference update.");
     }
 
@@ -70,9 +414,11 @@ void RefManager::updateRemoteRef(const std::string& remoteName, const std::strin
     }
 
     // .gitlite/refs/remotes/[remoteName]/[remoteBranchName]
-    std::string fullPath = Utils::join(remoteRefDir, remoteBranchName);
-
-    Utils::writeContents(fullPath, newHash + "\n");
+    RefTransaction tx;
+    tx.update("refs/remotes/" + remoteName + "/" + remoteBranchName, newHash.hex());
+    if (!tx.commit()) {
+        Utils::exitWithMessage(tx.getError());
+    }
 }
 
 
@@ -100,22 +446,39 @@ std::string RefManager::getRemoteTrackingBranchPath(const std::string& remoteTra
     return "";
 }
 
+std::vector<ObjectId> RefManager::getRemoteTrackingHashes(const std::string& remoteName) const {
+    std::string remoteRefDir = Utils::join(".gitlite", "refs", "remotes");
+    remoteRefDir = Utils::join(remoteRefDir, remoteName);
+
+    std::vector<ObjectId> hashes;
+    for (const std::string& branch : Utils::plainFilenamesIn(remoteRefDir)) {
+        if (isLockFile(branch)) continue;
+        ObjectId hash = parseHash(Utils::readContentsAsString(Utils::join(remoteRefDir, branch)));
+        if (!hash.isNull()) {
+            hashes.push_back(hash);
+        }
+    }
+    for (const auto& e : PackedRefs().withPrefix("refs/remotes/" + remoteName + "/")) {
+        ObjectId hash = parseHash(e.second);
+        if (!hash.isNull() && !Utils::isFile(Utils::join(".gitlite", e.first))) {
+            hashes.push_back(hash);
+        }
+    }
+    return hashes;
+}
+
 //ref: refs/heads/master
-std::string RefManager::resolveHead() {
+ObjectId RefManager::resolveHead() {
     std::string content = Utils::readContentsAsString(HEAD_FILE);
 
     if (!content.empty() && content.back() == '\n') content.pop_back();
 
     if (content.substr(0, 5) == "ref: ") {
-        std::string refPath = ".gitlite/" + content.substr(5);   //dir is like ".gitlite/refs/heads/[branch name]"
-        if (!Utils::exists(refPath)) return "";
-        std::string hash = Utils::readContentsAsString(refPath);
-
-        if (!hash.empty() && hash.back() == '\n') hash.pop_back();  //debug
-        return hash;
+        //"refs/heads/[branch name]", loose or packed
+        return readRef(content.substr(5));
     } else {
         // Detached HEAD, return hash
-        return content;
+        return parseHash(content);
     }
 }
 
@@ -132,28 +495,29 @@ std::string RefManager::getCurrentBranchName() {
 }
 
 void RefManager::createBranch(const std::string& branchName) {
-    std::string path = getBranchPath(branchName);
-
-    if (Utils::exists(path)) {
+    if (!readRef("refs/heads/" + branchName).isNull()) {
         Utils::exitWithMessage("A branch with that name already exists.");
     }
 
-    std::string currentCommitHash = resolveHead();
-    if (currentCommitHash.empty()) {
+    ObjectId currentCommitHash = resolveHead();
+    if (currentCommitHash.isNull()) {
         Utils::exitWithMessage("No commit to branch from (repo is empty).");
     }
 
-    // create  Reference
-    Ref newBranch(branchName, currentCommitHash, false);
-
-    // write to .gitlite/refs/heads/[branchName]
-    Utils::writeContents(path, newBranch.serialize());
+    // write .gitlite/refs/heads/[branchName] under its lock; "" = must still not exist,
+    // so of two concurrent `branch` commands only one succeeds
+    RefTransaction tx;
+    tx.update("refs/heads/" + branchName, currentCommitHash.hex(), "");
+    if (!tx.commit()) {
+        Utils::exitWithMessage(tx.getError());
+    }
 }
 
 void RefManager::removeBranch(const std::string& branchName) {
     std::string path = getBranchPath(branchName);
+    std::string refName = "refs/heads/" + branchName;
 
-    if (!Utils::exists(path)) {
+    if (readRef(refName).isNull()) {
         Utils::exitWithMessage("A branch with that name does not exist.");
     }
 
@@ -163,26 +527,120 @@ void RefManager::removeBranch(const std::string& branchName) {
         Utils::exitWithMessage("Cannot remove the current branch.");
     }
 
-    // delete
-    Utils::restrictedDelete(path);
+    //under the ref's own lock, so a concurrent update of the branch waits for us
+    std::string lock = path + ".lock";
+    std::string error;
+    if (!acquireLock(lock, refName, error)) {
+        Utils::exitWithMessage(error);
+    }
+    try {
+        // delete, the packed entry too or it would show through. checked under
+        // packed-refs.lock: a pack-refs running now may be packing this very ref
+        PackedRefs packed;
+        packed.lock();
+        if (!packed.lookup(refName).empty()) {
+            auto entries = packed.withPrefix("refs/");
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                         [&refName](const std::pair<std::string, std::string>& e) {
+                                             return e.first == refName;
+                                         }),
+                          entries.end());
+            packed.write(entries);
+        }
+        if (Utils::exists(path)) {
+            Utils::restrictedDelete(path);
+        }
+    } catch (...) {
+        std::remove(lock.c_str());
+        throw;
+    }
+    std::remove(lock.c_str());
 }
 
 std::vector<std::string> RefManager::getAllBranchNames() const {
+    std::vector<std::string> branchNames;
+    if (Utils::isDirectory(MASTER_DIR)) {
+        for (const std::string& name : Utils::plainFilenamesIn(MASTER_DIR)) {
+            if (isLockFile(name)) continue;
+            branchNames.push_back(name);
+        }
+    }
 
-    if (!Utils::isDirectory(MASTER_DIR)) {
-        return {};
+    PackedRefs packed;
+    auto entries = packed.withPrefix("refs/heads/");
+    if (entries.empty()) {
+        return branchNames;
+    }
+    for (const auto& e : entries) {
+        branchNames.push_back(e.first.substr(11));
     }
+    std::sort(branchNames.begin(), branchNames.end());
+    branchNames.erase(std::unique(branchNames.begin(), branchNames.end()), branchNames.end());
+    return branchNames;
+}
 
+ObjectId RefManager::readRef(const std::string& refName) const {
+    std::string loose = Utils::join(".gitlite", refName);
+    if (Utils::isFile(loose)) {
+        return parseHash(Utils::readContentsAsString(loose));
+    }
+    return parseHash(PackedRefs().lookup(refName));
+}
 
-    std::vector<std::string> branchNames = Utils::plainFilenamesIn(MASTER_DIR);
+size_t RefManager::packRefs() {
+    //locked before reading, so a concurrent rm-branch's edit is not overwritten
+    PackedRefs packed;
+    packed.lock();
+    std::map<std::string, std::string> refs;
+    for (const auto& e : packed.withPrefix("refs/")) {
+        refs[e.first] = e.second;
+    }
 
-    return branchNames;
+    //loose refs win over what was packed before
+    std::vector<std::string> loose_files;
+    for (const std::string& branch : Utils::plainFilenamesIn(MASTER_DIR)) {
+        if (isLockFile(branch)) continue;
+        loose_files.push_back("refs/heads/" + branch);
+    }
+    std::string remotesDir = Utils::join(".gitlite", "refs", "remotes");
+    for (const std::string& remote : Utils::plainFilenamesIn(remotesDir)) {
+        for (const std::string& branch : Utils::plainFilenamesIn(Utils::join(remotesDir, remote))) {
+            if (isLockFile(branch)) continue;
+            loose_files.push_back("refs/remotes/" + remote + "/" + branch);
+        }
+    }
+
+    std::map<std::string, std::string> loose_hashes;
+    for (const std::string& name : loose_files) {
+        std::string path = Utils::join(".gitlite", name);
+        if (!Utils::isFile(path)) continue;
+        std::string hash = trimHash(Utils::readContentsAsString(path));
+        if (hash.length() != 40) continue;
+        refs[name] = hash;
+        loose_hashes[name] = hash;
+    }
+
+    packed.write(std::vector<std::pair<std::string, std::string>>(refs.begin(), refs.end()));
+
+    //only drop a loose ref if nobody moved it while we were packing
+    for (const auto& e : loose_hashes) {
+        std::string path = Utils::join(".gitlite", e.first);
+        std::string lock = path + ".lock";
+        std::string error;
+        if (!acquireLock(lock, e.first, error)) continue;
+        //gone already if rm-branch deleted it meanwhile
+        if (Utils::isFile(path) && trimHash(Utils::readContentsAsString(path)) == e.second) {
+            std::remove(path.c_str());
+        }
+        std::remove(lock.c_str());
+    }
+    return loose_hashes.size();
 }
 
 
 
 RemoteRefManager::RemoteRefManager(const std::string& gitlite_root_dir)
-    : remote_root_dir(gitlite_root_dir) {
+    : remote_root_dir(gitlite_root_dir), packed(gitlite_root_dir) {
     if (!remote_root_dir.empty() && remote_root_dir.back() == '/') {
         remote_root_dir.pop_back();
     }
@@ -193,35 +651,35 @@ std::string RemoteRefManager::getRefPath(const std::string& refName) const {
     return Utils::join(remote_root_dir, refName);
 }
 
-std::string RemoteRefManager::resolveRef(const std::string& refName) const {
+ObjectId RemoteRefManager::resolveRef(const std::string& refName) const {
     std::string refPath = getRefPath(refName);
 
     if (!Utils::exists(refPath)) {
-        return "";
+        return parseHash(packed.lookup(refName));
     }
 
     std::string content = Utils::readContentsAsString(refPath);
-
-    if (!content.empty() && content.back() == '\n') {
-        content.pop_back();
-    }                                                                                                                 //debug
-    content.erase(std::remove_if(content.begin(), content.end(), ::isspace), content.end());   //debug
-
-    if (content.length() == 40) {
-        return content;
-    }
-    return "";
+    content.erase(std::remove_if(content.begin(), content.end(), ::isspace), content.end());
+    return parseHash(content);
 }
 
 //remote ref only have detached ref
-void RemoteRefManager::updateRef(const std::string& refName, const std::string& newHash) {
-    if (newHash.empty() || newHash.length() != 40) {
+bool RemoteRefManager::updateRef(const std::string& refName, const ObjectId& newHash,
+                                 const ObjectId& expectedOld) {
+    if (newHash.isNull()) {
         Utils::exitWithMessage("Invalid hash provided for reference update.");
     }
 
-    std::string refPath = getRefPath(refName);
-
-    Utils::writeContents(refPath, newHash + "\n");
+    RefTransaction tx(remote_root_dir);
+    tx.update(refName, newHash.hex(), expectedValue(expectedOld));
+    if (tx.commit()) {
+        return true;
+    }
+    //a busy lock that never freed up is not a moved ref
+    if (tx.getError().compare(0, 14, "Unable to lock") == 0) {
+        Utils::exitWithMessage(tx.getError());
+    }
+    return false;
 }
 
 
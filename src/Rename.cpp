@@ -0,0 +1,150 @@
+#include "Rename.hpp"
+
+#include <algorithm>
+#include <set>
+
+#include "Diff.hpp"
+#include "Trace.hpp"
+
+namespace {
+    //odd multipliers, one hash function per sketch slot
+    struct Multipliers {
+        uint64_t m[Rename::SKETCH_SIZE];
+        Multipliers() {
+            uint64_t x = 0x9e3779b97f4a7c15ull;
+            for (uint64_t& v : m) {
+                //splitmix64
+                x += 0x9e3779b97f4a7c15ull;
+                uint64_t z = x;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                v = (z ^ (z >> 31)) | 1;
+            }
+        }
+    };
+
+    const Multipliers& multipliers() {
+        static const Multipliers instance;
+        return instance;
+    }
+
+    uint64_t bandKey(const Rename::Sketch& s, size_t band) {
+        uint64_t key = band;
+        for (size_t r = 0; r < Rename::ROWS; ++r) {
+            key = (key ^ s.mins[band * Rename::ROWS + r]) * 0x100000001b3ull;
+        }
+        return key;
+    }
+}
+
+namespace Rename {
+    Sketch sketch(const std::string& content) {
+        Sketch s;
+        std::fill(std::begin(s.mins), std::end(s.mins), UINT32_MAX);
+        const Multipliers& mul = multipliers();
+        for (const Diff::Line& line : Diff::splitLines(content)) {
+            //"a\n" and a last line "a" are the same line
+            Diff::Line text{line.data, line.hasNewline() ? line.size - 1 : line.size};
+            uint64_t h = Diff::hashLine(text);
+            for (size_t i = 0; i < SKETCH_SIZE; ++i) {
+                uint32_t v = static_cast<uint32_t>((h * mul.m[i]) >> 32);
+                if (v < s.mins[i]) s.mins[i] = v;
+            }
+            s.empty = false;
+        }
+        return s;
+    }
+
+    int similarity(const Sketch& a, const Sketch& b) {
+        if (a.empty || b.empty) return 0;
+        size_t same = 0;
+        for (size_t i = 0; i < SKETCH_SIZE; ++i) {
+            if (a.mins[i] == b.mins[i]) same++;
+        }
+        return static_cast<int>(same * 100 / SKETCH_SIZE);
+    }
+
+    size_t SimilarityIndex::add(const Sketch& s) {
+        size_t id = sketches.size();
+        sketches.push_back(s);
+        if (!s.empty) {
+            for (size_t band = 0; band < BANDS; ++band) {
+                buckets[bandKey(s, band)].push_back(id);
+            }
+        }
+        return id;
+    }
+
+    std::vector<size_t> SimilarityIndex::candidates(const Sketch& s) const {
+        std::vector<size_t> out;
+        if (s.empty) return out;
+        for (size_t band = 0; band < BANDS; ++band) {
+            auto it = buckets.find(bandKey(s, band));
+            if (it != buckets.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+
+    std::vector<Match> detect(ObjectDatabase& db,
+                              const std::map<std::string, ObjectId>& deleted,
+                              const std::map<std::string, ObjectId>& added,
+                              int min_similarity) {
+        std::vector<Match> matches;
+        if (deleted.empty() || added.empty()) return matches;
+        Trace::Phase phase("merge.renames");
+        std::set<std::string> used_from, used_to;
+
+        //exact renames: same blob, nothing to read
+        std::map<ObjectId, std::vector<std::string>> by_blob;
+        for (const auto& pair : deleted) by_blob[pair.second].push_back(pair.first);
+        for (const auto& pair : added) {
+            auto it = by_blob.find(pair.second);
+            if (it == by_blob.end() || it->second.empty()) continue;
+            matches.push_back({it->second.front(), pair.first, 100});
+            used_from.insert(it->second.front());
+            used_to.insert(pair.first);
+            it->second.erase(it->second.begin());
+        }
+
+        std::vector<std::string> from_paths;
+        SimilarityIndex index;
+        for (const auto& pair : deleted) {
+            if (used_from.count(pair.first)) continue;
+            from_paths.push_back(pair.first);
+            index.add(sketch(db.readBlobContent(pair.second)));
+        }
+        if (from_paths.empty()) return matches;
+
+        struct Candidate {
+            int similarity;
+            size_t from;
+            std::string to;
+        };
+        std::vector<Candidate> scored;
+        for (const auto& pair : added) {
+            if (used_to.count(pair.first)) continue;
+            Sketch s = sketch(db.readBlobContent(pair.second));
+            for (size_t id : index.candidates(s)) {
+                int score = similarity(index.at(id), s);
+                if (score >= min_similarity) scored.push_back({score, id, pair.first});
+            }
+        }
+
+        //best pairs first; ties in path order so the result does not depend on hashing
+        std::sort(scored.begin(), scored.end(), [&from_paths](const Candidate& a, const Candidate& b) {
+            if (a.similarity != b.similarity) return a.similarity > b.similarity;
+            if (from_paths[a.from] != from_paths[b.from]) return from_paths[a.from] < from_paths[b.from];
+            return a.to < b.to;
+        });
+        for (const Candidate& c : scored) {
+            const std::string& from = from_paths[c.from];
+            if (used_from.count(from) || used_to.count(c.to)) continue;
+            used_from.insert(from);
+            used_to.insert(c.to);
+            matches.push_back({from, c.to, c.similarity});
+        }
+        return matches;
+    }
+}
@@ -11,6 +11,66 @@
 #include <unordered_set>
 
 #include "RemoteManager.hpp"
+#include "TransferEngine.hpp"
+#include "Daemon.hpp"
+#include "Pack.hpp"
+#include "GitliteException.h"
+#include "Trace.hpp"
+#include "CommitGraph.hpp"
+#include "Diff.hpp"
+#include "MergeEngine.hpp"
+
+namespace {
+    //compare-and-swap rounds a push makes before giving up on a busy remote branch
+    const unsigned PUSH_ATTEMPTS = 8;
+
+    //full id of the commit abbreviated by PREFIX; blobs that share the prefix do not count
+    ObjectId resolveCommitId(const ObjectDatabase& db, const std::string& prefix) {
+        std::vector<ObjectId> commits;
+        for (const ObjectId& oid : db.findObjectsByPrefix(prefix)) {
+            if (db.objectType(oid) == "commit") commits.push_back(oid);
+        }
+        if (commits.empty()) {
+            Utils::exitWithMessage("No commit with that id exists.");
+        }
+        if (commits.size() > 1) {
+            std::string msg = "Commit id " + prefix + " is ambiguous; it could be:";
+            for (const ObjectId& oid : commits) {
+                msg += "\n  " + oid.hex();
+            }
+            Utils::exitWithMessage(msg);
+        }
+        return commits[0];
+    }
+
+    //delete the worktree file of every path in FROM that TO does not have, one merge pass
+    void deleteMissing(const Manifest& from, const Manifest& to) {
+        auto t = to.begin();
+        for (const Manifest::Entry& e : from) {
+            while (t != to.end() && t->path < e.path) ++t;
+            if (t == to.end() || t->path != e.path) {
+                Utils::restrictedDelete(e.path.str());
+            }
+        }
+    }
+
+    void printLogEntry(const CommitHeader& commit) {
+        std::cout << "===\ncommit " << commit.oid << "\n";
+
+        const auto& fathers = commit.parents;
+
+        //handle merge
+        if (fathers.size() == 2) {
+            std::cout << "Merge: " << fathers[0].abbrev() << " "
+                      << fathers[1].abbrev() << "\n";
+        }
+
+        //output metadata
+        std::cout << "Date: " << commit.timestamp << "\n";
+        std::cout << commit.message << "\n";
+        std::cout << "\n";
+    }
+}
 
 void Repository::init() {
     //check if .gitlite exists
@@ -30,7 +90,7 @@ void Repository::init() {
 
 }
 
-void Repository::add(std::string & file) {
+void Repository::add(const std::string & file) {
     if (!Utils::isFile(file)) {
         Utils::exitWithMessage("File does not exist.");
     }
@@ -47,17 +107,17 @@ void Repository::add(std::string & file) {
     Blob add_blob(fileContent);
 
     //init database
-    ObjectDatabase db;
-    std::string new_blob_hash = Utils::sha1(add_blob.serialize());
+    ObjectDatabase& db = objects;
+    ObjectId new_blob_hash = ObjectId::hashOf(add_blob.serialize());
 
     //refresh index and write index
     index idx;
     RefManager refManager;
-    std::string head_commit_hash = refManager.resolveHead();
+    ObjectId head_commit_hash = refManager.resolveHead();
 
-    std::string commit_blob_hash;
+    ObjectId commit_blob_hash;
 
-    if (!head_commit_hash.empty()) {
+    if (!head_commit_hash.isNull()) {
         auto commit_obj = db.readObject(head_commit_hash);
         if (commit_obj) {
             // convert gitobj to commit
@@ -91,13 +151,13 @@ void Repository::add(std::string & file) {
     idx.write();
 }
 
-void Repository::commit(std::string & message) {
+void Repository::commit(const std::string & message) {
     if (message.empty()) {
         Utils::exitWithMessage("Please enter a commit message.");
     }
     //init
     index idx;
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
 
     //check entries
@@ -110,8 +170,8 @@ void Repository::commit(std::string & message) {
     std::string timestamp = Utils::getCurrentTimestamp();
     newCommit.setMetadata(message, timestamp);
     //set father commit
-    std::string parentHash = refManager.resolveHead();
-    if (!parentHash.empty()) {
+    ObjectId parentHash = refManager.resolveHead();
+    if (!parentHash.isNull()) {
         newCommit.addFather(parentHash);
 
         //firsly read and copy father commit
@@ -119,43 +179,40 @@ void Repository::commit(std::string & message) {
         if (!father_commit) {
             Utils::exitWithMessage("Fail to read father commit!");
         }
-        for (const auto& father_blobs : father_commit->getBlobs()) {
-            newCommit.addBlob(father_blobs.first , father_blobs.second);
-        }
+        newCommit.getBlobsRef() = father_commit->getBlobs();
     }
 
-    //then change blobs according to the entries (staging area)
-    for (const auto& changed_blobs : idx.getEntries()) {
-        newCommit.addBlob(changed_blobs.first , changed_blobs.second);
-    }
+    //then change blobs according to the entries (staging area), in one pass
+    std::map<std::string, ObjectId> changes = idx.getEntries();
     for (const auto & changed_blobs : idx.getRmEntries()) {
-        if (newCommit.getBlobs().find(changed_blobs) != newCommit.getBlobs().end()) {
-            newCommit.rmBlob(changed_blobs);
-        }else {
+        if (!newCommit.isTracking(changed_blobs) && !changes.count(changed_blobs)) {
             Utils::exitWithMessage("wrongly deleted inexisted file");
         }
+        changes[changed_blobs] = ObjectId();
     }
+    newCommit.getBlobsRef().update(changes);
 
     //then write commit and update refs
     db.writeObject(newCommit);
-    refManager.updateRef("HEAD",newCommit.get_hashid());
+    //compare-and-swap against the parent: a concurrent commit must not be dropped
+    refManager.updateRef("HEAD",newCommit.get_hashid(), parentHash);
 
     //refresh index
     idx.clear();
     idx.write();
 }
 
-void Repository::rm(std::string & file_name) {
+void Repository::rm(const std::string & file_name) {
     index idx;
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
 
     // get current commit state
-    std::string currentCommitHash = refManager.resolveHead();
+    ObjectId currentCommitHash = refManager.resolveHead();
     std::shared_ptr<Commit> currentCommit = nullptr;
     bool isTrackedByCommit = false;
 
-    if (!currentCommitHash.empty()) {
+    if (!currentCommitHash.isNull()) {
         //judge if the file being tracked by current commit
         try {
             auto obj = db.readObject(currentCommitHash);
@@ -200,128 +257,209 @@ void Repository::rm(std::string & file_name) {
 }
 
 void Repository::log() {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
 
-    std::string currentCommitHash = refManager.resolveHead();
+    ObjectId currentCommitHash = refManager.resolveHead();
 
-    while (!currentCommitHash.empty()) {
-        std::shared_ptr<Commit> currentCommit;
+    while (!currentCommitHash.isNull()) {
+        //parents and message only, the blob manifest is never parsed
+        std::shared_ptr<const CommitHeader> currentCommit;
         try {
-            auto obj = db.readObject(currentCommitHash);
-            currentCommit = std::dynamic_pointer_cast<Commit>(obj);
+            currentCommit = db.readCommitHeader(currentCommitHash);
 
             if (!currentCommit) {
-                Utils::exitWithMessage("Corrupted object: object at " + currentCommitHash.substr(0, 7) + " is not a Commit.");
+                Utils::exitWithMessage("Corrupted object: object at " + currentCommitHash.abbrev() + " is not a Commit.");
             }
         } catch (const std::exception& e) {
-            Utils::exitWithMessage("Error reading commit object (" + currentCommitHash.substr(0, 7) + "): " + e.what());
+            Utils::exitWithMessage("Error reading commit object (" + currentCommitHash.abbrev() + "): " + e.what());
         }
 
-        //output commit hashid
-        std::cout << "===\ncommit " << currentCommit->get_hashid() << "\n";
-
-        const auto& fathers = currentCommit->getFatherCommits();
-
-        //handle merge
-        if (fathers.size() == 2) {
-            std::cout << "Merge: " << fathers[0].substr(0, 7) << " "
-                      << fathers[1].substr(0, 7) << "\n";
-        }
-
-        //output metadata
-        std::cout << "Date: " << currentCommit->getTimestamp() << "\n";
-        std::cout << currentCommit->getMessage() << "\n";
-        std::cout << "\n";
+        printLogEntry(*currentCommit);
+        const auto& fathers = currentCommit->parents;
 
         //search back
         if (!fathers.empty()) {
             currentCommitHash = fathers[0]; //main branch in [0]
         } else {
-            currentCommitHash.clear();
+            currentCommitHash = ObjectId();
         }
     }
 }
 
-void Repository::globalLog() {
-    ObjectDatabase db;
+void Repository::logPath(const std::string& path) {
+    ObjectDatabase& db = objects;
+    RefManager refManager;
+    CommitGraph graph;
+    graph.load();
 
-    const std::string OBJECTS_DIR = ".gitlite/objects";
-    std::vector<std::string> subdirs = Utils::plainFilenamesIn(OBJECTS_DIR);
+    auto readCommit = [&db](const ObjectId& hash) {
+        auto commit = std::dynamic_pointer_cast<Commit>(db.readObject(hash));
+        if (!commit) {
+            Utils::exitWithMessage("Corrupted object: object at " + hash.abbrev() + " is not a Commit.");
+        }
+        return commit;
+    };
 
-    for (const std::string& subdir : subdirs) {
-        //.gitlite/objects/da
-        std::string subdir_path = Utils::join(OBJECTS_DIR, subdir);
-        std::vector<std::string> object_files = Utils::plainFilenamesIn(subdir_path);
+    ObjectId currentCommitHash = refManager.resolveHead();
+    while (!currentCommitHash.isNull()) {
+        //a commit in the graph whose filter rules PATH out is passed without reading it
+        const CommitGraph::Entry* entry = graph.find(currentCommitHash);
+        std::vector<ObjectId> fathers;
+        std::shared_ptr<Commit> currentCommit;
+        if (entry) {
+            fathers = entry->parents;
+        }
+        if (!entry || CommitGraph::mayHaveChanged(*entry, path)) {
+            currentCommit = readCommit(currentCommitHash);
+            fathers = currentCommit->getFatherCommits();
+            ObjectId before = fathers.empty() ? ObjectId() : readCommit(fathers[0])->getBlobHash(path);
+            if (currentCommit->getBlobHash(path) != before) {
+                printLogEntry(currentCommit->header());
+            }
+        }
+        currentCommitHash = fathers.empty() ? ObjectId() : fathers[0];
+    }
+}
 
-        for (const std::string& filename : object_files) {
-            std::string commit_hash = subdir + filename;
-            std::shared_ptr<GitLiteObject> obj = nullptr;
+void Repository::diff(const std::vector<std::string>& commitIds, const std::vector<std::string>& paths) {
+    ObjectDatabase& db = objects;
+    RefManager refManager;
 
-            //read from hash
-            try {
-                obj = db.readObject(commit_hash);
-            } catch (const std::exception& e) {
-                continue;
-            }
+    auto commitBlobs = [&db](const std::string& prefix) {
+        ObjectId hash = resolveCommitId(db, prefix);
+        auto commit = std::dynamic_pointer_cast<Commit>(db.readObject(hash));
+        if (!commit) {
+            Utils::exitWithMessage("Corrupted object: object at " + hash.abbrev() + " is not a Commit.");
+        }
+        return commit->getBlobs();
+    };
 
-            //check if it's commit
-            std::shared_ptr<Commit> currentCommit = std::dynamic_pointer_cast<Commit>(obj);
-            if (currentCommit) {
-                //copy from log
-                std::cout << "===\ncommit " << currentCommit->get_hashid() << "\n";
-                const auto& fathers = currentCommit->getFatherCommits();
+    // 旧版本: 给定的第一个 commit，否则为暂存区视图 (HEAD + 暂存的新增 - 暂存的删除)
+    Manifest oldBlobs;
+    Manifest tracked;
+    if (commitIds.size() < 2) {
+        index idx;
+        ObjectId headHash = refManager.resolveHead();
+        if (!headHash.isNull()) {
+            auto head = std::dynamic_pointer_cast<Commit>(db.readObject(headHash));
+            if (head) tracked = head->getBlobs();
+        }
+        std::map<std::string, ObjectId> staged = idx.getEntries();
+        for (const std::string& file : idx.getRmEntries()) staged[file] = ObjectId();
+        tracked.update(staged);
+    }
+    oldBlobs = commitIds.empty() ? tracked : commitBlobs(commitIds[0]);
 
-                if (fathers.size() == 2) {
-                    std::cout << "Merge: " << fathers[0].substr(0, 7) << " "
-                              << fathers[1].substr(0, 7) << "\n";
-                }
+    // 新版本: 第二个 commit，否则为工作区 (只看两边出现过的文件，未跟踪的不显示)
+    bool worktree = commitIds.size() < 2;
+    Manifest newBlobs = worktree ? tracked : commitBlobs(commitIds[1]);
+
+    auto selected = [&paths](const std::string& file) {
+        if (paths.empty()) return true;
+        for (const std::string& p : paths) {
+            if (file == p || file.compare(0, p.size() + 1, p + "/") == 0) return true;
+        }
+        return false;
+    };
 
-                std::cout << "Date: " << currentCommit->getTimestamp() << "\n";
-                std::cout << currentCommit->getMessage() << "\n";
-                std::cout << "\n";
+    StatCache stat_cache;
+    auto show = [&](const std::string& file, const ObjectId& oldHash, const ObjectId& committed) {
+        if (!selected(file)) return;
+        ObjectId newHash = committed;
+        std::string newContent;
+        bool have_content = false;
+        if (worktree) {
+            //unchanged stat: reuse the recorded hash and never open the file
+            newHash = ObjectId();
+            struct stat st;
+            if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+                !stat_cache.lookup(file, st, newHash)) {
+                newContent = Utils::readContentsAsString(file);
+                have_content = true;
+                newHash = ObjectId::hashOf(Blob(newContent).serialize());
+                stat_cache.record(file, st, newHash);
             }
         }
+        if (oldHash == newHash) return;
+
+        std::string oldContent = db.readBlobContent(oldHash);
+        if (!worktree) newContent = db.readBlobContent(newHash);
+        else if (!have_content && !newHash.isNull()) newContent = Utils::readContentsAsString(file);
+
+        std::cout << "diff --git a/" << file << " b/" << file << "\n";
+        std::cout << "--- " << (oldHash.isNull() ? "/dev/null" : "a/" + file) << "\n";
+        std::cout << "+++ " << (newHash.isNull() ? "/dev/null" : "b/" + file) << "\n";
+        std::cout << Diff::unified(oldContent, newContent);
+    };
+
+    //both manifests are sorted: one merge pass visits each path once, in order
+    Trace::Phase phase("diff.compare");
+    auto o = oldBlobs.begin();
+    auto n = newBlobs.begin();
+    while (o != oldBlobs.end() || n != newBlobs.end()) {
+        if (n == newBlobs.end() || (o != oldBlobs.end() && o->path < n->path)) {
+            show(o->path.str(), o->blob, ObjectId());
+            ++o;
+        } else if (o == oldBlobs.end() || n->path < o->path) {
+            show(n->path.str(), ObjectId(), n->blob);
+            ++n;
+        } else {
+            show(o->path.str(), o->blob, n->blob);
+            ++o;
+            ++n;
+        }
+    }
+
+    if (worktree) {
+        try {
+            stat_cache.write();
+        } catch (const GitliteException&) {
+            //read-only repository: the next diff just hashes again
+        }
+    }
+}
+
+void Repository::globalLog() {
+    ObjectDatabase& db = objects;
+
+    //loose and packed objects alike
+    for (const ObjectId& commit_hash : db.listObjects()) {
+        std::shared_ptr<const CommitHeader> currentCommit;
+
+        //read from hash, null if it's not a commit
+        try {
+            currentCommit = db.readCommitHeader(commit_hash);
+        } catch (const std::exception& e) {
+            continue;
+        }
+
+        if (currentCommit) {
+            printLogEntry(*currentCommit);
+        }
     }
 }
 
 void Repository::find(const std::string &message) {
-    ObjectDatabase db;
-    std::vector<std::string> matching_commits;
+    ObjectDatabase& db = objects;
+    std::vector<ObjectId> matching_commits;
 
     const std::string OBJECTS_DIR = ".gitlite/objects";
     if (!Utils::isDirectory(OBJECTS_DIR)) {
         Utils::exitWithMessage("No Gitlite repository found or objects directory is missing.");
     }
 
-    std::vector<std::string> subdirs = Utils::plainFilenamesIn(OBJECTS_DIR);
-    //std::cerr<<subdirs.size()<<std::endl;  //debug
-    for (const std::string& subdir : subdirs) {
-        std::string subdir_path = Utils::join(OBJECTS_DIR, subdir);
-
-        std::vector<std::string> object_files = Utils::plainFilenamesIn(subdir_path);
-        //std::cerr<<object_files.size()<<std::endl;  //debug
+    for (const ObjectId& commit_hash : db.listObjects()) {
+        std::shared_ptr<const CommitHeader> currentCommit;
 
-        for (const std::string& filename : object_files) {
-            // place together 2 bit hash(subdir) and 38 bit
-            std::string commit_hash = subdir + filename;
-
-            std::shared_ptr<GitLiteObject> obj = nullptr;
-
-            try {
-                obj = db.readObject(commit_hash);
-            } catch (const std::exception& e) {
-                //std::cerr<<"cant find obj : "<<commit_hash<<std::endl; //debug
-                continue;
-            }
-
-            std::shared_ptr<Commit> currentCommit = std::dynamic_pointer_cast<Commit>(obj);
-            if (currentCommit) {
-                if (currentCommit->getMessage() == message) {
-                    matching_commits.push_back(currentCommit->get_hashid());
-                 }
+        try {
+            currentCommit = db.readCommitHeader(commit_hash);
+        } catch (const std::exception& e) {
+            continue;
+        }
 
-            }
+        if (currentCommit && currentCommit->message == message) {
+            matching_commits.push_back(commit_hash);
         }
     }
 
@@ -330,14 +468,14 @@ void Repository::find(const std::string &message) {
     if (matching_commits.empty()) {
         Utils::exitWithMessage("Found no commit with that message.");
     } else {
-        for (const std::string& hash : matching_commits) {
+        for (const ObjectId& hash : matching_commits) {
             std::cout << hash << "\n";
         }
     }
 }
 
 void Repository::status() {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager ref_manager;
     index staging_index;
 
@@ -391,16 +529,13 @@ void Repository::status() {
 
 
     //handle modified and untracked file
-    std::string currentCommitHash = ref_manager.resolveHead();
-    std::map<std::string, std::string> trackedBlobs;
-
-    if (!currentCommitHash.empty()) {
-        auto obj = db.readObject(currentCommitHash);
-        std::shared_ptr<Commit> currentCommit = std::dynamic_pointer_cast<Commit>(obj);
-        if (currentCommit) {
-            trackedBlobs = currentCommit->getBlobs();
-        }
+    ObjectId currentCommitHash = ref_manager.resolveHead();
+    std::shared_ptr<Commit> currentCommit;
+    if (!currentCommitHash.isNull()) {
+        currentCommit = std::dynamic_pointer_cast<Commit>(db.readObject(currentCommitHash));
     }
+    static const Manifest NO_BLOBS;
+    const Manifest& trackedBlobs = currentCommit ? currentCommit->getBlobs() : NO_BLOBS;
 
     std::set<std::string> allFiles;
     std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
@@ -408,8 +543,8 @@ void Repository::status() {
         if (file == ".gitlite") continue;
         allFiles.insert(file);
     }
-    for (const auto& pair : trackedBlobs) {
-        allFiles.insert(pair.first);
+    for (const Manifest::Entry& e : trackedBlobs) {
+        allFiles.insert(e.path.str());
     }
     for (const auto& pair : staging_index.getEntries()) {
         allFiles.insert(pair.first);
@@ -419,26 +554,27 @@ void Repository::status() {
     }
 
     // get file hash - check if modified
-    auto getFileHash = [](const std::string& path) -> std::string {
-        if (!Utils::exists(path)) return "";
+    auto getFileHash = [](const std::string& path) -> ObjectId {
+        if (!Utils::exists(path)) return ObjectId();
         std::string content = Utils::readContentsAsString(path);
         std::string header = "blob " + std::to_string(content.size() + 1);
-        return Utils::sha1(header + '\0'+'\n' + content + '\n');
+        return ObjectId::hashOf(header + '\0'+'\n' + content + '\n');
     };
 
+    Trace::Phase phase("status.compare-worktree");
     std::map<std::string, std::string> modificationsNotStagedMap;
     std::vector<std::string> untrackedFiles;
 
     for (const std::string& filePath : allFiles) {
         bool inWorkingDir = Utils::exists(filePath);
-        bool isTracked = (trackedBlobs.count(filePath) > 0);
+        bool isTracked = trackedBlobs.contains(filePath);
         bool inStagedAdd = (staging_index.getEntries().count(filePath) > 0);
         bool inStagedRemove = (std::find(staging_index.getRmEntries().begin(),staging_index.getRmEntries().end(),filePath) != staging_index.getRmEntries().end());
 
 
-        std::string wdHash = inWorkingDir ? getFileHash(filePath) : "";
-        std::string trackedHash = isTracked ? trackedBlobs.at(filePath) : "";
-        std::string stagedHash = inStagedAdd ? staging_index.getEntries().at(filePath) : "";
+        ObjectId wdHash = inWorkingDir ? getFileHash(filePath) : ObjectId();
+        ObjectId trackedHash = trackedBlobs.blobOf(filePath);
+        ObjectId stagedHash = inStagedAdd ? staging_index.getEntries().at(filePath) : ObjectId();
 
         bool wdContentChangedFromTracked = (isTracked && inWorkingDir && (wdHash != trackedHash));
         bool wdContentChangedFromStaged = (inStagedAdd && inWorkingDir && (wdHash != stagedHash));
@@ -505,11 +641,11 @@ void Repository::status() {
 // Repository.cpp
 
 void Repository::checkoutFile(const std::string& fileName) {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
-    std::string headCommitHash = refManager.resolveHead();
+    ObjectId headCommitHash = refManager.resolveHead();
 
-    if (headCommitHash.empty()) {
+    if (headCommitHash.isNull()) {
         Utils::exitWithMessage("No commit with that id exists.");
     }
 
@@ -522,9 +658,9 @@ void Repository::checkoutFile(const std::string& fileName) {
         Utils::exitWithMessage("No commit with that id exists.");
     }
 
-    std::string blobHash = headCommit->getBlobHash(fileName);
+    ObjectId blobHash = headCommit->getBlobHash(fileName);
 
-    if (blobHash.empty()) {
+    if (blobHash.isNull()) {
         Utils::exitWithMessage("File does not exist in that commit.");
     }
 
@@ -544,13 +680,9 @@ void Repository::checkoutFile(const std::string& fileName) {
 // Repository.cpp
 
 void Repository::checkoutFileInCommit(const std::string& commitId, const std::string& fileName) {
-    ObjectDatabase db;
-
-    std::string targetHash = db.findObjectByPrefix(commitId);
+    ObjectDatabase& db = objects;
 
-    if (targetHash.empty()) {
-        Utils::exitWithMessage("No commit with that id exists.");
-    }
+    ObjectId targetHash = resolveCommitId(db, commitId);
 
     // read target commit
     std::shared_ptr<Commit> targetCommit = nullptr;
@@ -566,9 +698,9 @@ void Repository::checkoutFileInCommit(const std::string& commitId, const std::st
     }
 
     //find if files in commit
-    std::string blobHash = targetCommit->getBlobHash(fileName);
+    ObjectId blobHash = targetCommit->getBlobHash(fileName);
 
-    if (blobHash.empty()) {
+    if (blobHash.isNull()) {
         Utils::exitWithMessage("File does not exist in that commit.");
     }
 
@@ -586,25 +718,24 @@ void Repository::checkoutFileInCommit(const std::string& commitId, const std::st
 
 
 void Repository::checkoutBranch(const std::string& branchName) {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
     index idx;
 
     bool isLocalBranch = false;
-    std::string targetCommitHash;
+    ObjectId targetCommitHash;
 
-    // local branch: .gitlite/refs/heads/[branchName]
-    std::string localBranchPath = Utils::join(".gitlite/refs/heads", branchName);
+    // local branch: refs/heads/[branchName], remote branch: refs/remotes/[branchName]
+    // (loose file or packed-refs)
+    ObjectId localHash = refManager.readRef("refs/heads/" + branchName);
+    ObjectId remoteHash = localHash.isNull() ? refManager.readRef("refs/remotes/" + branchName) : ObjectId();
 
-    // remote branch: .gitlite/refs/remotes/[branchName]
-    std::string remoteBranchPath = Utils::join(".gitlite/refs/remotes", branchName);
-
-    if (Utils::exists(localBranchPath)) {
+    if (!localHash.isNull()) {
         isLocalBranch = true;
-        targetCommitHash = Utils::readContentsAsString(localBranchPath);
-    } else if (Utils::exists(remoteBranchPath)) {
+        targetCommitHash = localHash;
+    } else if (!remoteHash.isNull()) {
         isLocalBranch = false;
-        targetCommitHash = Utils::readContentsAsString(remoteBranchPath);
+        targetCommitHash = remoteHash;
     } else {
         Utils::exitWithMessage("No such branch exists.");
     }
@@ -616,10 +747,7 @@ void Repository::checkoutBranch(const std::string& branchName) {
     }
 
     // get commit hash
-    if (!targetCommitHash.empty() && targetCommitHash.back() == '\n') {
-        targetCommitHash.pop_back();
-    }//debug
-    std::string currentCommitHash = refManager.resolveHead();
+    ObjectId currentCommitHash = refManager.resolveHead();
 
     std::shared_ptr<Commit> currentCommit = nullptr;
     std::shared_ptr<Commit> targetCommit = nullptr;
@@ -628,7 +756,7 @@ void Repository::checkoutBranch(const std::string& branchName) {
     auto obj = db.readObject(targetCommitHash);
     targetCommit = std::dynamic_pointer_cast<Commit>(obj);
 
-    if (!currentCommitHash.empty()) {
+    if (!currentCommitHash.isNull()) {
         try {
             auto obj = db.readObject(currentCommitHash);
             currentCommit = std::dynamic_pointer_cast<Commit>(obj);
@@ -636,50 +764,49 @@ void Repository::checkoutBranch(const std::string& branchName) {
         }
     }
 
-    // get Blobs Map (Path -> Hash)
-    std::map<std::string, std::string> currentBlobs;
-    if (currentCommit) currentBlobs = currentCommit->getBlobs();
-
-    std::map<std::string, std::string> targetBlobs;
-    if (targetCommit) targetBlobs = targetCommit->getBlobs();
+    // get Blobs (Path -> Hash), no copies
+    static const Manifest NO_BLOBS;
+    const Manifest& currentBlobs = currentCommit ? currentCommit->getBlobs() : NO_BLOBS;
+    const Manifest& targetBlobs = targetCommit ? targetCommit->getBlobs() : NO_BLOBS;
 
 
     //if a file untracked by current_commit and not in idx but in target_blob, then throw an RE and exit
 
-    std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
-    for (const std::string& file : workingFiles) {
-        if (file == ".gitlite") continue;
+    {
+        Trace::Phase phase("worktree.check-untracked");
+        std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
+        for (const std::string& file : workingFiles) {
+            if (file == ".gitlite") continue;
 
-        bool isTrackedCurrent = (currentBlobs.find(file) != currentBlobs.end());
-        bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
-        bool existsInTarget = (targetBlobs.find(file) != targetBlobs.end());
+            bool isTrackedCurrent = currentBlobs.contains(file);
+            bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
+            bool existsInTarget = targetBlobs.contains(file);
 
-        if (!isTrackedCurrent && !isStaged && existsInTarget) {
-            Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+            if (!isTrackedCurrent && !isStaged && existsInTarget) {
+                Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+            }
         }
     }
 
-    // renew workdir
-    //delete
-    for (const auto& pair : currentBlobs) {
-        const std::string& path = pair.first;
-        if (targetBlobs.find(path) == targetBlobs.end()) {
-            Utils::restrictedDelete(path);
-        }
-    }
-    //add
-    for (const auto& pair : targetBlobs) {
-        const std::string& path = pair.first;
-        const std::string& blobHash = pair.second;
+    {
+        Trace::Phase phase("worktree.write");
+        // renew workdir
+        //delete
+        deleteMissing(currentBlobs, targetBlobs);
+        //add
+        for (const Manifest::Entry& e : targetBlobs) {
+            std::string path = e.path.str();
+            const ObjectId& blobHash = e.blob;
 
-        try {
-            auto obj = db.readObject(blobHash);
-            auto blob = std::dynamic_pointer_cast<Blob>(obj);
-            if (blob) {
-                Utils::writeContents(path, blob->getContent());
+            try {
+                auto obj = db.readObject(blobHash);
+                auto blob = std::dynamic_pointer_cast<Blob>(obj);
+                if (blob) {
+                    Utils::writeContents(path, blob->getContent());
+                }
+            } catch (...) {
+                Utils::exitWithMessage("Fatal: Missing blob object for " + path);
             }
-        } catch (...) {
-            Utils::exitWithMessage("Fatal: Missing blob object for " + path);
         }
     }
 
@@ -689,7 +816,7 @@ void Repository::checkoutBranch(const std::string& branchName) {
         Utils::writeContents(".gitlite/HEAD", newHeadContent);
     } else {
         //detached head
-        Utils::writeContents(".gitlite/HEAD", targetCommitHash + "\n");
+        Utils::writeContents(".gitlite/HEAD", targetCommitHash.hex() + "\n");
     }
 
     idx.clear();
@@ -706,13 +833,10 @@ void Repository::rm_branch(const std::string& branchName) {
 }
 
 void Repository::reset(const std::string& commitId) {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
     index idx;
-    std::string targetHash = db.findObjectByPrefix(commitId);
-    if (targetHash.empty()) {
-        Utils::exitWithMessage("No commit with that id exists.");
-    }
+    ObjectId targetHash = resolveCommitId(db, commitId);
 
     //load commit
     std::shared_ptr<Commit> targetCommit = nullptr;
@@ -722,76 +846,69 @@ void Repository::reset(const std::string& commitId) {
     } catch (...) {
         Utils::exitWithMessage("No commit with that id exists.");
     }
-    std::string currentCommitHash = refManager.resolveHead();
+    ObjectId currentCommitHash = refManager.resolveHead();
     std::shared_ptr<Commit> currentCommit = nullptr;
-    if (!currentCommitHash.empty()) {
+    if (!currentCommitHash.isNull()) {
         try {
             auto obj = db.readObject(currentCommitHash);
             currentCommit = std::dynamic_pointer_cast<Commit>(obj);
         } catch (...) {}
     }
 
-    //load bolb->file
-    std::map<std::string, std::string> currentBlobs;
-    if (currentCommit) currentBlobs = currentCommit->getBlobs();
-
-    std::map<std::string, std::string> targetBlobs;
-    if (targetCommit) targetBlobs = targetCommit->getBlobs();
+    //load bolb->file, no copies
+    static const Manifest NO_BLOBS;
+    const Manifest& currentBlobs = currentCommit ? currentCommit->getBlobs() : NO_BLOBS;
+    const Manifest& targetBlobs = targetCommit ? targetCommit->getBlobs() : NO_BLOBS;
 
 
     //reuse checkout branch code
-    std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
-    for (const std::string& file : workingFiles) {
-        if (file == ".gitlite") continue;
+    {
+        Trace::Phase phase("worktree.check-untracked");
+        std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
+        for (const std::string& file : workingFiles) {
+            if (file == ".gitlite") continue;
 
-        bool isTrackedCurrent = (currentBlobs.find(file) != currentBlobs.end());
-        bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
-        bool existsInTarget = (targetBlobs.find(file) != targetBlobs.end());
+            bool isTrackedCurrent = currentBlobs.contains(file);
+            bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
+            bool existsInTarget = targetBlobs.contains(file);
 
-        if (!isTrackedCurrent && !isStaged && existsInTarget) {
-            Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
-        }
-    }
-    // renew workmenu
-    //delete
-    for (const auto& pair : currentBlobs) {
-        const std::string& path = pair.first;
-        if (targetBlobs.find(path) == targetBlobs.end()) {
-            Utils::restrictedDelete(path);
+            if (!isTrackedCurrent && !isStaged && existsInTarget) {
+                Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+            }
         }
     }
-    //add
-    for (const auto& pair : targetBlobs) {
-        const std::string& path = pair.first;
-        const std::string& blobHash = pair.second;
+    {
+        Trace::Phase phase("worktree.write");
+        // renew workmenu
+        //delete
+        deleteMissing(currentBlobs, targetBlobs);
+        //add
+        for (const Manifest::Entry& e : targetBlobs) {
+            std::string path = e.path.str();
+            const ObjectId& blobHash = e.blob;
 
-        try {
-            auto obj = db.readObject(blobHash);
-            auto blob = std::dynamic_pointer_cast<Blob>(obj);
-            if (blob) {
-                Utils::writeContents(path, blob->getContent());
+            try {
+                auto obj = db.readObject(blobHash);
+                auto blob = std::dynamic_pointer_cast<Blob>(obj);
+                if (blob) {
+                    Utils::writeContents(path, blob->getContent());
+                }
+            } catch (...) {
+                Utils::exitWithMessage("Fatal: Missing blob object for " + path);
             }
-        } catch (...) {
-            Utils::exitWithMessage("Fatal: Missing blob object for " + path);
         }
     }
 
 
-    std::string currentBranch = refManager.getCurrentBranchName();
-
-    if (!currentBranch.empty()) {
-        std::string branchPath = Utils::join(".gitlite/refs/heads", currentBranch);
-        Utils::writeContents(branchPath, targetHash);
-    } else {
-        Utils::writeContents(".gitlite/HEAD", targetHash);
-    }
+    //current branch, or HEAD itself when detached
+    refManager.updateRef("HEAD", targetHash);
 
     idx.clear();
     idx.write();
 }
 
 void Repository::merge(const std::string& givenBranchName) {
-    ObjectDatabase db;
+    ObjectDatabase& db = objects;
     RefManager refManager;
     index idx;
 
@@ -801,16 +918,14 @@ void Repository::merge(const std::string& givenBranchName) {
         Utils::exitWithMessage("Cannot merge a branch with itself.");
     }
 
-    std::string givenBranchPath = refManager.getBranchPath(givenBranchName);
-    if (!Utils::exists(givenBranchPath)) {
+    ObjectId givenHash = refManager.readRef("refs/heads/" + givenBranchName);
+    if (givenHash.isNull()) {
         // to support fetch & pull
-        std::string remoteTrackingPath = refManager.getRemoteTrackingBranchPath(givenBranchName);
+        givenHash = refManager.readRef("refs/remotes/" + givenBranchName);
 
-        if (remoteTrackingPath.empty()) {
+        if (givenHash.isNull()) {
             Utils::exitWithMessage("A branch with that name does not exist.");
             return;
-        } else {
-            givenBranchPath = remoteTrackingPath;
         }
     }
 
@@ -819,24 +934,22 @@ void Repository::merge(const std::string& givenBranchName) {
         Utils::exitWithMessage("You have uncommitted changes.");
     }
 
-    std::string currentHash = refManager.resolveHead();
-    std::string givenHash = Utils::readContentsAsString(givenBranchPath);
-    if (!givenHash.empty() && givenHash.back() == '\n') givenHash.pop_back();
+    ObjectId currentHash = refManager.resolveHead();
 
     // load commit
     std::shared_ptr<Commit> currentCommit = std::dynamic_pointer_cast<Commit>(db.readObject(currentHash));
     std::shared_ptr<Commit> givenCommit = std::dynamic_pointer_cast<Commit>(db.readObject(givenHash));
 
     // find split obj
-    std::string splitPointHash = findCommonAncestor(currentHash, givenHash);
+    ObjectId splitPointHash = findCommonAncestor(currentHash, givenHash);
 
 
     std::shared_ptr<Commit> splitCommit = std::dynamic_pointer_cast<Commit>(db.readObject(splitPointHash));
 
     //get all blobs
-    std::map<std::string, std::string> splitBlobs = splitCommit->getBlobs();
-    std::map<std::string, std::string> currentBlobs = currentCommit->getBlobs();
-    std::map<std::string, std::string> givenBlobs = givenCommit->getBlobs();
+    const Manifest& splitBlobs = splitCommit->getBlobs();
+    const Manifest& currentBlobs = currentCommit->getBlobs();
+    const Manifest& givenBlobs = givenCommit->getBlobs();
 
 
     std::vector<std::string> workingFiles = Utils::plainFilenamesIn(".");
@@ -844,9 +957,9 @@ void Repository::merge(const std::string& givenBranchName) {
     //tackle untrack conflict
     for (const std::string& file : workingFiles) {
         if (file == ".gitlite") continue;
-        bool isTrackedCurrent = (currentBlobs.count(file));
+        bool isTrackedCurrent = currentBlobs.contains(file);
         bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
-        bool existsInGiven = (givenBlobs.count(file));
+        bool existsInGiven = givenBlobs.contains(file);
 
         //if a file untracked by current_commit and not in idx but in given_commit, then throw an RE and exit
         if (!isTrackedCurrent && !isStaged && existsInGiven) {
@@ -869,9 +982,9 @@ void Repository::merge(const std::string& givenBranchName) {
         for (const std::string& file : workingFiles) {
             if (file == ".gitlite") continue;
 
-            bool isTrackedCurrent = (currentBlobs.count(file));
+            bool isTrackedCurrent = currentBlobs.contains(file);
             bool isStaged = idx.contains_in_entries(file) || idx.contains_in_removed(file);
-            bool existsInTarget = (givenBlobs.count(file));
+            bool existsInTarget = givenBlobs.contains(file);
 
             if (!isTrackedCurrent && !isStaged && existsInTarget) {
                 Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
@@ -882,29 +995,24 @@ void Repository::merge(const std::string& givenBranchName) {
         //update stage and workfir
 
         // 删除 currentBlobs 中有，但 givenBlobs 中没有的文件
-        for (const auto& pair : currentBlobs) {
-            const std::string& path = pair.first;
-            if (givenBlobs.find(path) == givenBlobs.end()) {
-                Utils::restrictedDelete(path);
-            }
-        }
+        deleteMissing(currentBlobs, givenBlobs);
 
         // 添加/覆盖 givenBlobs 中的文件，并暂存
-        for (const auto& pair : givenBlobs) {
-            const std::string& path = pair.first;
-            const std::string& blobHash = pair.second;
+        for (const Manifest::Entry& e : givenBlobs) {
+            std::string path = e.path.str();
+            const ObjectId& blobHash = e.blob;
 
             writeBlobToWD(db, path, blobHash);
 
             idx.add_entry(path, blobHash);
         }
 
-        refManager.updateRef("HEAD", givenHash);
+        refManager.updateRef("HEAD", givenHash, currentHash);
 
         idx.clear();
         idx.write();
 
-        Utils::exitWithMessage("Current branch fast-forwarded.");
+        Utils::message("Current branch fast-forwarded.");
         return;
     }
 
@@ -912,129 +1020,26 @@ void Repository::merge(const std::string& givenBranchName) {
 }
 
 void Repository::performThreeWayMerge(
-    const std::map<std::string, std::string>& splitBlobs,
-    const std::map<std::string, std::string>& currentBlobs,
-    const std::map<std::string, std::string>& givenBlobs,
+    const Manifest& splitBlobs,
+    const Manifest& currentBlobs,
+    const Manifest& givenBlobs,
     index& idx,
     ObjectDatabase& db,
     RefManager &refManager,
     const std::string& givenBranchName,
     const std::string& currentBranchName,
-    const std::string& currentHash,
-    const std::string& givenHash
+    const ObjectId& currentHash,
+    const ObjectId& givenHash
 ) {
-    std::set<std::string> allFiles;
-    for (const auto& pair : splitBlobs) allFiles.insert(pair.first);
-    for (const auto& pair : currentBlobs) allFiles.insert(pair.first);
-    for (const auto& pair : givenBlobs) allFiles.insert(pair.first);
-
-    bool conflictEncountered = false;
-
-    for (const std::string& path : allFiles) {
-        // 获取三个版本的文件哈希 (如果不存在则为空字符串)
-        std::string h_split = splitBlobs.count(path) ? splitBlobs.at(path) : "";
-        std::string h_current = currentBlobs.count(path) ? currentBlobs.at(path) : "";
-        std::string h_given = givenBlobs.count(path) ? givenBlobs.at(path) : "";
-
-        // 定义文件状态 (是否存在)
-        bool exists_split = !h_split.empty();
-        bool exists_current = !h_current.empty();
-        bool exists_given = !h_given.empty();
-
-        // 文件是否被修改 (与 split 相比)
-        bool mod_current = exists_current && (h_current != h_split);
-        bool mod_given = exists_given && (h_given != h_split);
-
-        // 文件是否被删除 (与 split 相比)
-        bool del_current = exists_split && !exists_current;
-        bool del_given = exists_split && !exists_given;
-
-        //HANDLE CONFLICT
-
-        // Case 8: modified by different ways
-        if (
-            // A. 两边都修改，且内容不同
-            (mod_current && mod_given && h_current != h_given) ||
-            // B. 一边修改，一边删除
-            (mod_current && del_given) || (del_current && mod_given) ||
-            // C. 均新增，但内容不同
-            (!exists_split && exists_current && exists_given && h_current != h_given)
-        ) {
-            conflictEncountered = true;
-
-            // 获取冲突文件内容
-            std::string content_current = h_current.empty() ? "" : db.readBlobContent(h_current);
-            std::string content_given = h_given.empty() ? "" : db.readBlobContent(h_given);
-
-            // 构造冲突标记内容
-            std::stringstream conflict_ss;
-            conflict_ss << "<<<<<<< HEAD\n";
-            conflict_ss << content_current;
-            if (!content_current.empty() && content_current.back() != '\n') conflict_ss << "\n";
-            conflict_ss << "=======\n";
-            conflict_ss << content_given;
-            if (!content_given.empty() && content_given.back() != '\n') conflict_ss << "\n";
-            conflict_ss << ">>>>>>>\n";
-
-            std::string final_content = conflict_ss.str();
-            Utils::writeContents(path, final_content);
-
-            // 暂存冲突结果
-            Blob conflict_blob(final_content);
-            std::string conflict_hash = db.writeObject(conflict_blob);
-            idx.add_entry(path, conflict_hash);
-
-            continue;
-        }
-
-
-        //handle no-conflict
-
-        // Case 6: only be deleted in given -> all delete
-        if (exists_split && (h_current == h_split) && del_given) {
-             Utils::restrictedDelete(path);
-             idx.rm_entry(path);
-             idx.add_rm_entry(path);
-             continue;
-        }
-
-        // Case 3: same modify/delete
-        if ((mod_current && mod_given && h_current == h_given) || (del_current && del_given)) {
-            continue;
-        }
-
-        // Case 2: only modified in current -> stay like current
-        if (mod_current && !del_given) {
-            continue;
-        }
-
-        // Case 1: only modified in given -> change to given
-        if (mod_given && !del_current) {
-            writeBlobToWD(db, path, h_given);
-            idx.add_entry(path, h_given);
-            continue;
-        }
-
-        // Case 5: newly add in given
-        if (!exists_split && !exists_current && exists_given) {
-            writeBlobToWD(db, path, h_given);
-            idx.add_entry(path, h_given);
-            continue;
-        }
-
-        // Case 4: newly add in current
-        if (!exists_split && exists_current && !exists_given) {
-            idx.add_entry(path, h_current);
-            continue;
-        }
-
-    }
+    // 合并只在内存中计算，结果确定后再一次性写入对象库、工作区与暂存区
+    Merge::Result result = Merge::merge(db, splitBlobs, currentBlobs, givenBlobs);
+    Merge::apply(db, result, idx);
 
     idx.write();
 
 
     // COMMIT
-    if (conflictEncountered) {
+    if (!result.clean()) {
         std::cout << "Encountered a merge conflict." << std::endl;
     }
 
@@ -1045,20 +1050,19 @@ void Repository::performThreeWayMerge(
     newCommit.addFather(currentHash); // HEAD (Current Branch)
     newCommit.addFather(givenHash);   // Given Branch
 
-    newCommit.getBlobsRef() = currentBlobs;
-    newCommit.setBlobsFromIndex(idx);
+    newCommit.getBlobsRef() = result.manifest;
 
-    std::string newCommitHash = db.writeObject(newCommit);
+    ObjectId newCommitHash = db.writeObject(newCommit);
 
-    refManager.updateRef("HEAD", newCommitHash);
+    refManager.updateRef("HEAD", newCommitHash, currentHash);
 
     idx.clear();
     idx.write();
 }
 
 //a function to act like checkout branch which write blob to working dir
-void Repository::writeBlobToWD(ObjectDatabase& db, const std::string& path, const std::string& blobHash) {
-    if (blobHash.empty()) {
+void Repository::writeBlobToWD(ObjectDatabase& db, const std::string& path, const ObjectId& blobHash) {
+    if (blobHash.isNull()) {
         return;
     }
 
@@ -1068,32 +1072,31 @@ void Repository::writeBlobToWD(ObjectDatabase& db, const std::string& path, cons
     Utils::writeContents(path, blob->getContent());
 }
 
-std::string Repository::findCommonAncestor(const std::string& hash1, const std::string& hash2) {
-    ObjectDatabase db;
+ObjectId Repository::findCommonAncestor(const ObjectId& hash1, const ObjectId& hash2) {
+    Trace::Phase phase("merge.find-ancestor");
+    ObjectDatabase& db = objects;
     if (hash1 == hash2) {
         return hash1;
     }
 
     // store hash1 and all its ancestor
-    std::unordered_set<std::string> ancestors1;
-    std::queue<std::string> queue1;
+    std::unordered_set<ObjectId> ancestors1;
+    std::queue<ObjectId> queue1;
 
     queue1.push(hash1);
     ancestors1.insert(hash1);
 
     //handle multi-father situation (如菱形结构)
     while (!queue1.empty()) {
-        std::string currentHash = queue1.front();
+        ObjectId currentHash = queue1.front();
         queue1.pop();
 
-        std::shared_ptr<Commit> currentCommit = nullptr;
-        auto obj = db.readObject(currentHash);
-        currentCommit = std::dynamic_pointer_cast<Commit>(obj);
-
+        // 只读提交头 (父提交与元数据)，不解析文件清单
+        std::shared_ptr<const CommitHeader> currentCommit = db.readCommitHeader(currentHash);
 
         if (currentCommit) {
             // 遍历所有父提交 (可能不止一个，处理合并提交)
-            for (const std::string& parentHash : currentCommit->getFatherCommits()) {
+            for (const ObjectId& parentHash : currentCommit->parents) {
                 if (ancestors1.find(parentHash) == ancestors1.end()) {
                     ancestors1.insert(parentHash);
                     queue1.push(parentHash);
@@ -1103,26 +1106,24 @@ std::string Repository::findCommonAncestor(const std::string& hash1, const std::
     }
 
 
-    std::queue<std::string> queue2;
-    std::unordered_set<std::string> visited2;
+    std::queue<ObjectId> queue2;
+    std::unordered_set<ObjectId> visited2;
 
     queue2.push(hash2);
     visited2.insert(hash2);
 
     while (!queue2.empty()) {
-        std::string currentHash = queue2.front();
+        ObjectId currentHash = queue2.front();
         queue2.pop();
 
         if (ancestors1.count(currentHash)) {
             return currentHash;
         }
 
-        std::shared_ptr<Commit> currentCommit = nullptr;
-        auto obj = db.readObject(currentHash);
-        currentCommit = std::dynamic_pointer_cast<Commit>(obj);
+        std::shared_ptr<const CommitHeader> currentCommit = db.readCommitHeader(currentHash);
 
         if (currentCommit) {
-            for (const std::string& parentHash : currentCommit->getFatherCommits()) {
+            for (const ObjectId& parentHash : currentCommit->parents) {
                 if (visited2.find(parentHash) == visited2.end()) {
                     visited2.insert(parentHash);
                     queue2.push(parentHash);
@@ -1130,7 +1131,7 @@ std::string Repository::findCommonAncestor(const std::string& hash1, const std::
             }
         }
     }
-    return "";
+    return ObjectId();
 }
 
 void Repository::addRemote(const std::string& name, const std::string& path) {
@@ -1144,44 +1145,49 @@ void Repository::rmRemote(const std::string& name) {
 }
 
 
-//From the local repository's object database, identify all Commit objects and their associated Blob objects that trace upwards from end_hash up to,
-//but not including, start_hash, and copy these objects to the specified remote repository path (remote_gitlite_path).
+//From the local repository's object database, identify all Commit objects and their associated Blob objects reachable
+//from end_hash but not from the remote_has boundary, and copy these objects to the remote repository path (remote_gitlite_path).
+//Only blobs that differ from the parent commits are enumerated.
 void Repository::traverseAndCopy(
-    const std::string& start_hash,
-    const std::string& end_hash,
+    const std::unordered_set<ObjectId>& remote_has,
+    const ObjectId& end_hash,
     ObjectDatabase& local_db,
     const std::string& remote_gitlite_path
 ) {
-    std::queue<std::string> q;
-    std::unordered_set<std::string> visited;
-
-    q.push(end_hash);
-    visited.insert(end_hash);
-
-    while (!q.empty()) {
-        std::string current_hash = q.front();
-        q.pop();
-
-        if (current_hash == start_hash) {
-            continue;
-        }
-
-        local_db.copyToRemote(current_hash, remote_gitlite_path);
-
-        std::shared_ptr<Commit> commit = std::dynamic_pointer_cast<Commit>(local_db.readObject(current_hash));
-        if (!commit) continue;
-
-        for (const auto& pair : commit->getBlobs()) {
-            local_db.copyToRemote(pair.second, remote_gitlite_path);
-        }
+    ObjectDatabase remote_db(remote_gitlite_path);
+
+    PackBuilder pack(local_db);
+    TransferEngine engine(
+        [&local_db](const ObjectId& oid) {
+            return std::dynamic_pointer_cast<Commit>(local_db.readObject(oid));
+        },
+        [&pack, &remote_db](const ObjectId& oid) -> size_t {
+            return remote_db.hasObject(oid) ? 0 : pack.add(oid);
+        });
+    //everything reachable from a boundary commit is on the remote. the remote store only
+    //ever holds commits with complete history, so a commit it has ends the walk as well
+    //(this also covers merges whose second parent goes behind the remote tip)
+    engine.setStopPredicate([&remote_has, &remote_db](const ObjectId& oid) {
+        return remote_has.count(oid) > 0 || remote_db.hasObject(oid);
+    });
+
+    TransferStats stats = engine.run(end_hash);
+    sendPack(pack, remote_db);
+    TransferEngine::report("push", stats);
+}
 
-        for (const std::string& parent_hash : commit->getFatherCommits()) {
-            if (visited.find(parent_hash) == visited.end()) {
-                visited.insert(parent_hash);
-                q.push(parent_hash);
-            }
-        }
+//stream collected objects into DEST as a single pack
+void Repository::sendPack(PackBuilder& pack, ObjectDatabase& dest) {
+    if (pack.size() == 0) {
+        return;
     }
+    Trace::Phase phase("transfer.send-pack");
+    PackReceiver receiver(dest);
+    pack.writeTo([&receiver](const char* data, size_t len) {
+        receiver.feed(data, len);
+    });
+    receiver.finish();
+    dest.repack(ObjectDatabase::AUTO_REPACK_PACKS);
 }
 
 void Repository::push(const std::string& remoteName, const std::string& remoteBranchName) {
@@ -1189,54 +1195,76 @@ void Repository::push(const std::string& remoteName, const std::string& remoteBr
     RefManager localRefManager;
 
     std::string remote_path = remoteManager.getRemotePath(remoteName);
+    if (DaemonClient::isDaemonUrl(remote_path)) {
+        pushToDaemon(remoteName, remote_path, remoteBranchName);
+        return;
+    }
     if (remote_path.empty() || !Utils::exists(remote_path)) {
         Utils::exitWithMessage("Remote directory not found.");
     }
 
-    RemoteRefManager remoteRefManager(remote_path);
-    ObjectDatabase localDB;
+    ObjectDatabase& localDB = objects;
 
-    std::string local_hash = localRefManager.resolveHead();
+    ObjectId local_hash = localRefManager.resolveHead();
     std::string remote_ref_name = "refs/heads/" + remoteBranchName;
-    std::string remote_hash = remoteRefManager.resolveRef(remote_ref_name);
 
-    if (remote_hash.empty()) {
-        //新建分支 (首次推送)
-        traverseAndCopy("", local_hash, localDB, remote_path);
-
-        // 在远程创建新分支并指向本地 HEAD
-        remoteRefManager.updateRef(remote_ref_name, local_hash);
-        Utils::exitWithMessage("New remote branch created and pushed.");
-        return;
+    //"remote has" boundary: remote tip + what we fetched from that remote before
+    std::unordered_set<ObjectId> remote_has;
+    for (const ObjectId& hash : localRefManager.getRemoteTrackingHashes(remoteName)) {
+        if (localDB.hasObject(hash)) {
+            remote_has.insert(hash);
+        }
     }
 
-    //Fast-Forward 检查：检查远程 HEAD 是否是本地 HEAD 的祖先
-    try {
-        localDB.readObject(remote_hash);
-    } catch (...) {
-        Utils::exitWithMessage("Please pull down remote changes before pushing.");
-        return;
-    }  //debug
-    auto ancestor= findCommonAncestor(remote_hash,local_hash);
-    if (ancestor != remote_hash)
-    {
-        Utils::exitWithMessage("Please pull down remote changes before pushing.");
-        return;
-    }
+    //the remote ref moves only if it still holds the value we checked against.
+    //if another push got in first we start over from its new tip
+    std::string outcome;
+    bool created = false;
+    for (unsigned attempt = 0;; ++attempt) {
+        RemoteRefManager remoteRefManager(remote_path);
+        ObjectId remote_hash = remoteRefManager.resolveRef(remote_ref_name);
 
-    // III. 执行 Push (Fast-Forward)
+        //Fast-Forward 检查：检查远程 HEAD 是否是本地 HEAD 的祖先
+        if (!remote_hash.isNull()) {
+            if (!localDB.hasObject(remote_hash) || findCommonAncestor(remote_hash, local_hash) != remote_hash) {
+                outcome = "Please pull down remote changes before pushing.";
+                break;
+            }
+            remote_has.insert(remote_hash);
+        }
+
+        // 复制对象：只复制 remote_hash 之后的 Commit 和 Blob (新建分支时为全部未知历史)
+        traverseAndCopy(remote_has, local_hash, localDB, remote_path);
 
-    // 复制对象：只复制 remote_hash 之后的 Commit 和 Blob
-    traverseAndCopy(remote_hash, local_hash, localDB, remote_path);
+        // 更新远程引用 (在远程创建新分支时指向本地 HEAD)
+        if (remoteRefManager.updateRef(remote_ref_name, local_hash, remote_hash)) {
+            created = remote_hash.isNull();
+            break;
+        }
+        if (attempt + 1 >= PUSH_ATTEMPTS) {
+            outcome = "Remote branch is busy, please try again.";
+            break;
+        }
+        RefTransaction::backoff(attempt);
+    }
+    TransferEngine::report("refs", RefTransaction::stats().summary());
 
-    // 更新远程引用
-    remoteRefManager.updateRef(remote_ref_name, local_hash);
+    if (!outcome.empty()) {
+        Utils::exitWithMessage(outcome);
+    }
+    if (created) {
+        Utils::message("New remote branch created and pushed.");
+    }
 }
 
 void Repository::fetch(const std::string& remoteName, const std::string& remoteBranchName) {
     RemoteManager remoteManager;
 
     std::string remote_path = remoteManager.getRemotePath(remoteName);
+    if (DaemonClient::isDaemonUrl(remote_path)) {
+        fetchFromDaemon(remoteName, remote_path, remoteBranchName);
+        return;
+    }
     if (remote_path.empty() || !Utils::exists(remote_path)) {
         Utils::exitWithMessage("Remote directory not found.");
     }
@@ -1245,50 +1273,130 @@ void Repository::fetch(const std::string& remoteName, const std::string& remoteB
     RemoteRefManager remoteRefManager(remote_path);
 
     std::string remote_ref_name = "refs/heads/" + remoteBranchName;
-    std::string remote_hash = remoteRefManager.resolveRef(remote_ref_name);
+    ObjectId remote_hash = remoteRefManager.resolveRef(remote_ref_name);
 
-    if (remote_hash.empty()) {
+    if (remote_hash.isNull()) {
         Utils::exitWithMessage("That remote does not have that branch.");
     }
 
     //复制对象 (从远程到本地)
-    std::queue<std::string> q;
-    std::unordered_set<std::string> visited;
+    ObjectDatabase& localDB = objects; // 本地数据库
+
+    PackBuilder pack(remoteDB.getDatabase());
+    TransferEngine engine(
+        [&remoteDB](const ObjectId& oid) {
+            return std::dynamic_pointer_cast<Commit>(remoteDB.readObject(oid));
+        },
+        [&pack, &localDB](const ObjectId& oid) -> size_t {
+            return localDB.hasObject(oid) ? 0 : pack.add(oid);
+        });
+    //have/want: a commit we already have comes with its whole history, stop there
+    engine.setStopPredicate([&localDB](const ObjectId& oid) {
+        return localDB.hasObject(oid);
+    });
+
+    TransferStats stats = engine.run(remote_hash);
+    sendPack(pack, localDB);
+    TransferEngine::report("fetch", stats);
 
-    q.push(remote_hash);
-    visited.insert(remote_hash);
-
-    ObjectDatabase localDB; // 本地数据库
-
-    while (!q.empty()) {
-        std::string current_hash = q.front();
-        q.pop();
+    // III. 更新本地跟踪引用
+    RefManager localRefManager;
+    std::string local_tracking_ref = "refs/remotes/" + remoteName + "/" + remoteBranchName;
 
-        remoteDB.copyToLocal(current_hash, localDB);
+    localRefManager.updateRemoteRef(remoteName, remoteBranchName, remote_hash);
+}
 
-        //读取对象以获取其关联的 Blob 和父级 Commit
-        std::shared_ptr<Commit> commit = std::dynamic_pointer_cast<Commit>(remoteDB.readObject(current_hash));
-        if (!commit) continue;
+//push over the `gitlite serve` transport: same fast-forward rules as a directory remote,
+//but refs come from the daemon's advertisement and objects travel as one pack stream
+void Repository::pushToDaemon(const std::string& remoteName, const std::string& url,
+                              const std::string& remoteBranchName) {
+    RefManager localRefManager;
+    ObjectDatabase& localDB = objects;
 
-        //复制 Commit 关联的 Blob 对象
-        for (const auto& pair : commit->getBlobs()) {
-            remoteDB.copyToLocal(pair.second, localDB);
-        }
+    try {
+        DaemonClient client(url);
+        ObjectId local_hash = localRefManager.resolveHead();
+        std::string remote_ref_name = "refs/heads/" + remoteBranchName;
+
+        //same compare-and-swap loop as a directory remote, the server does the swap
+        for (unsigned attempt = 0;; ++attempt) {
+            std::map<std::string, ObjectId> remote_refs = client.listRefs();
+            ObjectId remote_hash = remote_refs.count(remote_ref_name) ? remote_refs[remote_ref_name] : ObjectId();
+
+            if (!remote_hash.isNull()) {
+                if (!localDB.hasObject(remote_hash) || findCommonAncestor(remote_hash, local_hash) != remote_hash) {
+                    Utils::exitWithMessage("Please pull down remote changes before pushing.");
+                }
+            }
 
-        //遍历父级 Commit
-        for (const std::string& parent_hash : commit->getFatherCommits()) {
-            if (visited.find(parent_hash) == visited.end()) {
-                visited.insert(parent_hash);
-                q.push(parent_hash);
+            //"remote has" boundary: every advertised tip we know + our tracking refs of that remote
+            std::vector<ObjectId> tips = localRefManager.getRemoteTrackingHashes(remoteName);
+            for (const auto& ref : remote_refs) {
+                tips.push_back(ref.second);
+            }
+            TransferEngine::CommitReader reader = [&localDB](const ObjectId& oid) -> std::shared_ptr<Commit> {
+                if (!localDB.hasObject(oid)) return nullptr;
+                return std::dynamic_pointer_cast<Commit>(localDB.readObject(oid));
+            };
+            TransferEngine::HeaderReader header_reader = [&localDB](const ObjectId& oid) -> std::shared_ptr<const CommitHeader> {
+                if (!localDB.hasObject(oid)) return nullptr;
+                return localDB.readCommitHeader(oid);
+            };
+
+            PackBuilder pack(localDB);
+            TransferEngine engine(reader, [&pack](const ObjectId& oid) {
+                return pack.add(oid);
+            });
+            engine.setStopPredicate(TransferEngine::reachableFrom(tips, header_reader));
+            TransferStats stats = engine.run(local_hash);
+            TransferEngine::report("push", stats);
+
+            std::string error = client.push(remote_ref_name, remote_hash, local_hash, pack);
+            if (error.empty()) {
+                if (remote_hash.isNull()) {
+                    Utils::message("New remote branch created and pushed.");
+                }
+                break;
             }
+            //lost the race: look at the new tip and try again
+            if (error != DaemonClient::REF_MOVED || attempt + 1 >= PUSH_ATTEMPTS) {
+                Utils::exitWithMessage(error == DaemonClient::REF_MOVED ? "Remote branch is busy, please try again." : error);
+            }
+            RefTransaction::backoff(attempt);
         }
+    } catch (const GitliteException& e) {
+        Utils::exitWithMessage(e.what());
     }
+}
 
-    // III. 更新本地跟踪引用
+void Repository::fetchFromDaemon(const std::string& remoteName, const std::string& url,
+                                 const std::string& remoteBranchName) {
     RefManager localRefManager;
-    std::string local_tracking_ref = "refs/remotes/" + remoteName + "/" + remoteBranchName;
+    ObjectDatabase& localDB = objects;
 
-    localRefManager.updateRemoteRef(remoteName, remoteBranchName, remote_hash);
+    try {
+        DaemonClient client(url);
+        std::map<std::string, ObjectId> remote_refs = client.listRefs();
+
+        std::string remote_ref_name = "refs/heads/" + remoteBranchName;
+        if (!remote_refs.count(remote_ref_name)) {
+            Utils::exitWithMessage("That remote does not have that branch.");
+        }
+        ObjectId remote_hash = remote_refs[remote_ref_name];
+
+        if (!localDB.hasObject(remote_hash)) {
+            //haves: our branch tips and what we fetched from this remote before
+            std::vector<ObjectId> haves = localRefManager.getRemoteTrackingHashes(remoteName);
+            for (const std::string& branch : localRefManager.getAllBranchNames()) {
+                haves.push_back(localRefManager.readRef("refs/heads/" + branch));
+            }
+            client.fetch(remote_hash, haves, localDB);
+        }
+
+        localRefManager.updateRemoteRef(remoteName, remoteBranchName, remote_hash);
+    } catch (const GitliteException& e) {
+        Utils::exitWithMessage(e.what());
+    }
 }
 
 void Repository::pull(const std::string& remoteName, const std::string& remoteBranchName) {
@@ -1299,6 +1407,199 @@ void Repository::pull(const std::string& remoteName, const std::string& remoteBr
 
 
 
+//apply each commit's change on top of HEAD, one new commit per commit
+void Repository::cherryPick(const std::vector<std::string>& commitIds) {
+    replayCommits(commitIds, false);
+}
+
+//take each commit's change back out of HEAD, one revert commit per commit
+void Repository::revert(const std::vector<std::string>& commitIds) {
+    replayCommits(commitIds, true);
+}
+
+void Repository::replayCommits(const std::vector<std::string>& commitIds, bool revert) {
+    ObjectDatabase& db = objects;
+    RefManager refManager;
+    index idx;
+
+    if (!idx.getEntries().empty() || !idx.getRmEntries().empty()) {
+        Utils::exitWithMessage("You have uncommitted changes.");
+    }
+
+    // 先解析全部提交，出错时什么都还没做
+    std::vector<std::shared_ptr<Commit>> picks;
+    for (const std::string& id : commitIds) {
+        ObjectId hash = resolveCommitId(db, id);
+        auto commit = std::dynamic_pointer_cast<Commit>(db.readObject(hash));
+        if (!commit) {
+            Utils::exitWithMessage("Corrupted object: object at " + hash.abbrev() + " is not a Commit.");
+        }
+        if (commit->getFatherCommits().size() > 1) {
+            Utils::exitWithMessage("Cannot " + std::string(revert ? "revert" : "cherry-pick") + " a merge commit.");
+        }
+        picks.push_back(commit);
+    }
+
+    ObjectId headHash = refManager.resolveHead();
+    auto head = std::dynamic_pointer_cast<Commit>(db.readObject(headHash));
+    const Manifest& startBlobs = head->getBlobs();
+
+    // 逐个在内存中合并并写出提交对象；工作区最后只按总的变化写一次
+    Manifest blobs = startBlobs;
+    ObjectId tip = headHash;
+    Merge::Result conflicted;
+    size_t stoppedAt = picks.size();
+    for (size_t i = 0; i < picks.size(); ++i) {
+        const std::shared_ptr<Commit>& pick = picks[i];
+        static const Manifest NO_BLOBS;
+        std::shared_ptr<Commit> parent;
+        if (!pick->getFatherCommits().empty()) {
+            parent = std::dynamic_pointer_cast<Commit>(db.readObject(pick->getFatherCommits()[0]));
+        }
+        const Manifest& parentBlobs = parent ? parent->getBlobs() : NO_BLOBS;
+        const Manifest& pickBlobs = pick->getBlobs();
+
+        // cherry-pick: 以父提交为 base 合入该提交; revert: 以该提交为 base 合入其父提交
+        Merge::Result result = revert ? Merge::merge(db, pickBlobs, blobs, parentBlobs)
+                                      : Merge::merge(db, parentBlobs, blobs, pickBlobs);
+        if (!result.clean()) {
+            conflicted = std::move(result);
+            stoppedAt = i;
+            break;
+        }
+        if (result.changes.empty()) {
+            // 改动已经在 HEAD 中
+            continue;
+        }
+        Merge::writeObjects(db, result);
+
+        Commit newCommit;
+        newCommit.setMetadata(revert ? "Revert \"" + pick->getMessage() + "\"" : pick->getMessage(),
+                              Utils::getCurrentTimestamp());
+        newCommit.addFather(tip);
+        newCommit.getBlobsRef() = result.manifest;
+        tip = db.writeObject(newCommit);
+        blobs = std::move(result.manifest);
+    }
+
+    bool stopped = stoppedAt < picks.size();
+
+    // 工作区: 从原 HEAD 到最终结果 (冲突时含冲突标记) 变化的路径
+    std::vector<Merge::Change> changes = Merge::changesBetween(startBlobs, stopped ? conflicted.manifest : blobs);
+    if (stopped) {
+        // 冲突这一步新产生的 blob 还不在对象库中，带上内容
+        std::map<std::string, const Merge::Change*> last;
+        for (const Merge::Change& c : conflicted.changes) last[c.path] = &c;
+        for (Merge::Change& change : changes) {
+            auto it = last.find(change.path);
+            if (it != last.end() && it->second->created) change = *it->second;
+        }
+    }
+    for (const Merge::Change& change : changes) {
+        if (!change.blob.isNull() && !startBlobs.contains(change.path) && Utils::exists(change.path)) {
+            Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+        }
+    }
+
+    if (tip != headHash) {
+        refManager.updateRef("HEAD", tip, headHash);
+    }
+    Merge::writeWorktree(db, changes);
+
+    if (stopped) {
+        // 冲突的一步不提交：其结果暂存，等用户解决后自行 commit
+        Merge::stage(conflicted.changes, idx);
+        idx.write();
+        // 指明冲突的提交和未处理的提交，解决并 commit 后可以接着处理剩下的
+        std::cout << "Encountered a merge conflict." << "\n";
+        const Commit& at = *picks[stoppedAt];
+        std::cout << "Conflicting commit: " << at.get_hashid() << " " << at.getMessage() << "\n";
+        if (stoppedAt + 1 < picks.size()) {
+            std::cout << "Not applied:" << "\n";
+            for (size_t i = stoppedAt + 1; i < picks.size(); ++i) {
+                std::cout << "  " << picks[i]->get_hashid() << " " << picks[i]->getMessage() << "\n";
+            }
+        }
+        std::cout << std::flush;
+    }
+}
+
+void Repository::mergeTree(const std::string& oursId, const std::string& theirsId) {
+    ObjectDatabase& db = objects;
+    auto readCommit = [&db](const std::string& prefix) {
+        ObjectId hash = resolveCommitId(db, prefix);
+        auto commit = std::dynamic_pointer_cast<Commit>(db.readObject(hash));
+        if (!commit) {
+            Utils::exitWithMessage("Corrupted object: object at " + hash.abbrev() + " is not a Commit.");
+        }
+        return commit;
+    };
+    std::shared_ptr<Commit> ours = readCommit(oursId);
+    std::shared_ptr<Commit> theirs = readCommit(theirsId);
+    std::shared_ptr<Commit> base = readCommit(findCommonAncestor(ours->get_hashid(), theirs->get_hashid()).hex());
+
+    Merge::Result result = Merge::merge(db, base->getBlobs(), ours->getBlobs(), theirs->getBlobs());
+    Merge::writeObjects(db, result);
+
+    // 相对 <ours> 的变化: M 修改/新增, D 删除, C 冲突 (blob 中含冲突标记)
+    for (const Merge::Change& change : result.changes) {
+        if (change.blob.isNull()) {
+            std::cout << "D " << change.path << "\n";
+        } else {
+            std::cout << (change.conflict ? "C " : "M ") << change.blob << " " << change.path << "\n";
+        }
+    }
+}
+
+//plumbing: print the blob id of FILE, and store the blob with -w.
+//safe to run from many processes against one repository
+void Repository::hashObject(const std::string& file, bool write) {
+    if (!Utils::isFile(file)) {
+        Utils::exitWithMessage("File does not exist.");
+    }
+    Blob blob(Utils::readContentsAsString(file));
+    ObjectId oid;
+    if (write) {
+        ObjectDatabase& db = objects;
+        oid = db.writeObject(blob);
+    } else {
+        oid = ObjectId::hashOf(blob.serialize());
+    }
+    std::cout << oid << "\n";
+}
+
+void Repository::packRefs() {
+    RefManager refManager;
+    refManager.packRefs();
+}
+
+void Repository::repack() {
+    objects.repack();
+}
+
+void Repository::writeCommitGraph() {
+    RefManager refManager;
+    std::vector<ObjectId> tips;
+    tips.push_back(refManager.resolveHead());
+    for (const std::string& branch : refManager.getAllBranchNames()) {
+        tips.push_back(refManager.readRef("refs/heads/" + branch));
+    }
+    CommitGraph graph;
+    graph.write(objects, tips);
+}
+
+void Repository::serve(const std::string& socketPath) {
+    try {
+        if (socketPath.empty()) {
+            DaemonServer::serveStdio();
+        } else {
+            DaemonServer::serveSocket(socketPath);
+        }
+    } catch (const GitliteException& e) {
+        Utils::exitWithMessage(e.what());
+    }
+}
+
 std::string  Repository::getGitliteDir() {
     std::string _path = ".gitlite";
     return _path;
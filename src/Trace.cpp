@@ -0,0 +1,155 @@
+#include "Trace.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
+
+namespace {
+    const char* COUNTER_NAMES[Trace::COUNTER_COUNT] = {
+        "objects_read",
+        "objects_written",
+        "object_bytes_read",
+        "object_bytes_written",
+        "object_cache_hits",
+        "index_cache_hits",
+        "bytes_hashed",
+        "files_read",
+        "files_written",
+        "file_bytes_read",
+        "file_bytes_written",
+        "stat_calls",
+        "readdir_calls",
+        "fsync_calls",
+        "bloom_checks",
+        "bloom_negatives",
+    };
+
+    struct PhaseTotal {
+        std::chrono::steady_clock::duration elapsed{0};
+        uint64_t count = 0;
+    };
+
+    std::mutex phase_mtx;
+    std::map<std::string, PhaseTotal> phases;
+
+    //absolute, so a command that changes directory still finds it
+    const std::string& tracePath() {
+        static std::string path = [] {
+            const char* env = std::getenv("GITLITE_TRACE");
+            std::string value = env ? env : "";
+            if (value.empty() || value == "0") return std::string();
+            if (value[0] != '/') {
+                char cwd[4096];
+                if (getcwd(cwd, sizeof(cwd))) value = std::string(cwd) + "/" + value;
+            }
+            return value;
+        }();
+        return path;
+    }
+
+    std::string quote(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        return out + "\"";
+    }
+
+    double ms(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    void reset() {
+        for (auto& c : Trace::detail::counters) c.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(phase_mtx);
+        phases.clear();
+    }
+
+    //one write(2) with O_APPEND: lines from concurrent processes do not mix
+    void appendLine(const std::string& line) {
+        int fd = ::open(tracePath().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (fd < 0) return;
+        ssize_t n = ::write(fd, line.data(), line.size());
+        (void) n;
+        ::close(fd);
+    }
+}
+
+namespace Trace {
+    namespace detail {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        bool on = !tracePath().empty();
+
+        void addPhase(const char* name, std::chrono::steady_clock::duration elapsed) {
+            std::lock_guard<std::mutex> lock(phase_mtx);
+            PhaseTotal& total = phases[name];
+            total.elapsed += elapsed;
+            total.count++;
+        }
+    }
+
+    Command::Command(const std::vector<std::string>& command_args) : active(detail::on) {
+        if (!active) return;
+        args = command_args;
+        reset();
+        start = std::chrono::steady_clock::now();
+    }
+
+    void Command::fail(const std::string& message) {
+        error = message;
+    }
+
+    Command::~Command() {
+        if (!active) return;
+        double wall = ms(std::chrono::steady_clock::now() - start);
+
+        std::ostringstream line;
+        line.setf(std::ios::fixed);
+        line.precision(3);
+        line << "{\"pid\": " << getpid()
+             << ", \"cmd\": " << quote(args.empty() ? "" : args[0]) << ", \"args\": [";
+        for (size_t i = 1; i < args.size(); ++i) {
+            line << (i > 1 ? ", " : "") << quote(args[i]);
+        }
+        line << "], \"ok\": " << (error.empty() ? "true" : "false");
+        if (!error.empty()) {
+            line << ", \"error\": " << quote(error);
+        }
+        line << ", \"wall_ms\": " << wall << ", \"phases\": {";
+        {
+            std::lock_guard<std::mutex> lock(phase_mtx);
+            bool first = true;
+            for (const auto& p : phases) {
+                line << (first ? "" : ", ") << quote(p.first) << ": {\"ms\": " << ms(p.second.elapsed)
+                     << ", \"count\": " << p.second.count << "}";
+                first = false;
+            }
+        }
+        line << "}, \"counters\": {";
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            line << (c ? ", " : "") << quote(COUNTER_NAMES[c]) << ": "
+                 << detail::counters[c].load(std::memory_order_relaxed);
+        }
+        line << "}}\n";
+
+        appendLine(line.str());
+        reset();
+    }
+}
@@ -0,0 +1,311 @@
+#include "TransferEngine.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Trace.hpp"
+#include "WorkerPool.hpp"
+
+namespace {
+    //what the traversal found out about one commit that must be sent
+    struct PendingCommit {
+        ObjectId oid;
+        std::vector<ObjectId> parents;
+        std::vector<ObjectId> new_blobs;  //blobs no parent already has at that path
+    };
+
+    //hand-off between the traversal thread and the enumeration stage
+    class CommitChannel {
+    private:
+        std::deque<PendingCommit> items;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool closed = false;
+
+    public:
+        void push(PendingCommit c) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                items.push_back(std::move(c));
+            }
+            cv.notify_one();
+        }
+
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                closed = true;
+            }
+            cv.notify_all();
+        }
+
+        //returns false once closed and drained
+        bool pop(PendingCommit& out) {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty()) return false;
+            out = std::move(items.front());
+            items.pop_front();
+            return true;
+        }
+    };
+
+    //blobs of COMMIT that differ from every parent at the same path.
+    //a blob shared with a parent is either on the destination already (parent is
+    //behind the boundary) or gets sent with that parent, so it can be skipped.
+    //manifests are sorted arrays, so this is a linear merge-join per parent
+    std::vector<ObjectId> blobsNotInParents(const Commit& commit,
+                                            const std::vector<std::shared_ptr<Commit>>& parents) {
+        std::vector<ObjectId> result;
+        const auto& blobs = commit.getBlobs();
+        if (parents.empty()) {
+            for (const Manifest::Entry& e : blobs) result.push_back(e.blob);
+            return result;
+        }
+
+        std::vector<Manifest::const_iterator> cursors;
+        for (const auto& p : parents) cursors.push_back(p->getBlobs().begin());
+
+        for (const Manifest::Entry& e : blobs) {
+            bool shared = false;
+            for (size_t i = 0; i < parents.size(); ++i) {
+                const Manifest& pblobs = parents[i]->getBlobs();
+                auto& it = cursors[i];
+                while (it != pblobs.end() && it->path < e.path) ++it;
+                if (it != pblobs.end() && it->path == e.path && it->blob == e.blob) {
+                    shared = true;
+                }
+            }
+            if (!shared) result.push_back(e.blob);
+        }
+        return result;
+    }
+}
+
+double TransferStats::objectsPerSec() const {
+    return seconds > 0 ? objects / seconds : 0;
+}
+
+double TransferStats::bytesPerSec() const {
+    return seconds > 0 ? bytes / seconds : 0;
+}
+
+std::string TransferStats::summary() const {
+    std::stringstream ss;
+    ss << commits << " commits, " << objects << " objects, " << bytes << " bytes in "
+       << seconds << "s (" << static_cast<long long>(objectsPerSec()) << " objects/s, "
+       << static_cast<long long>(bytesPerSec()) << " bytes/s)";
+    return ss.str();
+}
+
+//a destination store must never hold a commit whose parents or blobs are missing:
+//negotiation treats any commit already present as a complete history.
+//so commits are written last, and every parent before its children
+std::vector<ObjectId> TransferEngine::orderParentsFirst(
+    const std::vector<std::pair<ObjectId, std::vector<ObjectId>>>& commits) {
+    std::unordered_map<ObjectId, const std::vector<ObjectId>*> parents_of;
+    for (const auto& c : commits) {
+        parents_of[c.first] = &c.second;
+    }
+
+    std::vector<ObjectId> order;
+    std::unordered_set<ObjectId> emitted;
+    //iterative post-order dfs: (oid, index of next parent to visit)
+    std::vector<std::pair<ObjectId, size_t>> stack;
+    for (const auto& c : commits) {
+        if (emitted.count(c.first)) continue;
+        stack.emplace_back(c.first, 0);
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            const std::vector<ObjectId>& parents = *parents_of[top.first];
+            if (top.second < parents.size()) {
+                const ObjectId& parent = parents[top.second++];
+                if (parents_of.count(parent) && !emitted.count(parent)) {
+                    stack.emplace_back(parent, 0);
+                }
+                continue;
+            }
+            if (emitted.insert(top.first).second) {
+                order.push_back(top.first);
+            }
+            stack.pop_back();
+        }
+    }
+    return order;
+}
+
+TransferEngine::StopPredicate TransferEngine::reachableFrom(const std::vector<ObjectId>& tips,
+                                                            HeaderReader reader, size_t steps) {
+    //BFS over the ancestors of TIPS, advanced a little on every call.
+    //only the traversal thread calls a stop predicate, no locking needed
+    struct Walk {
+        HeaderReader read;
+        std::unordered_set<ObjectId> seen;
+        std::queue<ObjectId> q;
+    };
+    auto walk = std::make_shared<Walk>();
+    walk->read = std::move(reader);
+    for (const ObjectId& tip : tips) {
+        if (!tip.isNull() && walk->seen.insert(tip).second) walk->q.push(tip);
+    }
+
+    return [walk, steps](const ObjectId& oid) {
+        for (size_t i = 0; i < steps && !walk->q.empty(); ++i) {
+            std::shared_ptr<const CommitHeader> commit = walk->read(walk->q.front());
+            walk->q.pop();
+            if (!commit) continue;
+            for (const ObjectId& parent : commit->parents) {
+                if (walk->seen.insert(parent).second) walk->q.push(parent);
+            }
+        }
+        return walk->seen.count(oid) > 0;
+    };
+}
+
+TransferEngine::TransferEngine(CommitReader reader, ObjectCopier copier, unsigned workers)
+    : read_commit(std::move(reader)), copy_object(std::move(copier)), worker_count(workers) {
+}
+
+TransferStats TransferEngine::run(const ObjectId& tip) {
+    Trace::Phase phase("transfer.walk");
+    auto start = std::chrono::steady_clock::now();
+    TransferStats stats;
+    if (tip.isNull()) {
+        return stats;
+    }
+
+    CommitChannel channel;
+    std::exception_ptr traversal_error;
+    std::atomic<size_t> objects(0);
+    std::atomic<size_t> bytes(0);
+
+    //stage 1: BFS over the commit graph
+    std::thread traversal([&] {
+        try {
+            std::queue<ObjectId> q;
+            std::unordered_set<ObjectId> visited;
+            //commits read ahead as somebody's parent; dropped once dequeued
+            std::unordered_map<ObjectId, std::shared_ptr<Commit>> read_ahead;
+            q.push(tip);
+            visited.insert(tip);
+
+            auto fetchCommit = [&](const ObjectId& oid, bool keep) {
+                auto it = read_ahead.find(oid);
+                if (it != read_ahead.end()) {
+                    std::shared_ptr<Commit> c = it->second;
+                    if (!keep) read_ahead.erase(it);
+                    return c;
+                }
+                std::shared_ptr<Commit> c = read_commit(oid);
+                if (keep && c) read_ahead[oid] = c;
+                return c;
+            };
+
+            while (!q.empty()) {
+                ObjectId current_hash = q.front();
+                q.pop();
+
+                if (stop_at && stop_at(current_hash)) {
+                    continue;
+                }
+
+                std::shared_ptr<Commit> commit = fetchCommit(current_hash, false);
+                if (!commit) continue;
+
+                PendingCommit pending;
+                pending.oid = current_hash;
+                pending.parents = commit->getFatherCommits();
+
+                std::vector<std::shared_ptr<Commit>> parents;
+                for (const ObjectId& parent_hash : pending.parents) {
+                    if (visited.insert(parent_hash).second) {
+                        q.push(parent_hash);
+                    }
+                    std::shared_ptr<Commit> parent = fetchCommit(parent_hash, true);
+                    if (parent) parents.push_back(parent);
+                }
+                if (parents.size() == pending.parents.size()) {
+                    pending.new_blobs = blobsNotInParents(*commit, parents);
+                } else {
+                    //a parent could not be read: send the full manifest
+                    pending.new_blobs = blobsNotInParents(*commit, {});
+                }
+                channel.push(std::move(pending));
+            }
+        } catch (...) {
+            traversal_error = std::current_exception();
+        }
+        channel.close();
+    });
+
+    //stage 2 + 3: enumerate, dedup and hand objects to the copy workers
+    WorkerPool pool(worker_count);
+    std::unordered_set<ObjectId> scheduled;
+    auto schedule = [&](const ObjectId& oid) {
+        if (!scheduled.insert(oid).second) return;
+        pool.submit([&, oid] {
+            size_t written = copy_object(oid);
+            if (written > 0) {
+                ++objects;
+                bytes += written;
+            }
+        });
+    };
+
+    //commits are held back until every blob landed, see orderParentsFirst
+    std::vector<std::pair<ObjectId, std::vector<ObjectId>>> new_commits;
+
+    try {
+        PendingCommit pending;
+        while (channel.pop(pending)) {
+            ++stats.commits;
+            for (const ObjectId& blob : pending.new_blobs) {
+                schedule(blob);
+            }
+            new_commits.emplace_back(std::move(pending.oid), std::move(pending.parents));
+        }
+        pool.wait();
+    } catch (...) {
+        traversal.join();
+        throw;
+    }
+    traversal.join();
+
+    if (traversal_error) {
+        std::rethrow_exception(traversal_error);
+    }
+
+    for (const ObjectId& oid : orderParentsFirst(new_commits)) {
+        size_t written = copy_object(oid);
+        if (written > 0) {
+            ++objects;
+            bytes += written;
+        }
+    }
+
+    stats.objects = objects;
+    stats.bytes = bytes;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void TransferEngine::report(const std::string& what, const TransferStats& stats) {
+    report(what, stats.summary());
+}
+
+void TransferEngine::report(const std::string& what, const std::string& summary) {
+    if (std::getenv("GITLITE_TRANSFER_STATS") == nullptr) {
+        return;
+    }
+    std::cerr << what << ": " << summary << std::endl;
+}
@@ -1,10 +1,18 @@
 #include "../include/Utils.h"
+#include "../include/GitliteException.h"
+#include "../include/Trace.hpp"
 
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <sys/stat.h>
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unistd.h>
 
 /** Assorted utilities.
  *
@@ -83,6 +91,7 @@ namespace SHA1 {
     }
     
     std::string SHA::sha(std::string message) {
+        Trace::count(Trace::BYTES_HASHED, message.size());
         reset();
         message = padding(message);
         int byteLength = message.length();
@@ -114,9 +123,112 @@ namespace SHA1 {
     }
     
     SHA sha;
-    
+
+    Hasher::Hasher() : h{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0},
+                       block_len(0), total_len(0) {
+    }
+
+    void Hasher::compress(const unsigned char* chunk) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t(chunk[4 * i]) << 24) | (uint32_t(chunk[4 * i + 1]) << 16) |
+                   (uint32_t(chunk[4 * i + 2]) << 8) | uint32_t(chunk[4 * i + 3]);
+        }
+        for (int i = 16; i < 80; i++) {
+            uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (x << 1) | (x >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int t = 0; t < 80; t++) {
+            uint32_t f, k;
+            if (t < 20) {
+                f = (b & c) | ((~b) & d);
+                k = 0x5a827999;
+            } else if (t < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (t < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t temp = ((a << 5) | (a >> 27)) + f + e + k + w[t];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    void Hasher::update(const char* data, size_t len) {
+        Trace::count(Trace::BYTES_HASHED, len);
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        total_len += len;
+        if (block_len > 0) {
+            size_t take = std::min(len, sizeof(block) - block_len);
+            std::memcpy(block + block_len, p, take);
+            block_len += take;
+            p += take;
+            len -= take;
+            if (block_len < sizeof(block)) return;
+            compress(block);
+            block_len = 0;
+        }
+        while (len >= 64) {
+            compress(p);
+            p += 64;
+            len -= 64;
+        }
+        std::memcpy(block, p, len);
+        block_len = len;
+    }
+
+    void Hasher::digest(unsigned char out[20]) {
+        uint64_t bit_len = total_len * 8;
+        unsigned char pad[72] = {0x80};
+        size_t pad_len = (block_len < 56) ? (56 - block_len) : (120 - block_len);
+        if (block_len == 56) {
+            //SHA::padding() sizes the message as ceil((len + 8) / 64) blocks, so when
+            //len % 64 == 56 the length field overwrites the 0x80 marker. every object id
+            //ever written went through that code, keep producing the same ids
+            pad_len = 0;
+        }
+        for (int i = 0; i < 8; i++) {
+            pad[pad_len + i] = static_cast<unsigned char>(bit_len >> (56 - 8 * i));
+        }
+        update(reinterpret_cast<const char*>(pad), pad_len + 8);
+
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 4; j++) {
+                out[i * 4 + j] = static_cast<unsigned char>(h[i] >> (24 - 8 * j));
+            }
+        }
+    }
+
+    std::string Hasher::hexdigest() {
+        unsigned char raw[20];
+        digest(raw);
+        static const char* hex = "0123456789abcdef";
+        std::string out(40, '0');
+        for (int i = 0; i < 20; i++) {
+            out[2 * i] = hex[raw[i] >> 4];
+            out[2 * i + 1] = hex[raw[i] & 0xf];
+        }
+        return out;
+    }
+
     std::string sha1(std::string message) {
-        return sha.sha(message);
+        Hasher hasher;
+        hasher.update(message);
+        return hasher.hexdigest();
     }
     
     std::string sha1(std::string s1, std::string s2) {
@@ -153,7 +265,7 @@ std::string Utils::sha1(const std::vector<unsigned char>& data) {
 /* FILE DELETION */
 /** Deletes FILE if it exists and is not a directory.  Returns true
 *  if FILE was deleted, and false otherwise.  Refuses to delete FILE
-*  and throws IllegalArgumentException unless the directory designated by
+*  and throws GitliteException unless the directory designated by
 *  FILE also contains a directory named .gitlite. */
 bool Utils::restrictedDelete(const std::string& filepath) {
     // Extract parent directory
@@ -162,7 +274,7 @@ bool Utils::restrictedDelete(const std::string& filepath) {
     std::string gitliteDir = parentDir + "/.gitlite";
 
     // if (!isDirectory(gitliteDir)) {
-    //     throw std::invalid_argument("not .gitlite working directory");
+    //     throw GitliteException("not .gitlite working directory");
     // }
     
     if (isFile(filepath)) {
@@ -173,16 +285,16 @@ bool Utils::restrictedDelete(const std::string& filepath) {
 
  /* READING AND WRITING FILE CONTENTS */
 /** Return the entire contents of FILE as a byte array.  FILE must
- *  be a normal file.  Throws IllegalArgumentException
+ *  be a normal file.  Throws GitliteException
  *  in case of problems. */
 std::vector<unsigned char> Utils::readContents(const std::string& filepath) {
     if (!isFile(filepath)) {
-        throw std::invalid_argument("must be a normal file");
+        throw GitliteException("must be a normal file: " + filepath);
     }
     
     std::ifstream file(filepath, std::ios::binary);
     if (!file.is_open()) {
-        throw std::invalid_argument("cannot open file");
+        throw GitliteException("cannot open file: " + filepath);
     }
     
     file.seekg(0, std::ios::end);
@@ -191,52 +303,207 @@ std::vector<unsigned char> Utils::readContents(const std::string& filepath) {
     
     std::vector<unsigned char> contents(size);
     file.read(reinterpret_cast<char*>(contents.data()), size);
+    Trace::count(Trace::FILES_READ);
+    Trace::count(Trace::FILE_BYTES_READ, size);
     
     return contents;
 }
 
 /** Return the entire contents of FILE as a String.  FILE must
- *  be a normal file.  Throws IllegalArgumentException
+ *  be a normal file.  Throws GitliteException
  *  in case of problems. */
 std::string Utils::readContentsAsString(const std::string& filepath) {
     auto contents = readContents(filepath);
     return std::string(contents.begin(), contents.end());
 }
 
-/** Write the result of concatenating the bytes in CONTENTS to FILE,
- *  creating or overwriting it as needed.  Each object in CONTENTS may be
- *  either a String or a byte array.  Throws IllegalArgumentException
- *  in case of problems. */
-void Utils::writeContents(const std::string& filepath, const std::string& content) {
-    // Create parent directories if needed
-    size_t pos = filepath.find_last_of("/\\");
-    if (pos != std::string::npos) {
-        std::string parentDir = filepath.substr(0, pos);
-        createDirectories(parentDir);
+/* DURABILITY */
+
+namespace {
+    //renamed repository files that are not durable yet, and their directories.
+    //objects are kept apart: they must be on disk before any ref or index naming them.
+    //worker pool tasks commit files concurrently: the lists are only touched under
+    //MTX, and FLUSH_MTX is held for a whole sync so a caller returns only after
+    //everything registered before it is on disk, even if another thread took the list
+    struct PendingSync {
+        std::mutex mtx;
+        std::mutex flush_mtx;
+        std::vector<std::string> object_files;
+        std::set<std::string> object_dirs;
+        std::vector<std::string> other_files;
+        std::set<std::string> other_dirs;
+
+        ~PendingSync() {
+            try {
+                Utils::syncPendingWrites();
+            } catch (...) {
+            }
+        }
+    };
+
+    PendingSync& pending() {
+        static PendingSync p;
+        return p;
     }
-    
-    std::ofstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::invalid_argument("cannot create file");
+
+    std::string parentOf(const std::string& path) {
+        size_t pos = path.find_last_of("/\\");
+        if (pos == std::string::npos) return ".";
+        if (pos == 0) return "/";
+        return path.substr(0, pos);
+    }
+
+    enum class FileKind { Object, Repository, Worktree };
+
+    //by location: anything under a .gitlite directory is repository data, the
+    //objects/ directory right below it holds objects, everything else is worktree
+    FileKind kindOf(const std::string& path) {
+        static const std::string DIR = ".gitlite/";
+        size_t at = path.compare(0, DIR.size(), DIR) == 0 ? 0 : path.find("/" + DIR);
+        if (at == std::string::npos) return FileKind::Worktree;
+        size_t inside = at == 0 ? DIR.size() : at + 1 + DIR.size();
+        return path.compare(inside, 8, "objects/") == 0 ? FileKind::Object : FileKind::Repository;
+    }
+
+    void fsyncPath(const std::string& path, bool directory) {
+        int fd = ::open(path.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+        if (fd < 0) return;
+        Trace::count(Trace::FSYNC_CALLS);
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    //only our own files: their writeback was started when they were written, so
+    //each fsync mostly waits for I/O already under way. then each directory once
+    void syncFiles(const std::vector<std::string>& files, const std::set<std::string>& dirs) {
+        for (const std::string& file : files) fsyncPath(file, false);
+        for (const std::string& dir : dirs) fsyncPath(dir, true);
+    }
+
+    void writeAll(const std::string& filepath, const char* data, size_t len) {
+        Trace::count(Trace::FILES_WRITTEN);
+        Trace::count(Trace::FILE_BYTES_WRITTEN, len);
+        // Create parent directories if needed
+        size_t pos = filepath.find_last_of("/\\");
+        if (pos != std::string::npos) {
+            std::string parentDir = filepath.substr(0, pos);
+            Utils::createDirectories(parentDir);
+        }
+
+        //unique per process and per call: concurrent writers of the same file
+        //(two processes storing one object, or two threads) never share a temp file
+        static std::atomic<unsigned long> counter(0);
+        std::string tmp;
+        int fd = -1;
+        for (int tries = 0; fd < 0 && tries < 100; ++tries) {
+            tmp = filepath + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+            fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+            if (fd < 0 && errno != EEXIST) break;
+        }
+        if (fd < 0) {
+            throw GitliteException("cannot create file: " + filepath);
+        }
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ::close(fd);
+                std::remove(tmp.c_str());
+                throw GitliteException("cannot write file: " + filepath);
+            }
+            data += n;
+            len -= n;
+        }
+        if (Utils::fsyncMode() == Utils::FsyncMode::Strict) {
+            Trace::count(Trace::FSYNC_CALLS);
+            ::fsync(fd);
+        }
+#ifdef __linux__
+        else if (Utils::fsyncMode() == Utils::FsyncMode::Batched && kindOf(filepath) != FileKind::Worktree) {
+            //start writeback now, the fsync at the sync point then finds little left to do
+            ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+#endif
+        ::close(fd);
+        Utils::commitFile(tmp, filepath);
     }
-    
-    file.write(content.c_str(), content.size());
 }
 
-void Utils::writeContents(const std::string& filepath, const std::vector<unsigned char>& content) {
-    // Create parent directories if needed
-    size_t pos = filepath.find_last_of("/\\");
-    if (pos != std::string::npos) {
-        std::string parentDir = filepath.substr(0, pos);
-        createDirectories(parentDir);
+Utils::FsyncMode Utils::fsyncMode() {
+    static FsyncMode mode = [] {
+        const char* env = std::getenv("GITLITE_FSYNC");
+        std::string value = env ? env : "";
+        if (value == "none") return FsyncMode::None;
+        if (value == "strict") return FsyncMode::Strict;
+        return FsyncMode::Batched;
+    }();
+    return mode;
+}
+
+void Utils::commitFile(const std::string& tmpPath, const std::string& filepath) {
+    FsyncMode mode = fsyncMode();
+    FileKind kind = kindOf(filepath);
+
+    //a ref or the index may point at objects written just before: those go first
+    if (mode == FsyncMode::Batched && kind == FileKind::Repository) {
+        PendingSync& p = pending();
+        bool objects_pending;
+        {
+            std::lock_guard<std::mutex> lock(p.mtx);
+            objects_pending = !p.object_files.empty();
+        }
+        if (objects_pending) syncPendingWrites();
     }
-    
-    std::ofstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::invalid_argument("cannot create file");
+    if (mode == FsyncMode::Strict) {
+        fsyncPath(tmpPath, false);
     }
-    
-    file.write(reinterpret_cast<const char*>(content.data()), content.size());
+
+    if (std::rename(tmpPath.c_str(), filepath.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw GitliteException("cannot create file: " + filepath);
+    }
+
+    if (mode == FsyncMode::Strict) {
+        fsyncPath(parentOf(filepath), true);
+    } else if (mode == FsyncMode::Batched && kind != FileKind::Worktree) {
+        //worktree files are not synced in batched mode, like git
+        PendingSync& p = pending();
+        bool object = kind == FileKind::Object;
+        std::lock_guard<std::mutex> lock(p.mtx);
+        (object ? p.object_files : p.other_files).push_back(filepath);
+        (object ? p.object_dirs : p.other_dirs).insert(parentOf(filepath));
+    }
+}
+
+void Utils::syncPendingWrites() {
+    PendingSync& p = pending();
+    std::lock_guard<std::mutex> flush(p.flush_mtx);
+    std::vector<std::string> files;
+    std::set<std::string> dirs;
+    {
+        //take the lists, then sync without blocking writers that register more
+        std::lock_guard<std::mutex> lock(p.mtx);
+        if (p.object_files.empty() && p.other_files.empty()) return;
+        files.swap(p.object_files);
+        files.insert(files.end(), p.other_files.begin(), p.other_files.end());
+        dirs.swap(p.object_dirs);
+        dirs.insert(p.other_dirs.begin(), p.other_dirs.end());
+        p.other_files.clear();
+        p.other_dirs.clear();
+    }
+    syncFiles(files, dirs);
+}
+
+/** Write the result of concatenating the bytes in CONTENTS to FILE,
+ *  creating or overwriting it as needed. The bytes go to a temporary
+ *  file first which then replaces FILE, so readers never see a partial
+ *  file.  Throws GitliteException in case of problems. */
+void Utils::writeContents(const std::string& filepath, const std::string& content) {
+    writeAll(filepath, content.data(), content.size());
+}
+
+void Utils::writeContents(const std::string& filepath, const std::vector<unsigned char>& content) {
+    writeAll(filepath, reinterpret_cast<const char*>(content.data()), content.size());
 }
 
 /** Returns a list of the names of all plain files in the directory DIR, in
@@ -251,7 +518,7 @@ std::vector<std::string> Utils::plainFilenamesIn(const std::string& dirPath) {
     }
     
     struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) {
+    while (Trace::count(Trace::READDIR_CALLS), (entry = readdir(dir)) != nullptr) {
         if (entry->d_type == DT_REG || entry->d_type == DT_DIR) { // Regular file
             if (std::string(entry->d_name) != "." && std::string(entry->d_name) != "..")
                 files.push_back(std::string(entry->d_name));
@@ -292,19 +559,22 @@ void Utils::message(const std::string& msg) {
     std::cout << msg << std::endl;
 }
 
+/** Abort the current command with MSG. The CLI prints it and exits,
+ *  `gitlite batch` reports it and goes on with the next command. */
 void Utils::exitWithMessage(const std::string& msg) {
-    message(msg);
-    std::exit(0);
+    throw GitliteException(msg);
 }
 
 /** Returns true if PATH exists as a file or directory. */
 bool Utils::exists(const std::string& path) {
+    Trace::count(Trace::STAT_CALLS);
     struct stat buffer;
     return (stat(path.c_str(), &buffer) == 0);
 }
 
 /** Returns true if PATH exists and is a regular file. */
 bool Utils::isFile(const std::string& path) {
+    Trace::count(Trace::STAT_CALLS);
     struct stat buffer;
     if (stat(path.c_str(), &buffer) != 0) {
         return false;
@@ -314,6 +584,7 @@ bool Utils::isFile(const std::string& path) {
 
 /** Returns true if PATH exists and is a directory. */
 bool Utils::isDirectory(const std::string& path) {
+    Trace::count(Trace::STAT_CALLS);
     struct stat buffer;
     if (stat(path.c_str(), &buffer) != 0) {
         return false;
@@ -348,7 +619,7 @@ std::string Utils::getCurrentTimestamp() {
 
     struct tm *lt = std::localtime(&now_c);
     if (!lt) {
-        throw std::runtime_error("Could not get local time.");
+        throw GitliteException("Could not get local time.");
     }
 
 
@@ -356,7 +627,7 @@ std::string Utils::getCurrentTimestamp() {
     // 格式化为 "Day Mon DD HH:MM:SS YYYY "
     // %a: Day, %b: Mon, %d: DD, %H: HH, %M: MM, %S: SS, %Y: YYYY
     if (std::strftime(date_buffer, sizeof(date_buffer), "%a %b %d %H:%M:%S %Y", lt) == 0) {
-        throw std::runtime_error("Failed to format time.");
+        throw GitliteException("Failed to format time.");
     }
 
     // **获取时区偏移量 (TimeZone Offset)**
@@ -0,0 +1,86 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+WorkerPool::WorkerPool(unsigned threads) {
+    if (threads == 0) {
+        threads = defaultThreads();
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+unsigned WorkerPool::defaultThreads() {
+    //GITLITE_THREADS overrides, e.g. to exercise concurrency on a single core
+    const char* env = std::getenv("GITLITE_THREADS");
+    if (env) {
+        unsigned long n = std::strtoul(env, nullptr, 10);
+        if (n > 0 && n <= 64) return static_cast<unsigned>(n);
+    }
+    unsigned hw = std::thread::hardware_concurrency();
+    if (hw == 0) hw = 2;
+    //object copies are io bound, more threads than this only adds contention
+    return std::min(hw, 8u);
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        tasks.push_back(std::move(task));
+        ++in_flight;
+    }
+    task_ready.notify_one();
+}
+
+void WorkerPool::wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    all_done.wait(lock, [this] { return in_flight == 0; });
+
+    if (first_error) {
+        std::exception_ptr err = first_error;
+        first_error = nullptr;
+        std::rethrow_exception(err);
+    }
+}
+
+void WorkerPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            task_ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;  // stopping and drained
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!first_error) first_error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            --in_flight;
+            if (in_flight == 0) all_done.notify_all();
+        }
+    }
+}
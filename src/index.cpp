@@ -2,11 +2,47 @@
 #include "Utils.h"
 #include "GitliteException.h"
 #include "Objects.hpp"
+#include "Trace.hpp"
+#include <ctime>
 #include <sstream>
+#include <sys/stat.h>
 #include <utility>
 
-void index::add_entry(std::string path , std::string hash) {
-    entries[path] = std::move(hash);
+namespace {
+    //last index this process read or wrote, reused while the file is unchanged
+    //(a long-lived process such as `gitlite batch` then skips re-parsing it)
+    struct IndexCache {
+        bool valid = false;
+        ino_t ino = 0;
+        off_t size = 0;
+        struct timespec mtime = {0, 0};
+        std::map<std::string, ObjectId> entries;
+        std::vector<std::string> removed_entries;
+    };
+
+    IndexCache& indexCache() {
+        static IndexCache cache;
+        return cache;
+    }
+
+    bool statIndex(const std::string& path, IndexCache& key) {
+        Trace::count(Trace::STAT_CALLS);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return false;
+        key.ino = st.st_ino;
+        key.size = st.st_size;
+        key.mtime = st.st_mtim;
+        return true;
+    }
+
+    bool sameFile(const IndexCache& a, const IndexCache& b) {
+        return a.ino == b.ino && a.size == b.size &&
+               a.mtime.tv_sec == b.mtime.tv_sec && a.mtime.tv_nsec == b.mtime.tv_nsec;
+    }
+}
+
+void index::add_entry(std::string path , const ObjectId& hash) {
+    entries[path] = hash;
 }
 
 void index::add_rm_entry(std::string path) {
@@ -31,12 +67,8 @@ bool index::indentical(const std::string &path, Blob & obj) {
 
 
 void index::write() {
-    //delete old index
-    if (Utils::exists(INDEX_PATH)) {
-        std::remove(INDEX_PATH.c_str());
-    }
-
-    //create new one
+    Trace::Phase phase("index.write");
+    //replaces the old index atomically
     std::stringstream ss;
     for (const auto& pair : entries) {
         // hash + \space  + path + '\n'
@@ -50,9 +82,26 @@ void index::write() {
     }
 
     Utils::writeContents(INDEX_PATH, ss.str());
+
+    IndexCache& cache = indexCache();
+    cache.valid = statIndex(INDEX_PATH, cache);
+    cache.entries = entries;
+    cache.removed_entries = removed_entries;
 }
 
 void index::load() {
+    Trace::Phase phase("index.load");
+    IndexCache& cache = indexCache();
+    IndexCache current;
+    //stat before reading: if the file changes meanwhile the next load sees a new stamp
+    bool have_stat = statIndex(INDEX_PATH, current);
+    if (cache.valid && have_stat && sameFile(cache, current)) {
+        Trace::count(Trace::INDEX_CACHE_HITS);
+        entries = cache.entries;
+        removed_entries = cache.removed_entries;
+        return;
+    }
+
     if (!Utils::exists(INDEX_PATH)) {
         entries.clear();
     }
@@ -61,8 +110,8 @@ void index::load() {
         std::string raw_data;
         try {
             raw_data = Utils::readContentsAsString(INDEX_PATH);
-        } catch (const std::invalid_argument& e) {
-            throw std::runtime_error("Error reading object file: " + std::string(e.what()));
+        } catch (const GitliteException& e) {
+            throw GitliteException("Error reading index: " + std::string(e.what()));
         }
 
         //read
@@ -74,11 +123,12 @@ void index::load() {
             if (hash == REMOVED_DELIMITER) {
                 break;
             }
-            if (hash.length() != 40) {
+            ObjectId oid;
+            if (!ObjectId::parseHex(hash.data(), hash.size(), oid)) {
                 throw GitliteException("a index row must be hash + path");
             }
             data >> path;
-            entries[path] = hash;
+            entries[path] = oid;
             hash.clear() , path.clear();
         }
         while (data>>path) {
@@ -86,6 +136,13 @@ void index::load() {
             hash.clear() , path.clear();
         }
     }
+
+    if (have_stat) {
+        current.valid = true;
+        current.entries = entries;
+        current.removed_entries = removed_entries;
+        cache = current;
+    }
 }
 
 void index::clear() {
@@ -93,5 +150,59 @@ void index::clear() {
     removed_entries.clear();
 }
 
+bool StatCache::lookup(const std::string& path, const struct stat& st, ObjectId& oid) const {
+    auto it = stamps.find(path);
+    if (it == stamps.end()) return false;
+    const Stamp& s = it->second;
+    if (s.ino != st.st_ino || s.size != st.st_size ||
+        s.mtime.tv_sec != st.st_mtim.tv_sec || s.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        return false;
+    }
+    oid = s.oid;
+    return true;
+}
+
+void StatCache::record(const std::string& path, const struct stat& st, const ObjectId& oid) {
+    //a file modified this second may change again without a new mtime on coarse clocks
+    if (st.st_mtim.tv_sec >= std::time(nullptr)) {
+        if (stamps.erase(path)) dirty = true;
+        return;
+    }
+    Stamp s;
+    s.ino = st.st_ino;
+    s.size = st.st_size;
+    s.mtime = st.st_mtim;
+    s.oid = oid;
+    stamps[path] = s;
+    dirty = true;
+}
 
+void StatCache::write() {
+    if (!dirty) return;
+    // hash ino size sec nsec path
+    std::stringstream ss;
+    for (const auto& pair : stamps) {
+        const Stamp& s = pair.second;
+        ss << s.oid << " " << s.ino << " " << s.size << " "
+           << s.mtime.tv_sec << " " << s.mtime.tv_nsec << " " << pair.first << "\n";
+    }
+    Utils::writeContents(STAT_PATH, ss.str());
+    dirty = false;
+}
 
+void StatCache::load() {
+    stamps.clear();
+    if (!Utils::exists(STAT_PATH)) return;
+    std::stringstream data(Utils::readContentsAsString(STAT_PATH));
+    std::string hash;
+    std::string path;
+    Stamp s;
+    while (data >> hash >> s.ino >> s.size >> s.mtime.tv_sec >> s.mtime.tv_nsec >> path) {
+        //only a cache: anything unreadable just means rehashing
+        if (!ObjectId::parseHex(hash.data(), hash.size(), s.oid)) {
+            stamps.clear();
+            return;
+        }
+        stamps[path] = s;
+    }
+}
@@ -0,0 +1,130 @@
+import sys, os, hashlib
+from subprocess import run, PIPE
+from os.path import abspath, dirname, join, isfile
+from tempfile import mkdtemp
+from shutil import rmtree
+
+USAGE = """\
+Usage: python3 bad_packs.py [--keep]
+
+Pushes hand-built packs to `gitlite serve` over stdin/stdout and checks
+how the server repository copes.  A pack that repeats an object must be
+accepted and leave a readable pack index.  A rejected push (bad checksum,
+bad ref name, pushed commit missing) must leave nothing in objects/pack.
+The repository must stay usable (`hash-object -w`, `add`, `log`) after
+every push, accepted or not.
+"""
+
+
+def find_gitlite():
+    root = dirname(dirname(abspath(__file__)))
+    for path in (join(root, 'build', 'gitlite'), join(root, 'cmake-build-debug', 'gitlite')):
+        if isfile(path):
+            return path
+    print("Could not find gitlite executable.", file=sys.stderr)
+    sys.exit(1)
+
+
+def loose(repo, oid):
+    """Raw bytes of a loose object: b"<type> <size>\\0\\n<content>"."""
+    with open(join(repo, '.gitlite', 'objects', oid[:2], oid[2:]), 'rb') as f:
+        return f.read()
+
+
+def pack(raws):
+    """A pack stream (see include/Pack.hpp) holding RAWS in order."""
+    body = b"GITLITE-PACK 1 %d\n" % len(raws)
+    for raw in raws:
+        nul = raw.index(b"\0")
+        body += raw[:nul] + b"\n" + raw[nul + 2:]
+    return body + hashlib.sha1(body).hexdigest().encode() + b"\n"
+
+
+def serve(gitlite, repo, request, data):
+    out = run([gitlite, 'serve'], cwd=repo, input=request + data + b"quit\n", stdout=PIPE)
+    return out.stdout.decode(errors='replace').strip()
+
+
+def pack_files(repo):
+    pack_dir = join(repo, '.gitlite', 'objects', 'pack')
+    return sorted(os.listdir(pack_dir)) if os.path.isdir(pack_dir) else []
+
+
+def rejected(gitlite, repo, problems, label, request, data):
+    """Push DATA with REQUEST, expect an error and no trace in objects/pack."""
+    before = pack_files(repo)
+    reply = serve(gitlite, repo, request, data)
+    if not reply.startswith("error "):
+        problems.append("%s: push not rejected: %s" % (label, reply))
+    if pack_files(repo) != before:
+        problems.append("%s: objects/pack changed: %s" % (label, pack_files(repo)))
+    usable(gitlite, repo, problems, label)
+
+
+def usable(gitlite, repo, problems, label):
+    """Commands that open every pack index must still work."""
+    with open(join(repo, 'probe.txt'), 'w') as f:
+        f.write(label + "\n")
+    for args in (['hash-object', '-w', 'probe.txt'], ['add', 'probe.txt'], ['log']):
+        out = run([gitlite] + args, cwd=repo, stdout=PIPE, stderr=PIPE, universal_newlines=True)
+        if "Corrupted" in out.stdout + out.stderr or out.returncode != 0:
+            problems.append("%s: `%s` failed: %s" % (label, " ".join(args), (out.stdout + out.stderr).strip()[:200]))
+
+
+def main(args):
+    keep = False
+    for arg in args:
+        if arg == '--keep':
+            keep = True
+        else:
+            print(USAGE)
+            sys.exit(1)
+
+    gitlite = find_gitlite()
+    root = mkdtemp(prefix='gitlite-packs-')
+    problems = []
+    try:
+        client, server = join(root, 'client'), join(root, 'server')
+        os.mkdir(client)
+        os.mkdir(server)
+        run([gitlite, 'init'], cwd=client, stdout=PIPE, check=True)
+        run([gitlite, 'init'], cwd=server, stdout=PIPE, check=True)
+        with open(join(client, 'f.txt'), 'w') as f:
+            f.write("pushed twice\n")
+        run([gitlite, 'add', 'f.txt'], cwd=client, stdout=PIPE, check=True)
+        run([gitlite, 'commit', 'add f'], cwd=client, stdout=PIPE, check=True)
+        blob = run([gitlite, 'hash-object', 'f.txt'], cwd=client, stdout=PIPE,
+                   universal_newlines=True).stdout.strip()
+        with open(join(client, '.gitlite', 'refs', 'heads', 'master')) as f:
+            commit = f.read().strip()
+
+        raws = [loose(client, blob), loose(client, commit)]
+        good = pack(raws)
+        push = b"push refs/heads/dup - %s\n" % commit.encode()
+        rejected(gitlite, server, problems, "bad checksum", push, good[:-3] + b"00\n")
+        rejected(gitlite, server, problems, "bad ref name",
+                 b"push refs/tags/dup - %s\n" % commit.encode(), good)
+        rejected(gitlite, server, problems, "commit missing", push, pack(raws[:1]))
+
+        # the same blob twice, then the commit
+        raws = [loose(client, blob), loose(client, blob), loose(client, commit)]
+        reply = serve(gitlite, server, push, pack(raws))
+        if reply != "ok":
+            problems.append("duplicate object: push not accepted: " + reply)
+        usable(gitlite, server, problems, "duplicate object")
+    finally:
+        for err in problems:
+            print("  " + err)
+        if keep:
+            print("Repositories kept in " + root)
+        else:
+            rmtree(root)
+    if problems:
+        print("FAILED: %d problems" % len(problems))
+        return 1
+    print("OK")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,128 @@
+import sys, os, json
+from subprocess import run, PIPE
+from os.path import abspath, dirname, join, isfile
+from tempfile import mkdtemp
+from shutil import rmtree
+from time import time
+
+USAGE = """\
+Usage: python3 stress_merge.py [--files=M] [--runs=R] [--threads=T] [--keep]
+
+Merges two branches that both edit every one of M files (one at the top,
+one at the bottom), so the merge writes M new blobs and M worktree files
+at the same time from a T-thread worker pool (GITLITE_THREADS, default 8
+whatever the core count) under GITLITE_FSYNC=batched.  Fails if the merge
+errs, a merged file is wrong, or the trace shows fewer fsyncs than objects
+written (a pending-sync registration lost to a race).  Build with
+-fsanitize=thread to have every race reported, not just lost ones.
+"""
+
+LINES = 20
+
+
+def find_gitlite():
+    root = dirname(dirname(abspath(__file__)))
+    for path in (join(root, 'build', 'gitlite'), join(root, 'cmake-build-debug', 'gitlite')):
+        if isfile(path):
+            return path
+    print("Could not find gitlite executable.", file=sys.stderr)
+    sys.exit(1)
+
+
+def content(i, top, bottom):
+    lines = ["line %d of f%d\n" % (n, i) for n in range(LINES)]
+    if top:
+        lines[0] = "top %d\n" % i
+    if bottom:
+        lines[-1] = "bottom %d\n" % i
+    return "".join(lines)
+
+
+def write_all(repo, files, top, bottom):
+    for i in range(files):
+        with open(join(repo, 'f%d.txt' % i), 'w') as f:
+            f.write(content(i, top, bottom))
+
+
+def batch(gitlite, repo, commands):
+    """Run COMMANDS in one `gitlite batch`, fail on the first error frame."""
+    out = run([gitlite, 'batch'], cwd=repo, input="\n".join(commands) + "\n",
+              stdout=PIPE, universal_newlines=True).stdout
+    if "\nerror " in "\n" + out:
+        raise RuntimeError("setup failed: " + out[out.find("error"):][:200])
+
+
+def one_run(gitlite, files, threads):
+    repo = mkdtemp(prefix='gitlite-merge-')
+    names = ['f%d.txt' % i for i in range(files)]
+    run([gitlite, 'init'], cwd=repo, stdout=PIPE, check=True)
+    write_all(repo, files, False, False)
+    batch(gitlite, repo, ["add " + n for n in names] + ['commit base', 'branch other'])
+    write_all(repo, files, True, False)
+    batch(gitlite, repo, ["add " + n for n in names] + ['commit top'])
+    batch(gitlite, repo, ['checkout other'])
+    write_all(repo, files, False, True)
+    batch(gitlite, repo, ["add " + n for n in names] + ['commit bottom', 'checkout master'])
+
+    trace = join(repo, 'trace.json')
+    env = dict(os.environ, GITLITE_FSYNC='batched', GITLITE_TRACE=trace, GITLITE_THREADS=str(threads))
+    start = time()
+    merge = run([gitlite, 'merge', 'other'], cwd=repo, env=env, stdout=PIPE, stderr=PIPE,
+                universal_newlines=True)
+    elapsed = time() - start
+
+    problems = []
+    if merge.returncode != 0 or merge.stdout.strip():
+        problems.append("merge: " + (merge.stdout + merge.stderr).strip()[:200])
+    for i in range(files):
+        with open(join(repo, 'f%d.txt' % i)) as f:
+            if f.read() != content(i, True, True):
+                problems.append("f%d.txt not merged" % i)
+    if not isfile(trace):
+        problems.append("merge wrote no trace (exit status %d)" % merge.returncode)
+        return repo, elapsed, problems
+    with open(trace) as f:
+        counters = json.loads(f.read().splitlines()[-1])['counters']
+    if counters['fsync_calls'] < counters['objects_written']:
+        problems.append("%d objects written, only %d fsyncs"
+                        % (counters['objects_written'], counters['fsync_calls']))
+    return repo, elapsed, problems
+
+
+def main(args):
+    files, runs, threads, keep = 2000, 3, 8, False
+    for arg in args:
+        if arg.startswith('--files='):
+            files = int(arg[8:])
+        elif arg.startswith('--runs='):
+            runs = int(arg[7:])
+        elif arg.startswith('--threads='):
+            threads = int(arg[10:])
+        elif arg == '--keep':
+            keep = True
+        else:
+            print(USAGE)
+            sys.exit(1)
+
+    gitlite = find_gitlite()
+    failed = 0
+    for r in range(runs):
+        repo, elapsed, problems = one_run(gitlite, files, threads)
+        print("run %d: merged %d files in %.2fs" % (r, files, elapsed))
+        for err in problems[:20]:
+            print("  " + err)
+        if problems:
+            failed += 1
+        if keep:
+            print("Repository kept in " + repo)
+        else:
+            rmtree(repo)
+    if failed:
+        print("FAILED: %d of %d runs" % (failed, runs))
+        return 1
+    print("OK")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,130 @@
+import sys, os, re, random
+from subprocess import Popen, check_output, DEVNULL
+from os.path import abspath, dirname, join, isfile
+from tempfile import mkdtemp
+from shutil import rmtree
+from time import time
+
+USAGE = """\
+Usage: python3 stress_writers.py [--writers=N] [--files=M] [--keep]
+
+Runs N `gitlite hash-object -w` processes against one repository at the
+same time, each storing the same M files in a different order, while this
+script keeps reading every object file it can see.  Fails if a reader ever
+observes a partial object, if two writers disagree on an id, or if an
+object is missing at the end.
+"""
+
+HEADER = re.compile(rb"^(blob|commit) (\d+)\0\n")
+
+
+def find_gitlite():
+    root = dirname(dirname(abspath(__file__)))
+    for path in (join(root, 'build', 'gitlite'), join(root, 'cmake-build-debug', 'gitlite')):
+        if isfile(path):
+            return path
+    print("Could not find gitlite executable.", file=sys.stderr)
+    sys.exit(1)
+
+
+def check_object(path):
+    """None if PATH holds a complete object, otherwise what is wrong."""
+    try:
+        with open(path, 'rb') as f:
+            data = f.read()
+    except FileNotFoundError:
+        return None
+    m = HEADER.match(data)
+    if not m:
+        return "bad header"
+    if len(data) - m.end() != int(m.group(2)):
+        return "size %s, got %d bytes" % (m.group(2).decode(), len(data) - m.end())
+    return None
+
+
+def scan(objects):
+    problems = []
+    for sub in os.listdir(objects):
+        if len(sub) != 2:
+            continue
+        for name in os.listdir(join(objects, sub)):
+            if len(name) != 38:
+                continue      # a writer's temp file
+            err = check_object(join(objects, sub, name))
+            if err:
+                problems.append((sub + name, err))
+    return problems
+
+
+def main(args):
+    writers, files, keep = 8, 200, False
+    for arg in args:
+        if arg.startswith('--writers='):
+            writers = int(arg[10:])
+        elif arg.startswith('--files='):
+            files = int(arg[8:])
+        elif arg == '--keep':
+            keep = True
+        else:
+            print(USAGE)
+            sys.exit(1)
+
+    gitlite = find_gitlite()
+    repo = mkdtemp(prefix='gitlite-stress-')
+    try:
+        check_output([gitlite, 'init'], cwd=repo)
+        inputs = join(repo, 'in')
+        os.mkdir(inputs)
+        names = []
+        for i in range(files):
+            name = join(inputs, 'f%d.txt' % i)
+            with open(name, 'w') as f:
+                f.write(("line %d\n" % i) * random.randint(1, 2000))
+            names.append(name)
+
+        start = time()
+        procs, outputs = [], []
+        for w in range(writers):
+            order = names[:]
+            random.shuffle(order)
+            script = "; ".join("%s hash-object -w %s" % (gitlite, n) for n in order)
+            out = open(join(repo, 'writer%d.out' % w), 'w+')
+            procs.append((Popen(['sh', '-c', script], cwd=repo, stdout=out, stderr=DEVNULL), order))
+            outputs.append(out)
+
+        objects = join(repo, '.gitlite', 'objects')
+        problems, scans = [], 0
+        while any(p.poll() is None for p, _ in procs):
+            problems += scan(objects)
+            scans += 1
+        elapsed = time() - start
+
+        ids = {}
+        for (p, order), out in zip(procs, outputs):
+            out.seek(0)
+            for name, oid in zip(order, out.read().split()):
+                if ids.setdefault(name, oid) != oid:
+                    problems.append((oid, "writers disagree on the id of " + name))
+            out.close()
+        for oid in set(ids.values()):
+            if not isfile(join(objects, oid[:2], oid[2:])):
+                problems.append((oid, "missing after all writers finished"))
+        problems += scan(objects)
+
+        print("%d writers x %d files in %.2fs, %d concurrent scans" % (writers, files, elapsed, scans))
+        for oid, err in problems[:20]:
+            print("  %s: %s" % (oid, err))
+        if problems:
+            print("FAILED: %d problems" % len(problems))
+            return 1
+        print("OK")
+        return 0
+    finally:
+        if keep:
+            print("Repository kept in " + repo)
+        else:
+            rmtree(repo)
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))